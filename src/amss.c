@@ -3,27 +3,178 @@
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #include "amss.h"
 #include "util/logger.h"
 
 
 
-void gen_next_key(hash_t* sk, key_s* hashkey){
-    HASH_keyhash(sk, sk, CFG_WOTS_SEED_SIZE, hashkey);   // ensures forward security
+/*
+ * Hashes into a CFG_WOTS_SEED_SIZE-byte seed. A shorter digest leaves the
+ * remaining bytes unchanged, a longer one (e.g. SHAKE-256) is truncated.
+ */
+static void hash_to_seed(const HASH_Ctx* hash, hash_t* seed_out, const byte_t* input, size_t input_length, const key_s* hashkey){
+    const size_t size = hash->config.size;
+    hash_t digest[size];
+    HASH_keyhash(hash, digest, input, input_length, hashkey);
+    memcpy(seed_out, digest, (size < CFG_WOTS_SEED_SIZE) ? size : CFG_WOTS_SEED_SIZE);
+    memset(digest, 0, size);
 }
 
 
-void gen_grow_key(hash_t* growk, hash_t* sk, key_s* hashkey){
-    HASH_keyhash(growk, sk, CFG_WOTS_SEED_SIZE, hashkey);   // ensures forward security
+void gen_next_key(const HASH_Ctx* hash, hash_t* sk, key_s* hashkey){
+    HASH_Phase_t phase = HASH_set_phase(HASH_PHASE_KEY);
+    hash_to_seed(hash, sk, sk, CFG_WOTS_SEED_SIZE, hashkey);   // ensures forward security
+    HASH_set_phase(phase);
+}
+
+
+void gen_grow_key(const HASH_Ctx* hash, hash_t* growk, hash_t* sk, key_s* hashkey){
+    HASH_Phase_t phase = HASH_set_phase(HASH_PHASE_KEY);
+    hash_to_seed(hash, growk, sk, CFG_WOTS_SEED_SIZE, hashkey);   // ensures forward security
+    HASH_set_phase(phase);
+}
+
+
+static size_t cp_slots(const AMSA_Amss* amss){
+    return (size_t)1 << amss->tree.exist.height;
+}
+
+
+/*
+ * Generates the wots pubkey of leaf_idx from the imported seckey and
+ * keeps its chain checkpoints if the cache is enabled.
+ */
+static void gen_leaf_pubkey(AMSA_Amss* amss, MT_index_t leaf_idx){
+    if (amss->cp_interval == 0 || leaf_idx >= amss->tree.leaf_idx + cp_slots(amss)){   // only the bottom layer is signed soon
+        WOTS_generate_pubkey( &(amss->wots) );
+        return;
+    }
+    const size_t slot = leaf_idx % cp_slots(amss);
+    const size_t size = WOTS_checkpoints_size( &(amss->wots), amss->cp_interval );
+    WOTS_generate_pubkey_checkpoints( &(amss->wots), amss->cp_interval, amss->checkpoints + slot*size );
+    amss->cp_leaf[slot] = leaf_idx;
+}
+
+
+// ============================================================================
+// GGM leaf seeds
+// ============================================================================
+
+/* child of a GGM node: H(node || bit) */
+static void ggm_child(const AMSA_Amss* amss, const hash_t* node, uint8_t bit, hash_t* child_out){
+    byte_t input[CFG_WOTS_SEED_SIZE + 1];
+    memcpy(input, node, CFG_WOTS_SEED_SIZE);
+    input[CFG_WOTS_SEED_SIZE] = bit;
+    memset(child_out, 0, CFG_WOTS_SEED_SIZE);   // n < seed size: remaining bytes are zero
+    HASH_Phase_t phase = HASH_set_phase(HASH_PHASE_KEY);
+    hash_to_seed( &(amss->wots.hash), child_out, input, sizeof(input), &(amss->hashkey));
+    HASH_set_phase(phase);
+}
+
+
+/* The unused leaves ggm_next..2^h-1 are covered by one node per set bit of 2^h - ggm_next, lowest height first. */
+static uint32_t ggm_cover(const AMSA_Amss* amss){
+    return (1u << amss->tree.config.height) - amss->ggm_next;
+}
+
+
+/* Starts the punctured tree with the root. Moves the secret key into it. */
+static void ggm_reset(AMSA_Amss* amss){
+    const unsigned height = amss->tree.config.height;
+    memset(amss->ggm_nodes, 0, (height+1) * CFG_WOTS_SEED_SIZE);
+    memcpy(amss->ggm_nodes + height*CFG_WOTS_SEED_SIZE, amss->secret_key, CFG_WOTS_SEED_SIZE);
+    memset(amss->secret_key, 0, CFG_WOTS_SEED_SIZE);
+    amss->ggm_next = 0;
+}
+
+
+/**
+ * Derives the seed of an unused leaf from the node that covers it: h hashes at most.
+ * \return 0 on success, -1 if the leaf is already punctured
+ */
+static int ggm_leaf_seed(const AMSA_Amss* amss, uint32_t leaf_idx, hash_t* seed_out){
+    const uint32_t cover = ggm_cover(amss);
+    uint32_t start = amss->ggm_next;
+
+    if (leaf_idx < amss->ggm_next || cover == 0) return -1;
+    for (int height = 0; height <= amss->tree.config.height; height++){
+        if (((cover >> height) & 1) == 0) continue;
+        if (leaf_idx < start + (1u << height)){   // aligned node: the low bits of leaf_idx are the path
+            memcpy(seed_out, amss->ggm_nodes + height*CFG_WOTS_SEED_SIZE, CFG_WOTS_SEED_SIZE);
+            for (int h = height-1; h >= 0; h--) ggm_child(amss, seed_out, (leaf_idx >> h) & 1, seed_out);
+            return 0;
+        }
+        start += 1u << height;
+    }
+    return -1;
+}
+
+
+/**
+ * Punctures leaf ggm_next: its covering node is replaced by the right
+ * siblings on the path down to the leaf, and the leaf is discarded.
+ */
+static void ggm_puncture(AMSA_Amss* amss){
+    const uint32_t cover = ggm_cover(amss);
+    hash_t node[CFG_WOTS_SEED_SIZE];
+    int height = 0;
+
+    if (cover == 0) return;
+    while (((cover >> height) & 1) == 0) height++;
+    memcpy(node, amss->ggm_nodes + height*CFG_WOTS_SEED_SIZE, CFG_WOTS_SEED_SIZE);
+    memset(amss->ggm_nodes + height*CFG_WOTS_SEED_SIZE, 0, CFG_WOTS_SEED_SIZE);
+    for (int h = height-1; h >= 0; h--){
+        ggm_child(amss, node, 1, amss->ggm_nodes + h*CFG_WOTS_SEED_SIZE);
+        ggm_child(amss, node, 0, node);
+    }
+    memset(node, 0, CFG_WOTS_SEED_SIZE);
+    amss->ggm_next++;
+}
+
+
+
+static void wipe_grow_cursor(AMSA_Amss* amss, unsigned cursor){
+    memset(amss->grow_key + cursor*CFG_WOTS_SEED_SIZE, 0, CFG_WOTS_SEED_SIZE);
+    amss->grow_idx[cursor] = UINT32_MAX;
+}
+
+
+/* forward secure: wipes the cursors at leaves that are signed already */
+static void wipe_passed_grow_cursors(AMSA_Amss* amss){
+    for (unsigned cursor = 0; cursor < amss->num_grow; cursor++){
+        if (amss->grow_idx[cursor] != UINT32_MAX && amss->grow_idx[cursor] < amss->tree.leaf_idx) wipe_grow_cursor(amss, cursor);
+    }
+}
+
+
+/**
+ * Derives the seed of an unused leaf for growing. With AMSA_KEYS_CHAIN it moves
+ * the cursor of the grow stream to the leaf: one hash per signature and fractal
+ * layer, a jump per restart of a BDS treehash instance.
+ * \return 0 on success, -1 if the GGM leaf is already punctured
+ */
+static int gen_grow_seed(AMSA_Amss* amss, uint32_t leaf_idx, hash_t* seed_out){
+    if (amss->key_mode == AMSA_KEYS_GGM) return ggm_leaf_seed(amss, leaf_idx, seed_out);
+    const unsigned cursor = MT_get_grow_stream( &(amss->tree) );
+    hash_t* grow_key = amss->grow_key + cursor*CFG_WOTS_SEED_SIZE;
+    if (amss->grow_idx[cursor] > leaf_idx || amss->grow_idx[cursor] < amss->tree.leaf_idx){  // empty or passed: restart from the next leaf to sign
+        memcpy(grow_key, amss->secret_key, CFG_WOTS_SEED_SIZE);
+        amss->grow_idx[cursor] = amss->tree.leaf_idx;
+    }
+    for(; amss->grow_idx[cursor] < leaf_idx; amss->grow_idx[cursor]++){
+        gen_grow_key( &(amss->wots.hash), grow_key, grow_key, &(amss->hashkey) );
+    }
+    memcpy(seed_out, grow_key, CFG_WOTS_SEED_SIZE);
+    if (leaf_idx == (1u << amss->tree.config.height) - 1) wipe_grow_cursor(amss, cursor);   // last leaf: growing ends
+    return 0;
 }
 
 
 AMSA_Sig AMSA_Sig_init(const AMSA_Config config){
-    const int num_chains = WOTS_num_chains( &(config.cfg_wots) );
-    const size_t size_hash = config.cfg_wots.cfg_hash.size;
     AMSA_Sig sig;
-    WOTS_chains_t* wots = (WOTS_chains_t*) malloc( num_chains*size_hash );
+    WOTS_chains_t* wots = (WOTS_chains_t*) malloc( WOTS_sig_size( &(config.cfg_wots) ) );
     sig.wots = wots;
     sig.auth_path = MT_init_path( &(config.cfg_tree) );
     //sig.leaf_idx = 0;
@@ -42,82 +193,362 @@ AMSA_Amss AMSA_Amss_init(const AMSA_Config config){
     AMSA_Amss amss;
     amss.wots = WOTS_init( &(config.cfg_wots) );
 
-    // todo: determine best fractal height based on available memory
-    amss.tree = MT_init( &(config.cfg_tree), MT_FRACTAL_HALF );
+    // see AMSA_Amss_init_budget() for the split of a memory budget
+    if (config.tree_layers > 2) amss.tree = MT_init_layers( &(config.cfg_tree), config.tree_layers, NULL );
+    else if (config.tree_bottom > 0) amss.tree = MT_init( &(config.cfg_tree), MT_FRACTAL_BOTTOM_HEIGHT(config.tree_bottom) );
+    else amss.tree = MT_init( &(config.cfg_tree), MT_FRACTAL_HALF );
+    if (config.tree_leaf_cache) MT_init_leaf_cache( &(amss.tree) );   // signs without the cache on failure
+
+    // GGM seeds come from the punctured tree: no grow cursors
+    amss.num_grow = (config.key_mode == AMSA_KEYS_CHAIN) ? MT_num_grow_streams( &(amss.tree) ) : 0;
+    amss.grow_key = NULL;
+    amss.grow_idx = NULL;
+    if (amss.num_grow > 0){
+        amss.grow_key = (hash_t*) calloc( amss.num_grow, CFG_WOTS_SEED_SIZE );
+        amss.grow_idx = (uint32_t*) malloc( amss.num_grow * sizeof(uint32_t) );
+        if (amss.grow_key == NULL || amss.grow_idx == NULL) LOG_error("AMSA_Amss_init: Allocation error!");
+        for (unsigned i = 0; i < amss.num_grow && amss.grow_idx != NULL; i++) amss.grow_idx[i] = UINT32_MAX;
+    }
+
+    amss.key_mode = config.key_mode;
+    amss.ggm_nodes = NULL;
+    amss.ggm_next = 0;
+    if (amss.key_mode == AMSA_KEYS_GGM){
+        amss.ggm_nodes = (hash_t*) malloc( (config.cfg_tree.height+1) * CFG_WOTS_SEED_SIZE );
+        if (amss.ggm_nodes == NULL) LOG_error("AMSA_Amss_init: Allocation error!");
+    }
+
+    // signing cache: one slot for each leaf up to 2^h_bottom ahead
+    amss.cp_interval = config.wots_cp_interval;
+    amss.checkpoints = NULL;
+    amss.cp_leaf = NULL;
+    if (amss.cp_interval > 0){
+        const size_t slots = cp_slots(&amss);
+        amss.checkpoints = (hash_t*) malloc( slots * WOTS_checkpoints_size( &(amss.wots), amss.cp_interval ) );
+        amss.cp_leaf = (uint32_t*) malloc( slots * sizeof(uint32_t) );
+        if (amss.checkpoints == NULL || amss.cp_leaf == NULL){
+            LOG_warn("AMSA_Amss_init: No memory for the checkpoint cache. Signing without it.");
+            free(amss.checkpoints);
+            free(amss.cp_leaf);
+            amss.checkpoints = NULL;
+            amss.cp_leaf = NULL;
+            amss.cp_interval = 0;
+        } else {
+            for (size_t slot = 0; slot < slots; slot++) amss.cp_leaf[slot] = UINT32_MAX;
+        }
+    }
     return amss;   
 }
 
 
+// ============================================================================
+// memory budget
+// ============================================================================
+
+static bool is_bds(const AMSA_Config* config){
+    return config->cfg_tree.engine == MT_ENGINE_BDS && config->cfg_tree.height >= 2;
+}
+
+
+// subtree heights of the tree of AMSA_Amss_init(), bottom up. Returns the number of layers.
+static uint8_t tree_split(const AMSA_Config* config, uint8_t* heights){
+    const uint8_t height = config->cfg_tree.height;
+    if (config->tree_layers > 2 && config->tree_layers <= MT_MAX_LAYERS){
+        for (int i = 0; i < config->tree_layers; i++) heights[i] = height / config->tree_layers;
+        heights[config->tree_layers-1] = height - (config->tree_layers-1) * (height / config->tree_layers);
+        return config->tree_layers;
+    }
+    heights[0] = (config->tree_bottom > 0 && config->tree_bottom <= height) ? config->tree_bottom : height - height/2;
+    heights[1] = height - heights[0];
+    return 2;
+}
+
+
+/*
+ * Leaves grown over the lifetime of the key and at most per signature: one per path for every
+ * layer below the top, until its next subtree would start past the last leaf. BDS grows up to
+ * (h-k)/2 leaves for every path but the last.
+ */
+static void grow_cost(const AMSA_Config* config, uint64_t* total, unsigned* worst){
+    uint8_t heights[MT_MAX_LAYERS];
+    const uint8_t num_layers = tree_split(config, heights);
+    const uint8_t height = config->cfg_tree.height;
+    uint8_t lower_height = 0;
+    *total = 0;
+    *worst = 0;
+    if (is_bds(config)){
+        *worst = (height - MT_bds_k( &(config->cfg_tree) )) / 2;
+        *total = (((uint64_t)1 << height) - 1) * *worst;
+        return;
+    }
+    for (int i = 0; i < num_layers-1; i++){
+        lower_height += heights[i];
+        if (lower_height == height) break;
+        *total += ((uint64_t)1 << height) - ((uint64_t)1 << lower_height);
+        *worst += 1;
+    }
+}
+
+
+void AMSA_sign_cost(const AMSA_Config config, double* avg_hashes, double* worst_hashes){
+    WOTS_Wots wots = WOTS_init( &(config.cfg_wots) );
+    const double num_chains = wots.num_chains;
+    const double steps = config.cfg_wots.code_base - 1;   // chain length
+    const double num_leafs = (double)((uint64_t)1 << config.cfg_tree.height);
+    WOTS_free( &wots );
+
+    // WOTS signature: the seed and half a chain on average, or the steps from the last checkpoint
+    double sign_avg = num_chains * (1 + steps/2);
+    double sign_worst = num_chains * (1 + steps);
+    if (config.wots_cp_interval > 0){
+        const double interval = (config.wots_cp_interval < steps) ? config.wots_cp_interval : steps;
+        sign_avg = num_chains * (interval - 1) / 2;
+        sign_worst = num_chains * (interval - 1);
+    }
+    // left leaves are recomputed from the signature unless they are cached
+    double leaf_avg = 0;
+    double leaf_worst = 0;
+    if (!config.tree_leaf_cache || is_bds(&config)){
+        leaf_avg = num_chains * steps / 4;
+        leaf_worst = num_chains * steps;
+    }
+    // grown leaves: seeds and full chains
+    uint64_t grow_total;
+    unsigned grow_worst;
+    grow_cost(&config, &grow_total, &grow_worst);
+    const double leaf_gen = num_chains * (1 + steps);
+
+    *avg_hashes = sign_avg + leaf_avg + grow_total * leaf_gen / num_leafs;
+    *worst_hashes = sign_worst + leaf_worst + grow_worst * leaf_gen;
+}
+
+
+size_t AMSA_sizeof_amss(const AMSA_Config config){
+    uint8_t heights[MT_MAX_LAYERS];
+    const uint8_t num_layers = tree_split(&config, heights);
+    const uint8_t height_bottom = is_bds(&config) ? 0 : heights[0];   // BDS: checkpoint slot of the next leaf
+    size_t size = sizeof(AMSA_Amss) + config.cfg_wots.cfg_hash.size;   // and the wots pubkey
+    size += MT_sizeof_split( &(config.cfg_tree), num_layers, heights, config.tree_leaf_cache );
+    if (config.key_mode == AMSA_KEYS_GGM){
+        size += (config.cfg_tree.height+1) * CFG_WOTS_SEED_SIZE;
+    } else {
+        const size_t num_grow = is_bds(&config) ? config.cfg_tree.height : num_layers - 1u;   // BDS: h-k streams at most
+        size += num_grow * (CFG_WOTS_SEED_SIZE + sizeof(uint32_t));
+    }
+    if (config.wots_cp_interval > 0){
+        WOTS_Wots wots = WOTS_init( &(config.cfg_wots) );
+        size += ((size_t)1 << height_bottom) * (WOTS_checkpoints_size( &wots, config.wots_cp_interval ) + sizeof(uint32_t));
+        WOTS_free( &wots );
+    }
+    return size;
+}
+
+
+AMSA_Config AMSA_config_budget(const AMSA_Config config, size_t max_bytes){
+    const uint8_t height = config.cfg_tree.height;
+    if (is_bds(&config)){
+        if (AMSA_sizeof_amss(config) > max_bytes) LOG_warn("AMSA_config_budget: BDS needs %zu of %zu bytes.", AMSA_sizeof_amss(config), max_bytes);
+        return config;
+    }
+
+    AMSA_Config best = config;
+    AMSA_Config smallest = config;
+    double best_avg = 0;
+    double best_worst = 0;
+    size_t best_size = SIZE_MAX;
+    size_t smallest_size = SIZE_MAX;
+
+    // every split with and without each signing cache of config
+    for (int caches = 0; caches < 4; caches++){
+        AMSA_Config candidate = config;
+        if (caches & 1){
+            if (config.wots_cp_interval == 0) continue;
+            candidate.wots_cp_interval = 0;
+        }
+        if (caches & 2){
+            if (!config.tree_leaf_cache) continue;
+            candidate.tree_leaf_cache = false;
+        }
+        // 2 layers with bottom heights 1..h, then more layers split evenly
+        for (uint8_t num_layers = 2; num_layers <= MT_MAX_LAYERS && num_layers <= height; num_layers++){
+            for (uint8_t bottom = 1; bottom <= height; bottom++){
+                if (num_layers > 2 && bottom > 1) break;
+                candidate.tree_layers = (num_layers > 2) ? num_layers : 0;
+                candidate.tree_bottom = (num_layers > 2) ? 0 : bottom;
+                const size_t size = AMSA_sizeof_amss(candidate);
+                if (size < smallest_size){
+                    smallest = candidate;
+                    smallest_size = size;
+                }
+                if (size > max_bytes) continue;
+
+                double avg, worst;
+                AMSA_sign_cost(candidate, &avg, &worst);
+                if (best_size == SIZE_MAX || avg < best_avg || (avg == best_avg && (worst < best_worst || (worst == best_worst && size < best_size)))){
+                    best = candidate;
+                    best_avg = avg;
+                    best_worst = worst;
+                    best_size = size;
+                }
+            }
+        }
+    }
+
+    if (best_size == SIZE_MAX){
+        LOG_warn("AMSA_config_budget: %zu bytes are not enough, using the smallest split of %zu bytes.", max_bytes, smallest_size);
+        return smallest;
+    }
+    LOG_info("AMSA_config_budget: %d layers, bottom height %d, checkpoint interval %d, leaf cache %d, %zu of %zu bytes, %.0f hashes per signature.",
+        (best.tree_layers > 2) ? best.tree_layers : 2, (best.tree_layers > 2) ? height / best.tree_layers : best.tree_bottom,
+        best.wots_cp_interval, best.tree_leaf_cache, best_size, max_bytes, best_avg);
+    return best;
+}
+
+
+AMSA_Amss AMSA_Amss_init_budget(const AMSA_Config config, size_t max_bytes){
+    return AMSA_Amss_init( AMSA_config_budget(config, max_bytes) );
+}
+
+
+
 void AMSA_Amss_free(AMSA_Amss* amss){
     WOTS_free( &(amss->wots) );
 	MT_free( &(amss->tree) );    
+    if (amss->checkpoints != NULL){
+        memset(amss->checkpoints, 0, cp_slots(amss) * WOTS_checkpoints_size( &(amss->wots), amss->cp_interval ));
+        free(amss->checkpoints);
+        free(amss->cp_leaf);
+        amss->checkpoints = NULL;
+        amss->cp_leaf = NULL;
+    }
+    if (amss->grow_key != NULL){
+        memset(amss->grow_key, 0, amss->num_grow * CFG_WOTS_SEED_SIZE);
+        free(amss->grow_key);
+        free(amss->grow_idx);
+        amss->grow_key = NULL;
+        amss->grow_idx = NULL;
+    }
+    if (amss->ggm_nodes != NULL){
+        memset(amss->ggm_nodes, 0, (amss->tree.config.height+1) * CFG_WOTS_SEED_SIZE);
+        free(amss->ggm_nodes);
+        amss->ggm_nodes = NULL;
+    }
 }
 
 
 
-void AMSA_generate(AMSA_Amss* amss, const byte_t* seed, AMSA_Pubkey* pubkey_out){
+int AMSA_generate(AMSA_Amss* amss, const byte_t* seed, AMSA_Pubkey* pubkey_out){
     
+    if (amss->wots.root == NULL){   // WOTS_init() rejected the config
+        LOG_error("AMSA_generate: invalid WOTS config, no key generated.");
+        return -1;
+    }
     AMSA_Config config = { amss->tree.config, amss->wots.config };
 
-    // init hash
-    const size_t size_hash = config.cfg_wots.cfg_hash.size;
-    HASH_config( config.cfg_wots.cfg_hash );
-
-
     // store secret key and hashkey from random seed
-    memcpy(amss->secret_key, seed, size_hash);
+    memcpy(amss->secret_key, seed, CFG_WOTS_SEED_SIZE);
     memcpy(amss->hashkey.bytes, seed + CFG_WOTS_SEED_SIZE, CFG_HASH_KEY_SIZE);
 
 
     // create first seed from secret key
-	hash_t wots_seed[size_hash];
-    hash_t seed_first[size_hash];
-    memcpy(wots_seed, amss->secret_key, size_hash);
-    memcpy(seed_first, amss->secret_key, size_hash);
+	hash_t wots_seed[CFG_WOTS_SEED_SIZE];
+    hash_t seed_first[CFG_WOTS_SEED_SIZE];
+    if (amss->key_mode == AMSA_KEYS_GGM){
+        ggm_reset(amss);
+        ggm_leaf_seed(amss, 0, seed_first);
+    } else {
+        memcpy(seed_first, amss->secret_key, CFG_WOTS_SEED_SIZE);
+    }
+    memcpy(wots_seed, seed_first, CFG_WOTS_SEED_SIZE);
+
 
+    // grow cursor of each layer starts at the first leaf of its next subtree, BDS cursors start empty
+    uint32_t grow_first[MT_MAX_LAYERS-1];
+    grow_first[0] = 1u << amss->tree.exist.height;
+    for (int i = 0; i < amss->tree.num_mid; i++) grow_first[i+1] = 1u << (amss->tree.mid[i].lower_height + amss->tree.mid[i].exist.height);
+    for (unsigned i = 0; i < amss->num_grow; i++) wipe_grow_cursor(amss, i);
 
 	for (unsigned int idx = 0; idx < (1 << config.cfg_tree.height); idx++){
+        for (int i = 0; i <= amss->tree.num_mid && amss->num_grow > 0 && amss->tree.bds == NULL; i++){
+            if (idx != grow_first[i]) continue;
+            memcpy(amss->grow_key + i*CFG_WOTS_SEED_SIZE, wots_seed, CFG_WOTS_SEED_SIZE);
+            amss->grow_idx[i] = idx;
+        }
+        if (amss->key_mode == AMSA_KEYS_GGM) ggm_leaf_seed(amss, idx, wots_seed);
         // todo: update hashkey
         //memcpy(&hashkey + 2, &idx, 3);
         WOTS_import_seckey( &(amss->wots), (const hash_t*) &wots_seed, amss->hashkey);
-        WOTS_generate_pubkey( &(amss->wots) );    // gen wots pubkey
+        if (idx < cp_slots(amss)) gen_leaf_pubkey(amss, idx);    // gen wots pubkey
+        else WOTS_generate_pubkey( &(amss->wots) );
 		MT_add(&(amss->tree), amss->wots.root);    // add wots
         //LOG_debug("Gen: seed=%.8s, leaf=%.8s, hashkey=%.8s", HASH_hexstr( wots_seed ), HASH_hexstr( amss->wots.root ), HASH_hexstr( (const byte_t*)&(hashkey) ) );
 
-		gen_next_key(wots_seed, &(amss->hashkey));   // gen wots seed
+		if (amss->key_mode == AMSA_KEYS_CHAIN) gen_next_key( &(amss->wots.hash), wots_seed, &(amss->hashkey));   // gen wots seed
 	}
+    memset(wots_seed, 0, CFG_WOTS_SEED_SIZE);
 
     // AMSA internal:
     WOTS_import_seckey( &amss->wots, seed_first, amss->hashkey );  // regenerate first wots
+    memset(seed_first, 0, CFG_WOTS_SEED_SIZE);
 
     // public key
     AMSA_export_pubkey(amss, pubkey_out);
 
-    LOG_debug("AMSA_generate: Done. pk=%.8s, lidx=%d", HASH_hexstr( pubkey_out->root), amss->tree.leaf_idx );
+    LOG_debug("AMSA_generate: Done. pk=%.8s, lidx=%d", HASH_hexstr( pubkey_out->root, 4 ), amss->tree.leaf_idx );
+    return 0;
 }
 
 
-void AMSA_sign(AMSA_Amss* amss, const hash_t* msg_digest, AMSA_Sig* sig_out){
+int AMSA_sign(AMSA_Amss* amss, const hash_t* msg_digest, AMSA_Sig* sig_out){
 
     // Safety Check
     if (amss->tree.leaf_idx >= (1 << amss->tree.config.height)){
         LOG_error("AMSA_sign: All %d signatures exhausted!", (1 << amss->tree.config.height));
-        return;
+        return -1;
     }
 
     const size_t size_hash = amss->tree.config.cfg_hash.size;
-    hash_t growkey[CFG_WOTS_SEED_SIZE];
 
     // set index
-    sig_out->auth_path.leaf_idx = (uint16_t)amss->tree.leaf_idx;
+    sig_out->auth_path.leaf_idx = amss->tree.leaf_idx;
 
     // WOTS signature
-    WOTS_import_seckey( &(amss->wots), amss->secret_key, amss->hashkey);
-    WOTS_sign( &(amss->wots), msg_digest, sig_out->wots );
-	gen_next_key( amss->secret_key, &(amss->hashkey) );   // forward secure: iterate key and discard previous key
+    if (amss->key_mode == AMSA_KEYS_GGM){
+        hash_t leaf_seed[CFG_WOTS_SEED_SIZE];
+        if (ggm_leaf_seed(amss, amss->tree.leaf_idx, leaf_seed) != 0){
+            LOG_error("AMSA_sign: Seed of leaf %d is punctured!", amss->tree.leaf_idx);
+            return -1;
+        }
+        WOTS_import_seckey( &(amss->wots), leaf_seed, amss->hashkey);
+        memset(leaf_seed, 0, CFG_WOTS_SEED_SIZE);
+    } else {
+        WOTS_import_seckey( &(amss->wots), amss->secret_key, amss->hashkey);
+    }
+    const size_t slot = (amss->cp_interval > 0) ? amss->tree.leaf_idx % cp_slots(amss) : 0;
+    int ret;
+    if (amss->cp_interval > 0 && amss->cp_leaf[slot] == amss->tree.leaf_idx){
+        const size_t size = WOTS_checkpoints_size( &(amss->wots), amss->cp_interval );
+        ret = WOTS_sign_checkpoints( &(amss->wots), msg_digest, amss->cp_interval, amss->checkpoints + slot*size, sig_out->wots );
+        if (ret == 0){
+            memset(amss->checkpoints + slot*size, 0, size);   // forward secure: checkpoints are seckey material
+            amss->cp_leaf[slot] = UINT32_MAX;
+        }
+    } else {
+        ret = WOTS_sign( &(amss->wots), msg_digest, sig_out->wots );
+    }
+    WOTS_wipe_seckey( &(amss->wots) );
+    if (ret != 0) return -1;   // no chain was released: the leaf stays unused
+    // forward secure: iterate key or puncture the leaf and discard the previous key
+    if (amss->key_mode == AMSA_KEYS_GGM) ggm_puncture(amss);
+	else gen_next_key( &(amss->wots.hash), amss->secret_key, &(amss->hashkey) );
 
     // authentication path
-    if (amss->tree.leaf_idx % 2 == 0){
+    const hash_t* left_leaf = MT_get_left_leaf( &(amss->tree) );
+    if (left_leaf != NULL){  // cached left leaf
+        WOTS_import_pubkey( &(amss->wots), left_leaf, amss->hashkey);
+    } else if (amss->tree.bds != NULL){  // BDS only needs left leaves
+        if (amss->tree.leaf_idx % 2 == 0) WOTS_root_from_sig( &(amss->wots), msg_digest, sig_out->wots, amss->wots.root);
+    } else if (amss->tree.leaf_idx % 2 == 0){
         if (amss->tree.exist.leaf_idx == 0){ // first left is stored
             WOTS_import_pubkey( &(amss->wots), amss->tree.exist.left_nodes, amss->hashkey);
         } else {
@@ -128,29 +559,59 @@ void AMSA_sign(AMSA_Amss* amss, const hash_t* msg_digest, AMSA_Sig* sig_out){
         WOTS_import_pubkey( &(amss->wots), amss->tree.exist.right_nodes + (amss->tree.exist.leaf_idx-1)*size_hash, amss->hashkey);
     }
     MT_generate_path( &(amss->tree), amss->wots.root, &(sig_out->auth_path) );
-    LOG_debug("Signing m=%.8s, leaf_idx=%d, hashkey=%.8s. leaf hash=%.8s", HASH_hexstr( msg_digest ), amss->tree.leaf_idx-1, HASH_hexstr( (const byte_t*)&(amss->wots.hashkey) ), HASH_hexstr( amss->wots.root ) );
+    LOG_debug("Signing m=%.8s, leaf_idx=%d, hashkey=%.8s. leaf hash=%.8s", HASH_hexstr( msg_digest, 4 ), amss->tree.leaf_idx-1, HASH_hexstr( &(amss->wots.hashkey), 4 ), HASH_hexstr( amss->wots.root, 4 ) );
 
 
-    // grow Merkle tree if necessary
-    memcpy(growkey, amss->secret_key, CFG_WOTS_SEED_SIZE);
-    MT_index_t grow_idx = MT_get_grow_leaf_idx( &(amss->tree) );
-    if (grow_idx != 0){
-        for(int idx = amss->tree.leaf_idx; idx < grow_idx; idx++){
-            HASH_keyhash(growkey, growkey, CFG_WOTS_SEED_SIZE, &(amss->hashkey));
+    // grow Merkle tree: one leaf for each layer below the top
+    MT_index_t grow_idx;
+    while ((grow_idx = MT_get_grow_leaf_idx( &(amss->tree) )) != 0){
+        hash_t grow_seed[CFG_WOTS_SEED_SIZE];
+        if (gen_grow_seed(amss, grow_idx, grow_seed) != 0){
+            LOG_error("AMSA_sign: Seed of grow leaf %d is punctured!", grow_idx);
+            return -1;
         }
-        WOTS_import_seckey( &(amss->wots), growkey, amss->hashkey ); 
-        WOTS_generate_pubkey( &(amss->wots) );  // this is expensive
+        WOTS_import_seckey( &(amss->wots), grow_seed, amss->hashkey ); 
+        memset(grow_seed, 0, CFG_WOTS_SEED_SIZE);
+        gen_leaf_pubkey(amss, grow_idx);  // this is expensive
         MT_grow_dtree( &(amss->tree), amss->wots.root );
     }
+    wipe_passed_grow_cursors(amss);
+    return 0;
 }
 
 
 
 void AMSA_export_pubkey(AMSA_Amss* amss, AMSA_Pubkey* pubkey_out){
+    memset( &(pubkey_out->config), 0, sizeof(AMSA_Config) );   // caches and tree split are signer only
     pubkey_out->config.cfg_wots = amss->wots.config;
     pubkey_out->config.cfg_tree = amss->tree.config;
+    pubkey_out->config.key_mode = amss->key_mode;   // part of the public key
     pubkey_out->hashkey = amss->hashkey;
     pubkey_out->root = amss->tree.root;
+    pubkey_out->hash = amss->wots.hash;
+    pubkey_out->verify_pool = NULL;
+    pubkey_out->verify_min_steps = 0;
+}
+
+
+AMSA_Pubkey AMSA_Pubkey_import(const AMSA_Config config, const key_s hashkey, hash_t* root){
+    AMSA_Pubkey pubkey;
+    memset( &(pubkey.config), 0, sizeof(AMSA_Config) );
+    pubkey.config.cfg_wots = config.cfg_wots;
+    pubkey.config.cfg_tree = config.cfg_tree;
+    pubkey.config.key_mode = config.key_mode;
+    pubkey.hashkey = hashkey;
+    pubkey.root = root;
+    pubkey.hash = HASH_ctx_init( config.cfg_wots.cfg_hash );
+    pubkey.verify_pool = NULL;
+    pubkey.verify_min_steps = 0;
+    return pubkey;
+}
+
+
+void AMSA_set_verify_pool(AMSA_Pubkey* pubkey, POOL_Pool* pool, unsigned min_steps){
+    pubkey->verify_pool = pool;
+    pubkey->verify_min_steps = min_steps;
 }
 
    
@@ -161,23 +622,26 @@ bool AMSA_verify(const AMSA_Pubkey* pubkey, const hash_t* msg_digest, const AMSA
     hash_t tree_root[pubkey->config.cfg_wots.cfg_hash.size];
 
 
-    WOTS_Wots wots_leaf = WOTS_init( &(pubkey->config.cfg_wots) ); 
-    wots_leaf.hashkey = pubkey->hashkey; // todo: move to import_pubkey
+    // a pubkey assembled by hand has no backend yet
+    const HASH_Ctx hash = (pubkey->hash.keyhash != NULL) ? pubkey->hash : HASH_ctx_init( pubkey->config.cfg_wots.cfg_hash );
+    WOTS_Wots wots_leaf;
+    if (WOTS_init_ctx( &wots_leaf, &(pubkey->config.cfg_wots), &hash ) != 0) return false;
+    wots_leaf.hashkey = pubkey->hashkey;
+    WOTS_set_verify_pool( &wots_leaf, pubkey->verify_pool, pubkey->verify_min_steps );
     WOTS_root_from_sig( &wots_leaf, msg_digest, sig->wots, wots_root);
 
 
-	MT_root_from_path( &(sig->auth_path), wots_root, sig->auth_path.leaf_idx, tree_root);
+	MT_root_from_path( &hash, &(sig->auth_path), wots_root, sig->auth_path.leaf_idx, tree_root);
 
     bool is_valid =(bool)(memcmp(tree_root, pubkey->root, pubkey->config.cfg_wots.cfg_hash.size) == 0);
 
-    LOG_debug("Verify: wots_root=%.8s, tree_root=%.8s, pubkey=%.8s", HASH_hexstr( wots_root ), HASH_hexstr( tree_root ), HASH_hexstr( pubkey->root ) );
+    LOG_debug("Verify: wots_root=%.8s, tree_root=%.8s, pubkey=%.8s", HASH_hexstr( wots_root, 4 ), HASH_hexstr( tree_root, 4 ), HASH_hexstr( pubkey->root, 4 ) );
 
     if(!is_valid){
         LOG_warn("Signature is INVALID!" );
         for(int idx = 0; idx < pubkey->config.cfg_tree.height; idx++){
-            LOG_debug("Path Hash %d: %.8s", idx, HASH_hexstr( sig->auth_path.hashes + idx*pubkey->config.cfg_wots.cfg_hash.size ) );
+            LOG_debug("Path Hash %d: %.8s", idx, HASH_hexstr( sig->auth_path.hashes + idx*pubkey->config.cfg_wots.cfg_hash.size, 4 ) );
         }
     }
-    WOTS_free(&wots_leaf);
     return is_valid;
 }
\ No newline at end of file
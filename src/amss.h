@@ -30,9 +30,21 @@
 
 #define AMSA_SEED_SIZE (CFG_WOTS_SEED_SIZE + CFG_HASH_KEY_SIZE)
 
+// derivation of the wots seeds of the leaves from the secret key
+typedef enum {
+    AMSA_KEYS_CHAIN,  // hash chain: seed i+1 = H(seed i). Sequential access only.
+    AMSA_KEYS_GGM,    // leaves of a GGM tree over the secret key: O(h) access to any unused leaf
+} AMSA_Keys_t;
+
+
 typedef struct {
     MT_Config cfg_tree;
     WOTS_Config cfg_wots;
+    uint8_t wots_cp_interval;  // signing cache: chain checkpoint every interval steps, 0 (default) disables it. See AMSA_Amss.
+    bool tree_leaf_cache;      // signing cache: keep the left leaves of the bottom subtrees, 2^h_bottom * n bytes. See MT_init_leaf_cache().
+    AMSA_Keys_t key_mode;      // secret key format, AMSA_KEYS_CHAIN by default. Changes the public key, not the signatures.
+    uint8_t tree_layers;       // fractal layers of the Merkle tree, 0 for top and bottom (MT_FRACTAL_HALF). See MT_init_layers().
+    uint8_t tree_bottom;       // bottom subtree height of 2 layers, 0 for MT_FRACTAL_HALF. See AMSA_Amss_init_budget().
 } AMSA_Config;
 
 
@@ -40,14 +52,29 @@ typedef struct {
 typedef struct {
     hash_t secret_key[CFG_WOTS_SEED_SIZE];
     key_s hashkey;
+    // AMSA_KEYS_CHAIN grow cursors, one per stream of MT_get_grow_stream(): seed of leaf grow_idx[i], UINT32_MAX if empty.
+    // A cursor only holds the seed of a leaf that is not signed yet, it is wiped when the signer passes it.
+    uint8_t num_grow;
+    hash_t* grow_key;
+    uint32_t* grow_idx;
+    // AMSA_KEYS_GGM: secret_key is only the GGM root. The signer keeps the punctured tree instead: the nodes
+    // that cover the unused leaves ggm_next..2^h-1, at most one per height. Slot l holds the node of height l.
+    AMSA_Keys_t key_mode;
+    hash_t* ggm_nodes;
+    uint32_t ggm_next;
     MT_Tree tree;
     WOTS_Wots wots;
+    // signing cache: the chain checkpoints of the next 2^h_bottom leaves, filled when a leaf is generated or grown.
+    // Needs 2^h_bottom * WOTS_checkpoints_size() bytes, e.g. 32 * 8576 B for AMSA_SHA256_H10 with interval 4.
+    uint8_t cp_interval;
+    hash_t* checkpoints;
+    uint32_t* cp_leaf;   // leaf index held by each slot, UINT32_MAX if empty
 } AMSA_Amss;
 
 
 typedef struct {
     //uint16_t leaf_idx;
-    WOTS_chains_t* wots;
+    WOTS_chains_t* wots;   // WOTS_sig_size() bytes: chains, and the counter of WOTS_ENC_TARGET_SUM
     MT_Path auth_path;
 } AMSA_Sig;
 
@@ -56,6 +83,9 @@ typedef struct {
     AMSA_Config config;
     key_s hashkey;
     hash_t* root;
+    HASH_Ctx hash;   // hash backend for config.cfg_wots, resolved by AMSA_Pubkey_import() or AMSA_export_pubkey()
+    POOL_Pool* verify_pool;      // see AMSA_set_verify_pool(), NULL verifies single-threaded
+    unsigned verify_min_steps;
 } AMSA_Pubkey;
 
 
@@ -69,6 +99,17 @@ typedef struct {
 #define AMSA_BLAKE2B_160_H10 {{HASH_BLAKE2B_160, 10}, WOTS_BLAKE2B_160_W16}
 #define AMSA_BLAKE2B_160_H12 {{HASH_BLAKE2B_160, 12}, WOTS_BLAKE2B_160_W16}
 
+#define AMSA_BLAKE2B_TW_160_H4  {{HASH_BLAKE2B_TW_160, 4},  WOTS_BLAKE2B_TW_160_W16}
+#define AMSA_BLAKE2B_TW_160_H10 {{HASH_BLAKE2B_TW_160, 10}, WOTS_BLAKE2B_TW_160_W16}
+#define AMSA_BLAKE2B_TW_160_H12 {{HASH_BLAKE2B_TW_160, 12}, WOTS_BLAKE2B_TW_160_W16}
+
+#define AMSA_SHA256_H10_WOTSC {{HASH_SHA2_256, 10}, WOTS_SHA2_256_W16_WOTSC}   // slower signing, faster verification
+#define AMSA_SHA256_H10_CP4 {{HASH_SHA2_256, 10}, WOTS_SHA2_256_W16, 4}         // faster signing, 274 KB checkpoints
+#define AMSA_SHA256_H10_LEAFS {{HASH_SHA2_256, 10}, WOTS_SHA2_256_W16, 0, true}  // faster signing, 1 KB left leaves
+#define AMSA_SHA256_H10_GGM {{HASH_SHA2_256, 10}, WOTS_SHA2_256_W16, 0, false, AMSA_KEYS_GGM}  // random-access leaf seeds
+#define AMSA_SHA256_H16_L4 {{HASH_SHA2_256, 16}, WOTS_SHA2_256_W16, 0, false, AMSA_KEYS_CHAIN, 4}  // 4 layers of height 4
+#define AMSA_SHA256_H10_BDS {{HASH_SHA2_256, 10, MT_ENGINE_BDS}, WOTS_SHA2_256_W16, 0, false, AMSA_KEYS_GGM}  // BDS with random-access seeds
+
 
 
 // ============================================================================
@@ -81,6 +122,36 @@ typedef struct {
  */
 AMSA_Amss AMSA_Amss_init(const AMSA_Config config);
 
+/*
+ * Picks the tree split and signing caches of the lowest sign cost that fit into max_bytes:
+ * the fewest hashes per signature on average (AMSA_sign_cost()), then in the worst case.
+ * Tries every bottom height of 2 layers and evenly split layers, each with and without
+ * the signing caches of config. Overrides tree_layers and tree_bottom. BDS configs are kept.
+ * \param[in] max_bytes memory budget, see AMSA_sizeof_amss()
+ * \return the config, the smallest split without caches if none fits
+ */
+AMSA_Config AMSA_config_budget(const AMSA_Config config, size_t max_bytes);
+
+/*
+ * Allocates the AMSA with the config of AMSA_config_budget().
+ * \return allocated amss structure
+ */
+AMSA_Amss AMSA_Amss_init_budget(const AMSA_Config config, size_t max_bytes);
+
+/*
+ * Estimates the hashes of a signature: the WOTS signature, the leaf for the path and the
+ * grown leaves, on average over the key lifetime and in the worst case. Tree hashes
+ * (at most h per signature) are neglected.
+ */
+void AMSA_sign_cost(const AMSA_Config config, double* avg_hashes, double* worst_hashes);
+
+/*
+ * Determines the memory of an AMSA object: the struct, the tree, the GGM nodes and
+ * the signing caches. Signatures and the public key are not included.
+ * \return size in bytes
+ */
+size_t AMSA_sizeof_amss(const AMSA_Config config);
+
 /*
  * Allocates and initializes memory for the signature
  * \param[in] config configuration
@@ -107,8 +178,9 @@ void AMSA_Sig_free(AMSA_Sig* sig);
  * \param[in,out] amss struct holding the private key data
  * \param[in] seed pointer to a 48 byte random data source. 
  * \param[out] pubkey_out generated public key
+ * \return 0 on success, -1 if AMSA_Amss_init() got an invalid WOTS config
  */
-void AMSA_generate(AMSA_Amss* amss, const byte_t* seed, AMSA_Pubkey* pubkey_out); 
+int AMSA_generate(AMSA_Amss* amss, const byte_t* seed, AMSA_Pubkey* pubkey_out); 
 
 
 /*
@@ -119,18 +191,42 @@ void AMSA_generate(AMSA_Amss* amss, const byte_t* seed, AMSA_Pubkey* pubkey_out)
 void AMSA_export_pubkey(AMSA_Amss* amss, AMSA_Pubkey* pubkey_out);
 
 
+/*
+ * Builds a public key from its received parts, e.g. on a verifying device without the signer.
+ * \param[in] config configuration of the signer, as in the exported public key
+ * \param[in] hashkey hash key of the signer
+ * \param[in] root tree root, not copied
+ * \return public key with the hash backend resolved for config
+ */
+AMSA_Pubkey AMSA_Pubkey_import(const AMSA_Config config, const key_s hashkey, hash_t* root);
+
+
+/*
+ * Lets AMSA_verify() with this pubkey split the WOTS chains across a pool,
+ * like WOTS_set_verify_pool(). The caller owns the pool and destroys it after
+ * the last verification that uses it.
+ * \param[in,out] pubkey public key
+ * \param[in] pool worker threads from POOL_create(), NULL verifies single-threaded
+ * \param[in] min_steps signatures with fewer remaining chain steps are verified single-threaded
+ */
+void AMSA_set_verify_pool(AMSA_Pubkey* pubkey, POOL_Pool* pool, unsigned min_steps);
+
+
 /*
  * Sign a message hash digest. 
  * \param[in,out] amss struct holding the private key data
  * \param[in] msg_digest hash of the message that should be signed. check length
  * \param[out] sig_out signature of the message
+ * \return 0 on success, -1 if no signature was made: keys exhausted, a punctured
+ *         seed, or no target-sum counter. The key state is unchanged if the leaf was not signed.
  */
-void AMSA_sign(AMSA_Amss* amss, const hash_t* msg_digest, AMSA_Sig* sig_out);
+int AMSA_sign(AMSA_Amss* amss, const hash_t* msg_digest, AMSA_Sig* sig_out);
 
 
 /*
  * Verify a signature message hash digest. 
- * \param[in] pubkey certificate containing the public key
+ * \param[in] pubkey certificate containing the public key. Without a resolved hash backend
+ *            (pubkey->hash.keyhash NULL) it is resolved on every call.
  * \param[in] msg_digest hash of the message that should be signed. check length
  * \param[in] sig signature of the message
  * \return True if the signature is valid. False otherwise.
@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 // own includes
 #include "../hash.h"
@@ -19,7 +20,6 @@ void average_amss(const AMSA_Config config){
 	AMSA_Sig   sig = AMSA_Sig_init( config );
 	AMSA_Pubkey pubkey;
 	byte_t seed[AMSA_SEED_SIZE] = { 'x' };
-	HASH_config( config.cfg_wots.cfg_hash );
 
 
 	// generate test digest
@@ -56,6 +56,237 @@ void average_amss(const AMSA_Config config){
 
 
 
+/*
+ * Signs all leaves with the signing caches of cfg_cp and without any cache.
+ * \return number of signatures that differ
+ */
+int test_sign_caches(const AMSA_Config cfg_cp){
+	int errors = 0;
+	AMSA_Config config = cfg_cp;
+	config.wots_cp_interval = 0;
+	config.tree_leaf_cache = false;
+
+	AMSA_Amss amss = AMSA_Amss_init( config );
+	AMSA_Amss amss_cp = AMSA_Amss_init( cfg_cp );
+	AMSA_Sig sig = AMSA_Sig_init( config );
+	AMSA_Sig sig_cp = AMSA_Sig_init( cfg_cp );
+	AMSA_Pubkey pubkey, pubkey_cp;
+	byte_t seed[AMSA_SEED_SIZE] = { 'c' };
+	hash_t msg_digest[config.cfg_wots.cfg_hash.size];
+	const HASH_Ctx hash = HASH_ctx_init( config.cfg_wots.cfg_hash );
+	const size_t size_auth = config.cfg_tree.height * config.cfg_tree.cfg_hash.size;
+
+	AMSA_generate( &amss, seed, &pubkey);
+	AMSA_generate( &amss_cp, seed, &pubkey_cp);
+	if (memcmp(pubkey.root, pubkey_cp.root, config.cfg_tree.cfg_hash.size) != 0) errors++;
+
+	for (int idx = 0; idx < (1 << config.cfg_tree.height); idx++){
+		HASH_hash(&hash, msg_digest, (unsigned char*)&idx, 4);
+		AMSA_sign(&amss, msg_digest, &sig);
+		AMSA_sign(&amss_cp, msg_digest, &sig_cp);
+		if (memcmp(sig.wots, sig_cp.wots, WOTS_sig_size( &(config.cfg_wots) )) != 0 ||
+			memcmp(sig.auth_path.hashes, sig_cp.auth_path.hashes, size_auth) != 0 ||
+			!AMSA_verify(&pubkey, msg_digest, &sig_cp)){
+			LOG_error("Cached signature %d differs", idx);
+			errors++;
+		}
+	}
+	printf("Signing caches (checkpoint interval %d, leaf cache %d, h=%d): %s\n", cfg_cp.wots_cp_interval, cfg_cp.tree_leaf_cache,
+		config.cfg_tree.height, (errors == 0) ? "OK" : "FAILED");
+
+	AMSA_Amss_free( &amss );
+	AMSA_Amss_free( &amss_cp );
+	AMSA_Sig_free( &sig );
+	AMSA_Sig_free( &sig_cp );
+	return errors;
+}
+
+
+
+/*
+ * Chain keys: the grow cursors never hold the seed of a signed leaf, so a
+ * leaked signer state does not reveal used one-time keys.
+ * \return number of errors
+ */
+int test_grow_cursors(const AMSA_Config config){
+	int errors = 0;
+	const uint32_t num_leafs = 1u << config.cfg_tree.height;
+	AMSA_Amss amss = AMSA_Amss_init( config );
+	AMSA_Sig sig = AMSA_Sig_init( config );
+	AMSA_Pubkey pubkey;
+	byte_t seed[AMSA_SEED_SIZE] = { 'f' };
+	hash_t msg_digest[config.cfg_wots.cfg_hash.size];
+	hash_t* signed_seeds = malloc( num_leafs * CFG_WOTS_SEED_SIZE );
+	const HASH_Ctx hash = HASH_ctx_init( config.cfg_wots.cfg_hash );
+
+	if (amss.num_grow != MT_num_grow_streams( &(amss.tree) )) errors++;
+	AMSA_generate( &amss, seed, &pubkey);
+	for (uint32_t idx = 0; idx < num_leafs; idx++){
+		memcpy(signed_seeds + idx*CFG_WOTS_SEED_SIZE, amss.secret_key, CFG_WOTS_SEED_SIZE);
+		HASH_hash(&hash, msg_digest, (unsigned char*)&idx, 4);
+		AMSA_sign(&amss, msg_digest, &sig);
+		if (!AMSA_verify(&pubkey, msg_digest, &sig)) errors++;
+		for (unsigned cursor = 0; cursor < amss.num_grow; cursor++){
+			for (uint32_t used = 0; used <= idx; used++){
+				if (memcmp(amss.grow_key + cursor*CFG_WOTS_SEED_SIZE, signed_seeds + used*CFG_WOTS_SEED_SIZE, CFG_WOTS_SEED_SIZE) == 0){
+					LOG_error("Grow cursor %d holds the seed of signed leaf %d after leaf %d", cursor, used, idx);
+					errors++;
+				}
+			}
+		}
+	}
+	for (unsigned cursor = 0; cursor < amss.num_grow; cursor++) if (amss.grow_idx[cursor] != UINT32_MAX) errors++;   // all wiped
+	printf("Grow cursors (%d streams, h=%d): %s\n", amss.num_grow, config.cfg_tree.height, (errors == 0) ? "OK" : "FAILED");
+
+	free(signed_seeds);
+	AMSA_Amss_free( &amss );
+	AMSA_Sig_free( &sig );
+	return errors;
+}
+
+
+
+/*
+ * A verifier without the signer object: builds the public key from the
+ * received config, hash key and root, by AMSA_Pubkey_import() and by hand.
+ * \return number of errors
+ */
+int test_pubkey_import(const AMSA_Config config){
+	int errors = 0;
+	AMSA_Amss amss = AMSA_Amss_init( config );
+	AMSA_Sig sig = AMSA_Sig_init( config );
+	AMSA_Pubkey pubkey;
+	byte_t seed[AMSA_SEED_SIZE] = { 'i' };
+	hash_t msg_digest[config.cfg_wots.cfg_hash.size];
+	hash_t root[config.cfg_wots.cfg_hash.size];
+
+	AMSA_generate( &amss, seed, &pubkey);
+	memcpy(root, pubkey.root, sizeof(root));
+	memset(msg_digest, 0x42, sizeof(msg_digest));
+	AMSA_sign(&amss, msg_digest, &sig);
+	AMSA_Amss_free( &amss );   // the verifier has only the received parts
+
+	const AMSA_Pubkey imported = AMSA_Pubkey_import( config, pubkey.hashkey, root );
+	const AMSA_Pubkey by_hand = { .config = config, .hashkey = pubkey.hashkey, .root = root };
+	if (!AMSA_verify(&imported, msg_digest, &sig)) errors++;
+	if (!AMSA_verify(&by_hand, msg_digest, &sig)) errors++;
+	AMSA_Pubkey pooled = imported;   // the caller owns the verify pool
+	POOL_Pool* pool = POOL_create(2);
+	AMSA_set_verify_pool(&pooled, pool, 0);
+	if (pool == NULL || !AMSA_verify(&pooled, msg_digest, &sig)) errors++;
+	if (pool != NULL) POOL_destroy(pool);
+	msg_digest[0] ^= 1;
+	if (AMSA_verify(&imported, msg_digest, &sig)) errors++;
+	printf("Imported pubkey (h=%d): %s\n", config.cfg_tree.height, (errors == 0) ? "OK" : "FAILED");
+
+	AMSA_Sig_free( &sig );
+	return errors;
+}
+
+
+
+// returns true if all bytes are zero
+static bool is_wiped(const hash_t* bytes, size_t size){
+	for (size_t i = 0; i < size; i++) if (bytes[i] != 0) return false;
+	return true;
+}
+
+
+/*
+ * GGM keys: all signatures verify, and the signer state stays within h+1 seeds:
+ * no secret key, no grow cursors and no leaf seed after the last signature.
+ * \return number of errors
+ */
+int test_ggm(const AMSA_Config config){
+	int errors = 0;
+	AMSA_Amss amss = AMSA_Amss_init( config );
+	AMSA_Sig sig = AMSA_Sig_init( config );
+	AMSA_Pubkey pubkey;
+	byte_t seed[AMSA_SEED_SIZE] = { 'g' };
+	hash_t msg_digest[config.cfg_wots.cfg_hash.size];
+	const HASH_Ctx hash = HASH_ctx_init( config.cfg_wots.cfg_hash );
+
+	AMSA_generate( &amss, seed, &pubkey);
+	if (amss.num_grow != 0 || amss.grow_key != NULL) errors++;
+	if (pubkey.config.key_mode != AMSA_KEYS_GGM || pubkey.config.wots_cp_interval != 0 || pubkey.config.tree_leaf_cache ||
+		pubkey.config.tree_layers != 0 || pubkey.config.tree_bottom != 0) errors++;   // signer-only fields are cleared
+	for (int idx = 0; idx < (1 << config.cfg_tree.height); idx++){
+		HASH_hash(&hash, msg_digest, (unsigned char*)&idx, 4);
+		AMSA_sign(&amss, msg_digest, &sig);
+		if (sig.auth_path.leaf_idx != idx || !AMSA_verify(&pubkey, msg_digest, &sig)) errors++;
+		if (amss.ggm_next != idx + 1) errors++;
+		if (!is_wiped(amss.secret_key, CFG_WOTS_SEED_SIZE)) errors++;   // moved into the GGM root
+	}
+	// all leaves punctured: only zeros are left
+	if (!is_wiped(amss.ggm_nodes, (config.cfg_tree.height+1) * CFG_WOTS_SEED_SIZE)) errors++;
+	if (!is_wiped(amss.wots.seed, CFG_WOTS_SEED_SIZE) || amss.wots.has_seckey) errors++;
+	printf("GGM keys (h=%d): %s\n", config.cfg_tree.height, (errors == 0) ? "OK" : "FAILED");
+
+	AMSA_Amss_free( &amss );
+	AMSA_Sig_free( &sig );
+	return errors;
+}
+
+
+
+/*
+ * Memory budget: all signatures verify and the tree split fits into max_bytes.
+ * \param[in] height_bottom expected bottom subtree height, 0 to skip the check
+ * \return number of errors
+ */
+int test_budget(const AMSA_Config config, size_t max_bytes, uint8_t height_bottom){
+	int errors = 0;
+	AMSA_Amss amss = AMSA_Amss_init_budget( config, max_bytes );
+	AMSA_Sig sig = AMSA_Sig_init( config );
+	AMSA_Pubkey pubkey;
+	byte_t seed[AMSA_SEED_SIZE] = { 'b' };
+	hash_t msg_digest[config.cfg_wots.cfg_hash.size];
+	const HASH_Ctx hash = HASH_ctx_init( config.cfg_wots.cfg_hash );
+
+	size_t size = sizeof(AMSA_Amss) + MT_sizeof_alloc( &(amss.tree) );
+	if (amss.cp_interval > 0) size += (1 << amss.tree.exist.height) * WOTS_checkpoints_size( &(amss.wots), amss.cp_interval );
+	if (size > max_bytes) errors++;
+	if (height_bottom > 0 && (amss.tree.num_mid != 0 || amss.tree.exist.height != height_bottom)) errors++;
+
+	AMSA_generate( &amss, seed, &pubkey);
+	for (int idx = 0; idx < (1 << config.cfg_tree.height); idx++){
+		HASH_hash(&hash, msg_digest, (unsigned char*)&idx, 4);
+		AMSA_sign(&amss, msg_digest, &sig);
+		if (!AMSA_verify(&pubkey, msg_digest, &sig)) errors++;
+	}
+	printf("Budget %zu B (h=%d): %d layers, bottom height %d, checkpoints %d: %s\n", max_bytes, config.cfg_tree.height,
+		amss.tree.num_mid + 2, amss.tree.exist.height, amss.cp_interval, (errors == 0) ? "OK" : "FAILED");
+
+	AMSA_Amss_free( &amss );
+	AMSA_Sig_free( &sig );
+	return errors;
+}
+
+
+
+/*
+ * The estimated sign cost of AMSA_config_budget() never gets worse with more memory.
+ * \return number of budgets with a higher cost than the one before
+ */
+int test_budget_cost(const AMSA_Config config){
+	int errors = 0;
+	double last_avg = 0;
+	for (size_t max_bytes = 1 << 10; max_bytes <= (16 << 20); max_bytes += max_bytes/4){
+		const AMSA_Config chosen = AMSA_config_budget(config, max_bytes);
+		double avg, worst;
+		AMSA_sign_cost(chosen, &avg, &worst);
+		if (max_bytes > (1 << 10) && avg > last_avg){
+			LOG_error("Budget %zu B costs %.0f hashes, less memory %.0f", max_bytes, avg, last_avg);
+			errors++;
+		}
+		last_avg = avg;
+	}
+	printf("Budget cost (h=%d, up to 16 MB): %.0f hashes per signature: %s\n", config.cfg_tree.height, last_avg, (errors == 0) ? "OK" : "FAILED");
+	return errors;
+}
+
+
+
 void benchmark_amss(const AMSA_Config config, unsigned rounds){
 
 	AMSA_Amss amss = AMSA_Amss_init( config );
@@ -64,7 +295,7 @@ void benchmark_amss(const AMSA_Config config, unsigned rounds){
 
 	byte_t seed[AMSA_SEED_SIZE] = { 'x' };
 	hash_t msg_digest[config.cfg_wots.cfg_hash.size];
-	HASH_config( config.cfg_wots.cfg_hash );
+	const HASH_Ctx hash = HASH_ctx_init( config.cfg_wots.cfg_hash );
 
 	// profiling
 	profile_s prof_gen;
@@ -92,7 +323,7 @@ void benchmark_amss(const AMSA_Config config, unsigned rounds){
 	HASH_reset_stats();
 	bool succ;
 	for (int idx = 0; idx < (1 << amss.tree.config.height); idx++){
-		HASH_hash(msg_digest, (unsigned char*)&idx, 4);  // message
+		HASH_hash(&hash, msg_digest, (unsigned char*)&idx, 4);  // message
 
 		PROFILER_start( &prof_sign);
 		AMSA_sign(&amss, msg_digest, &sig);
@@ -135,5 +366,56 @@ int main(){
 
 	benchmark_amss(cfg, 1);
 
-	return 0;
+	benchmark_amss((AMSA_Config)AMSA_SHA256_H10_WOTSC, 1);   // verification without checksum chains
+
+	benchmark_amss((AMSA_Config)AMSA_SHA256_H10_CP4, 1);     // signing from chain checkpoints
+
+	benchmark_amss((AMSA_Config)AMSA_SHA256_H10_LEAFS, 1);   // no wots pubkey for left leaves
+
+	benchmark_amss((AMSA_Config)AMSA_SHA256_H10_GGM, 1);     // GGM leaf seeds
+
+	benchmark_amss((AMSA_Config)AMSA_SHA256_H10_BDS, 1);     // BDS traversal, GGM leaf seeds
+
+	int errors = 0;
+	errors += test_sign_caches((AMSA_Config){{HASH_SHA2_256, 10}, WOTS_SHA2_256_W16, 4, false});
+	errors += test_sign_caches((AMSA_Config){{HASH_SHA2_256, 10}, WOTS_SHA2_256_W16_WOTSC, 3, false});
+	errors += test_sign_caches((AMSA_Config){{HASH_BLAKE2B_TW_160, 6}, WOTS_BLAKE2B_TW_160_W16_INDEXED, 1, false});
+	errors += test_sign_caches((AMSA_Config)AMSA_SHA256_H10_LEAFS);
+	errors += test_sign_caches((AMSA_Config){{HASH_SHA2_256, 5}, WOTS_SHA2_256_W16, 2, true});
+	errors += test_sign_caches((AMSA_Config){{HASH_SHA2_256, 1}, WOTS_SHA2_256_W16, 0, true});
+	errors += test_sign_caches((AMSA_Config){{HASH_SHA2_256, 10}, WOTS_SHA2_256_W16, 4, true, AMSA_KEYS_GGM});
+	errors += test_sign_caches((AMSA_Config){{HASH_BLAKE2B_TW_160, 5}, WOTS_BLAKE2B_TW_160_W16, 1, false, AMSA_KEYS_GGM});
+	errors += test_ggm((AMSA_Config)AMSA_SHA256_H10_GGM);
+	errors += test_ggm((AMSA_Config){{HASH_SHA2_256, 3}, WOTS_SHA2_256_W16, 0, false, AMSA_KEYS_GGM});
+	errors += test_sign_caches((AMSA_Config){{HASH_SHA2_256, 12}, WOTS_SHA2_256_W16, 4, true, AMSA_KEYS_CHAIN, 3});
+	errors += test_ggm((AMSA_Config){{HASH_SHA2_256, 9}, WOTS_SHA2_256_W16, 0, false, AMSA_KEYS_GGM, 4});
+	errors += test_ggm((AMSA_Config)AMSA_SHA256_H10_BDS);
+	errors += test_sign_caches((AMSA_Config){{HASH_SHA2_256, 9, MT_ENGINE_BDS, 3}, WOTS_SHA2_256_W16, 4, false, AMSA_KEYS_CHAIN});
+	// n = 64 exceeds the seed size
+	errors += test_sign_caches((AMSA_Config){{HASH_SHAKE_256, 6}, {HASH_SHAKE_256, 16}, 2, true, AMSA_KEYS_CHAIN, 2});
+	errors += test_ggm((AMSA_Config){{HASH_SHAKE_256, 4}, {HASH_SHAKE_256, 16}, 0, false, AMSA_KEYS_GGM});
+
+	errors += test_pubkey_import((AMSA_Config)AMSA_SHA256_H4);
+	errors += test_pubkey_import((AMSA_Config){{HASH_BLAKE2B_TW_160, 5}, WOTS_BLAKE2B_TW_160_W16, 0, false, AMSA_KEYS_GGM});
+	errors += test_pubkey_import((AMSA_Config){{HASH_SHAKE_256, 4}, {HASH_SHAKE_256, 16}});
+	errors += test_grow_cursors((AMSA_Config)AMSA_SHA256_H10);
+	errors += test_grow_cursors((AMSA_Config){{HASH_SHA2_256, 9}, WOTS_SHA2_256_W16, 0, false, AMSA_KEYS_CHAIN, 3});
+	errors += test_grow_cursors((AMSA_Config){{HASH_SHA2_256, 9, MT_ENGINE_BDS}, WOTS_SHA2_256_W16});
+
+	AMSA_Config cfg_budget = {{HASH_SHA2_256, 8}, WOTS_SHA2_256_W16};
+	errors += test_budget(cfg_budget, 1 << 20, 8);   // all right nodes, no grown leaves
+	for (uint8_t height_bottom = 5; height_bottom <= 6; height_bottom++){
+		cfg_budget.tree_bottom = height_bottom;
+		errors += test_budget(cfg_budget, AMSA_sizeof_amss(cfg_budget), height_bottom);
+	}
+	cfg_budget.tree_bottom = 0;
+	cfg_budget.wots_cp_interval = 4;
+	errors += test_budget(cfg_budget, 64 << 10, 8);   // no grown leaves beat checkpoints of 2^2 leaves
+	errors += test_budget(cfg_budget, 8 << 10, 0);    // no checkpoints
+	errors += test_budget_cost((AMSA_Config){{HASH_SHA2_256, 10}, WOTS_SHA2_256_W16, 4, true});
+	cfg_budget.wots_cp_interval = 0;
+	cfg_budget.tree_layers = 3;
+	errors += test_budget(cfg_budget, AMSA_sizeof_amss(cfg_budget), 0);   // 3 layers
+
+	return errors;
 }
\ No newline at end of file
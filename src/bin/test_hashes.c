@@ -1,22 +1,408 @@
 // system includes (<> searches only include paths)
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // own includes
 #include "../hash.h"
+#include "../hashes/sha256.h"
+#include "../hashes/sha256_mb.h"
+#include "../hashes/blake2.h"
+#include "../hashes/blake2b_mb.h"
+#include "../hashes/fips202.h"
+#include "../hashes/fips202_mb.h"
 #include "../util/logger.h"
+#include "../util/pool.h"
 #include "../util/profiler.h"
 
 
 
-int main(){
+#define BATCH_MAX_NUM 37     // more than two batches of the widest kernel plus a tail
+#define BATCH_MAX_LEN 2144   // WOTS public key compression of SHA256_W16
+
+
+/*
+ * Compares the batch interface HASH_keyhash_xN() against the scalar HASH_keyhash().
+ * Covers all batch sizes up to BATCH_MAX_NUM, keyed and unkeyed inputs and in-place hashing.
+ * \return number of mismatching hashes
+ */
+int test_batch(const HASH_Config config, const char* name){
+	static byte_t inputs[BATCH_MAX_NUM][BATCH_MAX_LEN];
+	static hash_t expected[BATCH_MAX_NUM][64];
+	static hash_t batched[BATCH_MAX_NUM][BATCH_MAX_LEN];
+	const size_t lengths[] = {0, 1, 20, 32, 39, 48, 55, 56, 64, 100, 128, BATCH_MAX_LEN};
+	hash_t* outputs[BATCH_MAX_NUM];
+	const byte_t* inptrs[BATCH_MAX_NUM];
+	key_s keys[BATCH_MAX_NUM];
+	const key_s* keyptrs[BATCH_MAX_NUM];
+	int errors = 0;
+
+	const HASH_Ctx hash = HASH_ctx_init(config);
+	for(int i = 0; i < BATCH_MAX_NUM; i++){
+		for(int j = 0; j < BATCH_MAX_LEN; j++) inputs[i][j] = (byte_t)(i*31 + j*7);
+		for(int j = 0; j < CFG_HASH_KEY_SIZE; j++) keys[i].bytes[j] = (byte_t)(i + j*3);
+		keyptrs[i] = &keys[i];
+	}
+
+	for(int l = 0; l < sizeof(lengths)/sizeof(lengths[0]); l++){
+		for(int num = 1; num <= BATCH_MAX_NUM; num++){
+			for(int keyed = 0; keyed < 2; keyed++){
+				for(int inplace = 0; inplace < 2; inplace++){
+					for(int i = 0; i < num; i++){
+						HASH_keyhash(&hash, expected[i], inputs[i], lengths[l], keyed ? keyptrs[i] : 0);
+						if (inplace) memcpy(batched[i], inputs[i], lengths[l]);
+						outputs[i] = batched[i];
+						inptrs[i] = inplace ? batched[i] : inputs[i];
+					}
+					HASH_keyhash_xN(&hash, outputs, inptrs, lengths[l], keyed ? keyptrs : 0, num);
+					for(int i = 0; i < num; i++){
+						if (memcmp(expected[i], batched[i], config.size) != 0) errors++;
+					}
+				}
+			}
+		}
+	}
+
+	if (errors == 0) LOG_info("Batch %s: %d lanes, identical to scalar", name, HASH_lanes(&hash));
+	else LOG_error("Batch %s: %d lanes, %d hashes differ from scalar!", name, HASH_lanes(&hash), errors);
+	return errors;
+}
+
+
+
+#if !CFG_SHA256_USE_OPENSSL
+const char* sha256_backend_name(SHA256_Backend_t backend){
+	if (backend == SHA256_BACKEND_SHANI) return "shani";
+	if (backend == SHA256_BACKEND_REF) return "ref";
+	return "auto";
+}
+
+
+/*
+ * Compares all SHA-256 backends supported by this CPU against the portable one.
+ * \return number of mismatching hashes
+ */
+int test_sha256_backends(){
+	const SHA256_Backend_t selected = SHA256_get_backend();
+	byte_t input[300];
+	hash_t expected[32];
+	hash_t output[32];
+	int errors = 0;
+
+	for(int i = 0; i < sizeof(input); i++) input[i] = (byte_t)(i*13);
+
+	SHA256_set_backend(SHA256_BACKEND_REF);
+	const HASH_Ctx ref = HASH_ctx_init(HASH_SHA2_256);
+	for(SHA256_Backend_t backend = SHA256_BACKEND_SHANI; backend <= SHA256_BACKEND_SHANI; backend++){
+		if (SHA256_set_backend(backend) != 0){
+			LOG_info("SHA-256 backend %s: not supported by this CPU", sha256_backend_name(backend));
+			continue;
+		}
+		const HASH_Ctx hash = HASH_ctx_init(HASH_SHA2_256);
+		for(int len = 0; len <= sizeof(input); len++){
+			HASH_hash(&ref, expected, input, len);
+			HASH_hash(&hash, output, input, len);
+			if (memcmp(expected, output, 32) != 0) errors++;
+		}
+		if (errors == 0) LOG_info("SHA-256 backend %s: identical to ref", sha256_backend_name(backend));
+		else LOG_error("SHA-256 backend %s: %d hashes differ from ref!", sha256_backend_name(backend), errors);
+	}
+	SHA256_set_backend(selected);
+	return errors;
+}
+
+
+/*
+ * Compares the fixed-length fast paths against the generic SHA256_Init/Update/Final.
+ * \return number of mismatching hashes
+ */
+int test_sha256_fastpaths(){
+	byte_t input[64];
+	byte_t key[16];
+	hash_t expected[32];
+	hash_t output[32];
+	const SHA256_Compress_fn compress = SHA256_get_compress();
+	SHA256_CTX ctx;
+	int errors = 0;
+
+	for(int i = 0; i < sizeof(input); i++) input[i] = (byte_t)(i*29 + 1);
+	for(int i = 0; i < sizeof(key); i++) key[i] = (byte_t)(i*3 + 7);
+
+	for(int len = 0; len + sizeof(key) <= SHA256_SHORT_MAX; len++){
+		SHA256_Init(&ctx); SHA256_Update(&ctx, key, sizeof(key)); SHA256_Update(&ctx, input, len); SHA256_Final(expected, &ctx);
+		SHA256_Short(compress, output, key, sizeof(key), input, len);
+		if (memcmp(expected, output, 32) != 0) errors++;
+		if (len == 32){
+			SHA256_Key16_32(compress, output, key, input);
+			if (memcmp(expected, output, 32) != 0) errors++;
+		}
+	}
+	SHA256_Init(&ctx); SHA256_Update(&ctx, input, 64); SHA256_Final(expected, &ctx);
+	SHA256_64(compress, output, input);
+	if (memcmp(expected, output, 32) != 0) errors++;
+
+	if (errors == 0) LOG_info("SHA-256 fast paths: identical to SHA256_Update");
+	else LOG_error("SHA-256 fast paths: %d hashes differ from SHA256_Update!", errors);
+	return errors;
+}
+#endif
+
+
+/*
+ * Compares the AVX2 BLAKE2b compression against the reference one, keyed and unkeyed.
+ * \return number of mismatching hashes
+ */
+int test_blake2b_backends(){
+	const blake2b_backend_t selected = blake2b_get_backend();
+	byte_t input[300];
+	byte_t key[16];
+	hash_t expected[64];
+	hash_t output[64];
+	int errors = 0;
+
+	if (blake2b_set_backend(BLAKE2B_BACKEND_AVX2) != 0){
+		LOG_info("BLAKE2b backend avx2: not supported by this CPU");
+		return 0;
+	}
+	for(int i = 0; i < sizeof(input); i++) input[i] = (byte_t)(i*13);
+	for(int i = 0; i < sizeof(key); i++) key[i] = (byte_t)(i*3 + 7);
+
+	for(int len = 0; len <= sizeof(input); len++){
+		for(size_t keylen = 0; keylen <= sizeof(key); keylen += sizeof(key)){
+			blake2b_set_backend(BLAKE2B_BACKEND_REF);
+			blake2b(expected, 64, input, len, key, keylen);
+			blake2b_set_backend(BLAKE2B_BACKEND_AVX2);
+			blake2b(output, 64, input, len, key, keylen);
+			if (memcmp(expected, output, 64) != 0) errors++;
+		}
+	}
+	if (errors == 0) LOG_info("BLAKE2b backend avx2: identical to ref");
+	else LOG_error("BLAKE2b backend avx2: %d hashes differ from ref!", errors);
+	blake2b_set_backend(selected);
+	return errors;
+}
+
+
+
+/*
+ * Compares the 4-way Keccak-f[1600] against the scalar permutation and
+ * keyed SHAKE against SHAKE of the concatenation.
+ * \return number of mismatches
+ */
+int test_keccak(){
+	uint64_t states[4][25];
+	uint64_t interleaved[4*25];
+	byte_t input[SHAKE256_RATE + 300];   // longest key plus input
+	byte_t expected[200];
+	byte_t output[200];
+	int errors = 0;
+
+	for(int i = 0; i < sizeof(input); i++) input[i] = (byte_t)(i*13 + 5);
+
+	// keyed SHAKE: key lengths around the rate, input lengths across block borders
+	for(int len = 0; len <= 300; len += 7){
+		for(int keylen = 0; keylen < SHAKE256_RATE; keylen += 45){
+			shake256(expected, 200, input, keylen + len);
+			shake256_keyed(output, 200, input, keylen, input + keylen, len);
+			if (memcmp(expected, output, 200) != 0) errors++;
+			shake128(expected, 200, input, keylen + len);
+			shake128_keyed(output, 200, input, keylen, input + keylen, len);
+			if (memcmp(expected, output, 200) != 0) errors++;
+		}
+	}
+
+	if (keccak_mb_lanes() >= 4){
+		for(int i = 0; i < 4; i++){
+			for(int j = 0; j < 25; j++) states[i][j] = 0x0123456789abcdefULL * (uint64_t)(i*25 + j + 1);
+			for(int j = 0; j < 25; j++) interleaved[4*j + i] = states[i][j];
+			KeccakF1600_StatePermute(states[i]);
+		}
+		KeccakF1600_StatePermute4x(interleaved);
+		for(int i = 0; i < 4; i++){
+			for(int j = 0; j < 25; j++) if (interleaved[4*j + i] != states[i][j]) errors++;
+		}
+	}
+
+	if (errors == 0) LOG_info("Keccak: keyed SHAKE and %u-way permutation correct", keccak_mb_lanes());
+	else LOG_error("Keccak: %d mismatches!", errors);
+	return errors;
+}
+
+
+
+/*
+ * Compares the incremental HASH_keyhash_init/update/final() against HASH_keyhash()
+ * for pieces of different sizes that cross the block boundaries, keyed and unkeyed.
+ * \return number of mismatching hashes
+ */
+int test_stream(const HASH_Config config, const char* name){
+	static byte_t input[BATCH_MAX_LEN];
+	const size_t lengths[] = {0, 1, 20, 55, 64, 136, 168, 200, BATCH_MAX_LEN};
+	const size_t pieces[] = {1, 7, 20, 32, 64, 129, BATCH_MAX_LEN};
+	hash_t expected[64];
+	hash_t output[64];
+	key_s key;
+	HASH_Stream stream;
+	int errors = 0;
+
+	const HASH_Ctx hash = HASH_ctx_init(config);
+	for(int j = 0; j < BATCH_MAX_LEN; j++) input[j] = (byte_t)(j*13 + 5);
+	for(int j = 0; j < CFG_HASH_KEY_SIZE; j++) key.bytes[j] = (byte_t)(j*3 + 1);
+
+	for(int l = 0; l < sizeof(lengths)/sizeof(lengths[0]); l++){
+		for(int p = 0; p < sizeof(pieces)/sizeof(pieces[0]); p++){
+			for(int keyed = 0; keyed < 2; keyed++){
+				HASH_keyhash(&hash, expected, input, lengths[l], keyed ? &key : 0);
+				HASH_keyhash_init(&hash, &stream, keyed ? &key : 0);
+				for(size_t pos = 0; pos < lengths[l]; pos += pieces[p]){
+					size_t len = (lengths[l] - pos < pieces[p]) ? lengths[l] - pos : pieces[p];
+					HASH_keyhash_update(&stream, input + pos, len);
+				}
+				HASH_keyhash_final(&stream, output);
+				if (memcmp(expected, output, config.size) != 0) errors++;
+			}
+		}
+	}
+
+	if (errors == 0) LOG_info("Stream %s: identical to one call", name);
+	else LOG_error("Stream %s: %d hashes differ from one call!", name, errors);
+	return errors;
+}
+
+
+static void stats_task(void* arg, unsigned int idx){
+	const byte_t input[64] = { (byte_t)idx };
+	hash_t output[32];
+	HASH_hash( (const HASH_Ctx*)arg, output, input, sizeof(input));
+}
+
+
+/*
+ * The hashes of pool workers stay in the stats after the pool is destroyed
+ * and their counter blocks are freed, and a reset clears them.
+ * \return number of errors
+ */
+int test_stats_threads(){
+	const unsigned pools = 8;
+	const unsigned tasks = 64;
+	const HASH_Ctx hash = HASH_ctx_init(HASH_SHA2_256);
+	HASH_Stats stats;
+	uint64_t calls = 0;
+	int errors = 0;
+
+	if (!CFG_HASH_PROFILING) return 0;
+	HASH_reset_stats();
+	for(unsigned i = 0; i < pools; i++){
+		POOL_Pool* pool = POOL_create(3);
+		if (pool == NULL) return 1;
+		POOL_run(pool, stats_task, (void*)&hash, tasks);
+		POOL_destroy(pool);
+	}
+	HASH_get_stats(&stats);
+	for(int p = 0; p < HASH_PHASE_NUM; p++) calls += stats.calls[p];
+	if (calls != pools*tasks) errors++;
+
+	HASH_reset_stats();
+	HASH_get_stats(&stats);
+	for(int p = 0; p < HASH_PHASE_NUM; p++) if (stats.calls[p] != 0 || stats.bytes[p] != 0) errors++;
+
+	if (errors == 0) LOG_info("Stats: %u hashes of %u exited pools counted, reset clears them", pools*tasks, pools);
+	else LOG_error("Stats: %" PRIu64 " of %u hashes of exited pools counted!", calls, pools*tasks);
+	return errors;
+}
+
+
+/*
+ * Installs every registered backend and compares it against the reference one.
+ * Then lets the registry pick the fastest backends.
+ * \return number of mismatching hashes
+ */
+int test_backend_registry(){
+	const char* families[3] = {"sha256", "blake2b", "keccak"};
+	const HASH_Config configs[3] = {HASH_SHA2_256, HASH_BLAKE2B_160, HASH_SHAKE_256};
+	byte_t input[HASH_TUNE_PK_BYTES];
+	hash_t expected[64];
+	hash_t output[64];
+	key_s key = {{0}};
+	int errors = 0;
+
+	for(int i = 0; i < sizeof(input); i++) input[i] = (byte_t)(i*7 + 3);
+
+	for(int f = 0; f < 3; f++){
+		const char* name;
+		HASH_set_backend(families[f], "ref");
+		HASH_Ctx hash = HASH_ctx_init(configs[f]);
+		HASH_keyhash(&hash, expected, input, sizeof(input), &key);
+
+		for(unsigned int idx = 0; (name = HASH_backend_name(families[f], idx)) != NULL; idx++){
+			if (HASH_set_backend(families[f], name) != 0){
+				LOG_info("Backend %s/%s: not supported", families[f], name);
+				continue;
+			}
+			hash = HASH_ctx_init(configs[f]);
+			HASH_keyhash(&hash, output, input, sizeof(input), &key);
+			int failed = (memcmp(expected, output, configs[f].size) != 0);
+			failed += test_batch(configs[f], name);
+			failed += test_stream(configs[f], name);
+			if (failed == 0) LOG_info("Backend %s/%s: identical to ref", families[f], name);
+			else LOG_error("Backend %s/%s: differs from ref!", families[f], name);
+			errors += failed;
+		}
+		HASH_set_backend(families[f], "auto");
+	}
+
+	for(int f = 0; f < 3; f++){   // installing a backend must not change existing contexts
+		const HASH_Ctx before = HASH_ctx_init(configs[f]);
+		const unsigned int lanes = HASH_lanes(&before);
+		HASH_set_backend(families[f], "ref");
+		const HASH_Ctx after = HASH_ctx_init(configs[f]);
+		HASH_keyhash(&before, output, input, sizeof(input), &key);
+		HASH_keyhash(&after, expected, input, sizeof(input), &key);
+		if (HASH_lanes(&before) != lanes || HASH_lanes(&after) != 1 || memcmp(expected, output, configs[f].size) != 0){
+			LOG_error("Backend %s/ref: changed an existing context!", families[f]);
+			errors++;
+		}
+		HASH_set_backend(families[f], "auto");
+	}
+
+	HASH_tune_backends(HASH_TUNE_PK_BYTES);
+	LOG_info("Tuned backends: sha256=%s, blake2b=%s, keccak=%s", HASH_get_backend("sha256"), HASH_get_backend("blake2b"), HASH_get_backend("keccak"));
+	for(int f = 0; f < 3; f++) HASH_set_backend(families[f], "auto");
+	return errors;
+}
+
+
+
+/*
+ * Usage: test_hashes [ref|shani]  to force a SHA-256 backend
+ */
+int main(int argc, char** argv){
 	LOG_setLevel(LOG_LVL_DEBUG);
 	LOG_setLogFile("./main.log");
 
+#if !CFG_SHA256_USE_OPENSSL
+	if (argc > 1){
+		int status = -1;
+		if (strcmp(argv[1], "ref") == 0) status = SHA256_set_backend(SHA256_BACKEND_REF);
+		if (strcmp(argv[1], "shani") == 0) status = SHA256_set_backend(SHA256_BACKEND_SHANI);
+		if (status != 0){
+			LOG_error("SHA-256 backend %s is not supported!", argv[1]);
+			return 1;
+		}
+	}
+	LOG_info("SHA-256 backend: %s", sha256_backend_name( SHA256_get_backend() ));
+#endif
+
 	const int VECTOR_NUM = 2; 
 	char* testvectors[2] = { "", "abc" };
+	const char* sha256_expected[2] = {   // FIPS 180-2
+		"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+		"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" };
+	int errors = 0;
 	hash_t output[32];
 	profile_s prof_hash;
+	HASH_Ctx hash;
 
 
 	printf("\nRunning Testvectors\n");
@@ -26,20 +412,71 @@ int main(){
 	for(int i = 0; i < VECTOR_NUM; i++){
 		LOG_info("Testvector: \"%s\":", testvectors[i]);
 
-		HASH_config(HASH_SHA2_256);
-		HASH_hash(output, (unsigned char*)testvectors[i], strlen(testvectors[i]) );
-		LOG_info("SHA-256  : %s -> %s", testvectors[i], HASH_hexstr( output) );   // e3b0c442... and 
+		hash = HASH_ctx_init(HASH_SHA2_256);
+		HASH_hash(&hash, output, (unsigned char*)testvectors[i], strlen(testvectors[i]) );
+		LOG_info("SHA-256  : %s -> %s", testvectors[i], HASH_hexstr( output, hash.config.size ) );
+		if (strcmp(HASH_hexstr( output, hash.config.size ), sha256_expected[i]) != 0){
+			LOG_error("SHA-256 of \"%s\" does not match FIPS 180-2!", testvectors[i]);
+			errors++;
+		}
+
+		hash = HASH_ctx_init(HASH_SHAKE_128);
+		HASH_hash(&hash, output, (unsigned char*)testvectors[i], strlen(testvectors[i]) );
+		LOG_info("SHAKE-128: %s -> %s", testvectors[i], HASH_hexstr( output, hash.config.size ) );
+
+
+		hash = HASH_ctx_init(HASH_BLAKE2B_256);
+		HASH_hash(&hash, output, (unsigned char*)testvectors[i], strlen(testvectors[i]) );
+		LOG_info("Blake 256: %s -> %s\n", testvectors[i], HASH_hexstr( output, hash.config.size ) );  // 10ebb6770... and  bddd813c6
+
+	}
 
-		HASH_config(HASH_SHAKE_128);
-		HASH_hash(output, (unsigned char*)testvectors[i], strlen(testvectors[i]) );
-		LOG_info("SHAKE-128: %s -> %s", testvectors[i], HASH_hexstr( output) );
 
 
-		HASH_config(HASH_BLAKE2B_256);
-		HASH_hash(output, (unsigned char*)testvectors[i], strlen(testvectors[i]) );
-		LOG_info("Blake 256: %s -> %s\n", testvectors[i], HASH_hexstr( output) );  // 10ebb6770... and  bddd813c6
+	printf("\nRunning Batch Tests\n");
+	printf("=====================================================\n\n");
 
+#if !CFG_SHA256_USE_OPENSSL
+	errors += test_sha256_backends();
+	errors += test_sha256_fastpaths();
+#endif
+	const unsigned max_lanes[] = {1, 4, 8, 16};
+	for(int i = 0; i < 4; i++){   // test every kernel width that this CPU supports
+		sha256_mb_limit(max_lanes[i]);
+		hash = HASH_ctx_init(HASH_SHA2_256);
+		if (i == 0 || HASH_lanes(&hash) == max_lanes[i]) errors += test_batch(HASH_SHA2_256, "SHA-256");
+	}
+	sha256_mb_limit(0);
+	errors += test_blake2b_backends();
+	const unsigned max_lanes_x4[] = {1, 4};
+	for(int i = 0; i < 2; i++){
+		blake2b_mb_limit(max_lanes_x4[i]);
+		hash = HASH_ctx_init(HASH_BLAKE2B_256);
+		if (i == 0 || HASH_lanes(&hash) == max_lanes_x4[i]){
+			errors += test_batch(HASH_BLAKE2B_256, "Blake 256");
+			errors += test_batch(HASH_BLAKE2B_160, "Blake 160");
+			errors += test_batch(HASH_BLAKE2B_TW_256, "Blake TW 256");
+			errors += test_batch(HASH_BLAKE2B_TW_160, "Blake TW 160");
+		}
+	}
+	blake2b_mb_limit(0);
+	errors += test_keccak();
+	for(int i = 0; i < 2; i++){
+		keccak_mb_limit(max_lanes_x4[i]);
+		hash = HASH_ctx_init(HASH_SHAKE_128);
+		if (i == 0 || HASH_lanes(&hash) == max_lanes_x4[i]){
+			errors += test_batch(HASH_SHAKE_128, "SHAKE-128");
+			errors += test_batch(HASH_SHAKE_256, "SHAKE-256");
+		}
 	}
+	keccak_mb_limit(0);
+	errors += test_stream(HASH_SHA2_256, "SHA-256");
+	errors += test_stream(HASH_BLAKE2B_160, "Blake 160");
+	errors += test_stream(HASH_BLAKE2B_TW_160, "Blake TW 160");
+	errors += test_stream(HASH_SHAKE_128, "SHAKE-128");
+	errors += test_stream(HASH_SHAKE_256, "SHAKE-256");
+	errors += test_backend_registry();
+	errors += test_stats_threads();
 
 
 
@@ -61,37 +498,78 @@ int main(){
 
 	// SHA-256
 	PROFILER_reset( &prof_hash);
-	HASH_config(HASH_SHA2_256);
+	hash = HASH_ctx_init(HASH_SHA2_256);
 
 	for(int i = 0; i < rounds; i++){
 		PROFILER_start( &prof_hash);
-		HASH_hash(output, output, 32);
+		HASH_hash(&hash, output, output, 32);
 		PROFILER_stop( &prof_hash);
 	}
 	PROFILER_print( "SHA256", &prof_hash);
 
-	// SHAKE-256
+	// SHA-256 batch: one WOTS chain step per lane
+	hash_t lanes[BATCH_MAX_NUM][32] = {{0}};
+	hash_t* lane_ptrs[BATCH_MAX_NUM];
+	key_s lane_key = {{0}};
+	const key_s* lane_keys[BATCH_MAX_NUM];
+	unsigned num_lanes = HASH_lanes(&hash);
+	for(int i = 0; i < num_lanes; i++){ lane_ptrs[i] = lanes[i]; lane_keys[i] = &lane_key; }
+
+	PROFILER_reset( &prof_hash);
+	for(int i = 0; i < rounds; i++){
+		PROFILER_start( &prof_hash);
+		HASH_keyhash_xN(&hash, lane_ptrs, (const byte_t* const*)lane_ptrs, 32, lane_keys, num_lanes);
+		PROFILER_stop( &prof_hash);
+	}
+	printf("%u lanes: ", num_lanes); PROFILER_print( "SHA256_xN", &prof_hash);
+
+	// SHAKE-128
 	PROFILER_reset( &prof_hash);
-	HASH_config(HASH_SHAKE_128);
+	hash = HASH_ctx_init(HASH_SHAKE_128);
 
 	for(int i = 0; i < rounds; i++){
 		PROFILER_start( &prof_hash);
-		HASH_hash(output, output, 32);
+		HASH_hash(&hash, output, output, 32);
 		PROFILER_stop( &prof_hash);
 	}
 	PROFILER_print( "SHAKE128", &prof_hash);
 
+	// SHAKE-128 batch
+	num_lanes = HASH_lanes(&hash);
+	for(int i = 0; i < num_lanes; i++){ lane_ptrs[i] = lanes[i]; lane_keys[i] = &lane_key; }
+
+	PROFILER_reset( &prof_hash);
+	for(int i = 0; i < rounds; i++){
+		PROFILER_start( &prof_hash);
+		HASH_keyhash_xN(&hash, lane_ptrs, (const byte_t* const*)lane_ptrs, 32, lane_keys, num_lanes);
+		PROFILER_stop( &prof_hash);
+	}
+	printf("%u lanes: ", num_lanes); PROFILER_print( "SHAKE128_xN", &prof_hash);
+
 
 	// BLAKE2B_256
 	PROFILER_reset( &prof_hash);
-	HASH_config(HASH_BLAKE2B_256);
+	hash = HASH_ctx_init(HASH_BLAKE2B_256);
 
 	for(int i = 0; i < rounds; i++){
 		PROFILER_start( &prof_hash);
-		HASH_hash(output, output, 32);
+		HASH_hash(&hash, output, output, 32);
 		PROFILER_stop( &prof_hash);
 	}
 	PROFILER_print( "BLAKE2B_256", &prof_hash);
 
-}
+	// BLAKE2B_256 batch
+	num_lanes = HASH_lanes(&hash);
+	for(int i = 0; i < num_lanes; i++){ lane_ptrs[i] = lanes[i]; lane_keys[i] = &lane_key; }
 
+	PROFILER_reset( &prof_hash);
+	for(int i = 0; i < rounds; i++){
+		PROFILER_start( &prof_hash);
+		HASH_keyhash_xN(&hash, lane_ptrs, (const byte_t* const*)lane_ptrs, 32, lane_keys, num_lanes);
+		PROFILER_stop( &prof_hash);
+	}
+	printf("%u lanes: ", num_lanes); PROFILER_print( "BLAKE2B_256_xN", &prof_hash);
+
+
+	return errors;
+}
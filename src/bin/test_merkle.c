@@ -33,7 +33,7 @@ Stats_s G_stats[sizeof(HASH_Algo_t)];
 void benchmark_merkle(const MT_Config config){
 
 	// generate tree
-	HASH_config(config.cfg_hash);
+	const HASH_Ctx hash = HASH_ctx_init(config.cfg_hash);
 	MT_Tree tree;
 	MT_Path path = MT_init_path( &(config) );
 
@@ -61,9 +61,9 @@ void benchmark_merkle(const MT_Config config){
 		memset(digest, 0x88, config.cfg_hash.size);
 		for(int idx = 0; idx < (1 << config.height); idx++){
 			MT_add( &tree, digest);
-			HASH_hash( digest, digest, config.cfg_hash.size );
+			HASH_hash( &hash, digest, digest, config.cfg_hash.size );
 		}
-		printf("\nmode %d: root=%s", mode, HASH_hexstr(tree.root) );
+		printf("\nmode %d: root=%s", mode, HASH_hexstr( tree.root, config.cfg_hash.size ) );
 		MT_free( &tree );
 	}
 
@@ -79,7 +79,7 @@ void benchmark_merkle(const MT_Config config){
 		MT_add( &tree, digest);
 			PROFILER_stop( &prof_add);
 
-		HASH_hash( digest, digest, config.cfg_hash.size );
+		HASH_hash( &hash, digest, digest, config.cfg_hash.size );
 	}
 
 	CLI_print_merkle( &tree );  // print Merkle tree
@@ -88,7 +88,7 @@ void benchmark_merkle(const MT_Config config){
 	// fast forward desire seed
 	memcpy(desire, digest, config.cfg_hash.size);
 	for(int idx = 0; idx < (1 << (tree.exist.height)); idx++){
-		HASH_hash( desire, desire, config.cfg_hash.size );
+		HASH_hash( &hash, desire, desire, config.cfg_hash.size );
 	}
 
 	for(int idx = 0; idx < (1 << config.height); idx++){
@@ -104,18 +104,18 @@ void benchmark_merkle(const MT_Config config){
 
 		// root from path
 			PROFILER_start( &prof_path);
-		MT_root_from_path( &path, digest, idx, (hash_t*)&path_root);
+		MT_root_from_path( &hash, &path, digest, idx, (hash_t*)&path_root);
 			PROFILER_stop( &prof_path);
 
 		// validate:
 		is_valid =(bool)(memcmp(path_root, tree.root, tree.config.cfg_hash.size) == 0);
-		LOG_debug("digest=%.8s, mt_root=%.8s, path_root=%.8s", HASH_hexstr( digest ), HASH_hexstr( tree.root ), HASH_hexstr( path_root ) );
+		LOG_debug("digest=%.8s, mt_root=%.8s, path_root=%.8s", HASH_hexstr( digest, 4 ), HASH_hexstr( tree.root, 4 ), HASH_hexstr( path_root, 4 ) );
 		if (!is_valid) LOG_error("Invalid path_root! ");
 
 
 		// update digest and desire
-		HASH_hash( digest, digest, config.cfg_hash.size );
-		HASH_hash( desire, desire, config.cfg_hash.size );
+		HASH_hash( &hash, digest, digest, config.cfg_hash.size );
+		HASH_hash( &hash, desire, desire, config.cfg_hash.size );
 	}
 
 
@@ -133,6 +133,103 @@ void benchmark_merkle(const MT_Config config){
 }
 
 
+// leaf i of the layer tests
+static void layer_leaf(const HASH_Ctx* hash, uint32_t idx, hash_t* leaf){
+	HASH_hash( hash, leaf, (const unsigned char*)&idx, sizeof(idx) );
+}
+
+
+/*
+ * Generates and checks all paths of a tree, growing the leaves it requests.
+ * \param[in] max_grows leaves that a path may request
+ * \return number of invalid paths or roots
+ */
+int test_traversal(const MT_Config config, MT_Tree tree, const char* name, unsigned max_grows_allowed){
+	const HASH_Ctx hash = HASH_ctx_init(config.cfg_hash);
+	MT_Config cfg_half = config;
+	cfg_half.engine = MT_ENGINE_FRACTAL;
+	MT_Tree half = MT_init( &cfg_half, MT_FRACTAL_HALF );
+	MT_Path path = MT_init_path( &config );
+	hash_t leaf[config.cfg_hash.size];
+	hash_t path_root[config.cfg_hash.size];
+	int errors = 0;
+	unsigned max_grows = 0;
+	profile_s prof_path;
+	PROFILER_reset(&prof_path);
+
+	for (uint32_t idx = 0; idx < (1u << config.height); idx++){
+		layer_leaf(&hash, idx, leaf);
+		MT_add( &tree, leaf);
+		MT_add( &half, leaf);
+	}
+	if (memcmp(tree.root, half.root, config.cfg_hash.size) != 0) errors++;
+
+	for (uint32_t idx = 0; idx < (1u << config.height); idx++){
+		unsigned grows = 0;
+		MT_index_t grow_idx;
+		PROFILER_start( &prof_path);
+		layer_leaf(&hash, idx, leaf);
+		MT_generate_path( &tree, leaf, &path);
+		while ((grow_idx = MT_get_grow_leaf_idx( &tree )) != 0){
+			layer_leaf(&hash, grow_idx, leaf);
+			MT_grow_dtree( &tree, leaf);
+			grows++;
+		}
+		PROFILER_stop( &prof_path);
+		if (grows > max_grows) max_grows = grows;
+
+		layer_leaf(&hash, idx, leaf);
+		MT_root_from_path( &hash, &path, leaf, idx, path_root);
+		if (memcmp(path_root, tree.root, config.cfg_hash.size) != 0){
+			LOG_error("Invalid path_root of leaf %d with %s", idx, name);
+			errors++;
+		}
+	}
+	if (max_grows > max_grows_allowed) errors++;
+
+	printf("\n%s (h=%d): max %d grown leaves per path, %ld B: %s\n", name, config.height,
+		max_grows, MT_sizeof_alloc(&tree), (errors == 0) ? "OK" : "FAILED");
+	PROFILER_print("MT_path+grow", &prof_path);
+
+	MT_free( &tree );
+	MT_free( &half );
+	MT_free_path( &path );
+	return errors;
+}
+
+
+int test_layers(const MT_Config config, uint8_t num_layers, const uint8_t* heights){
+	char name[32];
+	snprintf(name, sizeof(name), "Layers %d", num_layers);
+	MT_Tree tree = MT_init_layers( &config, num_layers, heights );
+	int errors = (MT_sizeof_alloc(&tree) != MT_sizeof_split(&config, num_layers, heights, false));
+	return errors + test_traversal(config, tree, name, num_layers - 1);
+}
+
+
+// 2 layers with a bottom subtree of any height, with the leaf cache
+int test_bottom(const MT_Config config, uint8_t height_bottom){
+	char name[32];
+	const uint8_t heights[2] = { height_bottom, config.height - height_bottom };
+	snprintf(name, sizeof(name), "Bottom height %d", height_bottom);
+	MT_Tree tree = MT_init( &config, MT_FRACTAL_BOTTOM_HEIGHT(height_bottom) );
+	int errors = (tree.exist.height != height_bottom);
+	errors += MT_init_leaf_cache( &tree ) != 0;
+	errors += (MT_sizeof_alloc(&tree) != MT_sizeof_split(&config, 2, heights, true));
+	return errors + test_traversal(config, tree, name, (height_bottom < config.height) ? 1 : 0);
+}
+
+
+int test_bds(MT_Config config, uint8_t k){
+	char name[32];
+	config.engine = MT_ENGINE_BDS;
+	config.bds_k = k;
+	snprintf(name, sizeof(name), "BDS k=%d", k);
+	return test_traversal(config, MT_init( &config, MT_FRACTAL_HALF ), name, (config.height - k) / 2);
+}
+
+
+
 // ============================================================================
 // public function implementations
 // ============================================================================
@@ -141,11 +238,34 @@ int main(){
 	LOG_setLogFile("./merkle_test.log");
 
 
-	MT_Config config;
-	config.cfg_hash = HASH_SHA2_256;
-	config.height = 8;
+	MT_Config config = { HASH_SHA2_256, 8 };
 
 	benchmark_merkle(config);
 
-	return 0;
+	printf("\n\n.:: Testing fractal layers\n");
+	printf("=====================================================\n");
+	int errors = 0;
+	const uint8_t uneven[] = {2, 3, 1, 2};
+	errors += test_layers(config, 2, NULL);
+	errors += test_layers(config, 3, NULL);
+	errors += test_layers(config, 4, uneven);
+	errors += test_layers(config, 8, NULL);
+	for (uint8_t height_bottom = 0; height_bottom <= config.height; height_bottom++) errors += test_bottom(config, height_bottom);
+	errors += test_bds(config, 2);
+	errors += test_bds(config, 4);
+	errors += test_bds(config, 8);
+	config.height = 5;
+	errors += test_bds(config, 3);
+	config.height = 2;
+	errors += test_bds(config, 2);
+
+	// comparison with MT_FRACTAL_HALF (= 2 layers)
+	config.height = 16;
+	errors += test_layers(config, 2, NULL);
+	errors += test_layers(config, 4, NULL);
+	errors += test_bds(config, 2);
+	errors += test_bds(config, 4);
+	printf("\n");
+
+	return errors;
 }
\ No newline at end of file
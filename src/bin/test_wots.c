@@ -5,6 +5,9 @@
 
 // own includes
 #include "../hash.h"
+#include "../hashes/sha256_mb.h"
+#include "../hashes/blake2b_mb.h"
+#include "../hashes/fips202_mb.h"
 #include "../wots.h"
 #include "../merkle.h"
 #include "../amss.h"
@@ -33,7 +36,6 @@ Stats_s G_stats[sizeof(HASH_Algo_t)];
 void average_wots(const WOTS_Config config){
 
 	// generate WOTS
-	HASH_config(config.cfg_hash);
 	WOTS_Wots wots = WOTS_init( &config);
 	hash_t seed[CFG_WOTS_SEED_SIZE] = { 'x' };
 	key_s hashkey = {0};
@@ -52,7 +54,7 @@ void average_wots(const WOTS_Config config){
 
 	printf("\n\n.:: Testing 1 avg. "); CLI_print_wots_config( wots.config );
 	printf("\n=====================================================\n");
-	printf("Statistics for signing %.8s:\n", HASH_hexstr( avg_hash ) ); HASH_reset_stats();
+	printf("Statistics for signing %.8s:\n", HASH_hexstr( avg_hash, 4 ) ); HASH_reset_stats();
 
 	WOTS_import_seckey( &wots, seed, hashkey);
 	WOTS_generate_pubkey( &wots );
@@ -68,16 +70,330 @@ void average_wots(const WOTS_Config config){
 }
 
 
+/*
+ * Checks the per-phase hash counters of one WOTS key generation.
+ * \return number of wrong counters
+ */
+int test_phase_stats(const WOTS_Config config){
+	WOTS_Wots wots = WOTS_init( &config);
+	hash_t seed[CFG_WOTS_SEED_SIZE] = { 'x' };
+	key_s hashkey = {0};
+	HASH_Stats stats;
+	int errors = 0;
+
+	if (!CFG_HASH_PROFILING) return 0;
+
+	HASH_reset_stats();
+	WOTS_import_seckey( &wots, seed, hashkey);
+	WOTS_generate_pubkey( &wots );
+	HASH_get_stats( &stats );
+
+	const uint64_t steps = wots.code_digits*(wots.config.code_base-1) + wots.csum_digits*(wots.csum_base-1);
+	if (stats.calls[HASH_PHASE_SEED] != wots.num_chains) errors++;
+	if (stats.calls[HASH_PHASE_CHAIN] != steps) errors++;
+	if (stats.calls[HASH_PHASE_WOTS_PK] != 1) errors++;
+	if (stats.bytes[HASH_PHASE_WOTS_PK] != wots.num_chains*config.cfg_hash.size) errors++;
+	if (stats.calls[HASH_PHASE_OTHER] + stats.calls[HASH_PHASE_TREE] + stats.calls[HASH_PHASE_KEY] != 0) errors++;
+
+	if (errors == 0) LOG_info("Phase stats: %d chains, %d steps counted correctly", wots.num_chains, (int)steps);
+	else LOG_error("Phase stats: %d counters wrong!", errors);
+	HASH_reset_stats();
+	WOTS_free( &wots );
+	return errors;
+}
+
+
+/*
+ * Checks that the batched indexed seed expansion matches WOTS_chain_seed().
+ * Signing the all-zero digest leaves the message chains at their seeds.
+ * \return number of errors
+ */
+int test_indexed_seeds(const WOTS_Config config){
+	WOTS_Wots wots = WOTS_init( &config);
+	hash_t seed[CFG_WOTS_SEED_SIZE] = { 'x' };
+	key_s hashkey = { "hashkeyshashkeys" };
+	WOTS_chains_t signature[config.cfg_hash.size*(wots.num_chains)];
+	hash_t msg_digest[config.cfg_hash.size];
+	hash_t chain_seed[config.cfg_hash.size];
+	int errors = 0;
+
+	memset(msg_digest, 0, config.cfg_hash.size);
+	WOTS_import_seckey( &wots, seed, hashkey);
+	WOTS_generate_pubkey( &wots );
+	WOTS_sign( &wots, msg_digest, signature);
+	if (!WOTS_verify( &wots, msg_digest, signature)) errors++;
+
+	for(int i = 0; i < wots.code_digits; i++){
+		WOTS_chain_seed( &wots, i, chain_seed);
+		if (memcmp(chain_seed, signature + i*config.cfg_hash.size, config.cfg_hash.size) != 0) errors++;
+	}
+
+	if (errors == 0) LOG_info("Indexed seeds: batch and random access identical, signature valid");
+	else LOG_error("Indexed seeds: %d errors!", errors);
+	WOTS_free( &wots );
+	return errors;
+}
+
+
+#define LANES_DIGESTS 3
+
+
+/*
+ * Generates the pubkey, signs LANES_DIGESTS digests and recovers the root of
+ * each signature with the backends installed now.
+ * \return lanes of the hash context
+ */
+static unsigned wots_outputs(const WOTS_Config* config, hash_t* root, WOTS_chains_t* sigs, hash_t* sig_roots){
+	WOTS_Wots wots = WOTS_init( config );
+	const size_t size_hash = config->cfg_hash.size;
+	const size_t sig_size = WOTS_sig_size( config );
+	hash_t seed[CFG_WOTS_SEED_SIZE] = { 'l' };
+	key_s hashkey = { "hashkeyshashkeys" };
+	hash_t msg_digest[size_hash];
+
+	WOTS_import_seckey( &wots, seed, hashkey);
+	WOTS_generate_pubkey( &wots );
+	memcpy(root, wots.root, size_hash);
+	memset(msg_digest, 0x3C, size_hash);
+	for(int i = 0; i < LANES_DIGESTS; i++){
+		HASH_hash( &(wots.hash), msg_digest, msg_digest, size_hash );
+		WOTS_sign( &wots, msg_digest, sigs + i*sig_size);
+		WOTS_root_from_sig( &wots, msg_digest, sigs + i*sig_size, sig_roots + i*size_hash);
+	}
+	const unsigned lanes = HASH_lanes( &(wots.hash) );
+	WOTS_free( &wots );
+	return lanes;
+}
+
+
+/*
+ * WOTS_generate_pubkey(), WOTS_sign() and WOTS_root_from_sig() with the family
+ * pinned to ref (one lane) and with the auto backend limited to every batch
+ * width this CPU supports must give identical bytes. The chain counts are no
+ * multiples of the widths, so the last batch of each run is partial.
+ * \return number of differing runs
+ */
+int test_backend_lanes(const WOTS_Config config, const char* family, void (*mb_limit)(unsigned int)){
+	const size_t size_hash = config.cfg_hash.size;
+	const size_t sig_size = WOTS_sig_size( &config );
+	hash_t ref_root[size_hash];
+	WOTS_chains_t ref_sigs[LANES_DIGESTS*sig_size];
+	hash_t ref_sig_roots[LANES_DIGESTS*size_hash];
+	hash_t root[size_hash];
+	WOTS_chains_t sigs[LANES_DIGESTS*sig_size];
+	hash_t sig_roots[LANES_DIGESTS*size_hash];
+	const unsigned max_lanes[] = {0, 2, 4, 8, 16};   // 0: no limit
+	int errors = 0;
+
+	printf("Backend lanes "); CLI_print_wots_config(config); printf(": ref");
+	if (HASH_set_backend(family, "ref") != 0 || wots_outputs( &config, ref_root, ref_sigs, ref_sig_roots) != 1) errors++;
+	HASH_set_backend(family, "auto");
+	for(int i = 0; i < sizeof(max_lanes)/sizeof(max_lanes[0]); i++){
+		mb_limit(max_lanes[i]);
+		const unsigned lanes = wots_outputs( &config, root, sigs, sig_roots);
+		if (max_lanes[i] != 0 && lanes != max_lanes[i]) continue;   // width not supported by this CPU
+		printf(" = %u", lanes);
+		if (memcmp(root, ref_root, size_hash) != 0 || memcmp(sigs, ref_sigs, sizeof(sigs)) != 0
+			|| memcmp(sig_roots, ref_sig_roots, sizeof(sig_roots)) != 0){
+			printf(" FAILED");
+			errors++;
+		}
+	}
+	mb_limit(0);
+
+	printf(" lanes: %s\n", (errors == 0) ? "OK" : "FAILED");
+	return errors;
+}
+
+
+/*
+ * Verifies the same signatures single-threaded and with the verify pool.
+ * \return number of invalid signatures
+ */
+int test_parallel_verify(const WOTS_Config config, unsigned workers, unsigned rounds){
+	WOTS_Wots wots = WOTS_init( &config);
+	hash_t seed[CFG_WOTS_SEED_SIZE] = { 'x' };
+	key_s hashkey = { "hashkeyshashkeys" };
+	WOTS_chains_t signature[config.cfg_hash.size*(wots.num_chains)];
+	hash_t msg_digest[config.cfg_hash.size];
+	profile_s prof_serial;
+	profile_s prof_parallel;
+	POOL_Pool* pool = POOL_create(workers);
+	int errors = 0;
+
+	if (pool == NULL) {
+		LOG_error("Parallel verify: cannot start %u threads.", workers);
+		WOTS_free( &wots );
+		return 1;
+	}
+	PROFILER_reset(&prof_serial);
+	PROFILER_reset(&prof_parallel);
+	WOTS_import_seckey( &wots, seed, hashkey);
+	WOTS_generate_pubkey( &wots );
+
+	printf("\n\n.:: Parallel verification with %u workers: ", workers); CLI_print_wots_params( &wots );
+	printf("=====================================================\n");
+	for(int pass = 0; pass < 2; pass++){
+		profile_s* prof = (pass == 0) ? &prof_serial : &prof_parallel;
+		WOTS_set_verify_pool( &wots, (pass == 0) ? NULL : pool, 0);
+		memset(msg_digest, 0x88, config.cfg_hash.size);
+		for(int idx = 0; idx < rounds; idx++){
+			WOTS_sign( &wots, msg_digest, signature);
+				PROFILER_start( prof);
+			if (!WOTS_verify( &wots, msg_digest, signature)) errors++;
+				PROFILER_stop( prof);
+			HASH_hash( &(wots.hash), msg_digest, msg_digest, config.cfg_hash.size );
+		}
+	}
+	WOTS_set_verify_pool( &wots, NULL, 0);
+	POOL_destroy(pool);
+	PROFILER_print("WOTS_verify", &prof_serial);
+	PROFILER_print("WOTS_verify_parallel", &prof_parallel);
+
+	if (errors == 0) LOG_info("Parallel verify: %u signatures valid", 2*rounds);
+	else LOG_error("Parallel verify: %d signatures invalid!", errors);
+	WOTS_free( &wots );
+	return errors;
+}
+
+
+/*
+ * Signs and verifies with every Winternitz parameter w = 4 .. 256 and checks
+ * that a modified digest does not verify.
+ * \return number of errors
+ */
+int test_winternitz(const HASH_Config cfg_hash){
+	int errors = 0;
+
+	printf("\n\n.:: Winternitz parameters for "); CLI_print_hashname(cfg_hash);
+	printf("\n=====================================================\n");
+	for(unsigned w = 4; w <= 256; w *= 2){
+		const WOTS_Config config = {cfg_hash, w};
+		if (WOTS_num_chains( &config) > WOTS_MAX_CHAINS) {
+			printf("w=%3u: %3u chains exceed the supported %u, skipped\n", w, WOTS_num_chains( &config), WOTS_MAX_CHAINS);
+			continue;
+		}
+		WOTS_Wots wots = WOTS_init( &config);
+		hash_t seed[CFG_WOTS_SEED_SIZE] = { 'w' };
+		key_s hashkey = { "hashkeyshashkeys" };
+		WOTS_chains_t signature[config.cfg_hash.size*(wots.num_chains)];
+		hash_t msg_digest[config.cfg_hash.size];
+		hash_t root[config.cfg_hash.size];
+
+		memset(msg_digest, 0xA5, config.cfg_hash.size);
+		WOTS_import_seckey( &wots, seed, hashkey);
+		WOTS_generate_pubkey( &wots );
+		WOTS_sign( &wots, msg_digest, signature);
+		if (!WOTS_verify( &wots, msg_digest, signature)) errors++;
+		msg_digest[config.cfg_hash.size-1] ^= 1;   // last digit, padded if log2(w) does not divide 8n
+		WOTS_root_from_sig( &wots, msg_digest, signature, root);
+		if (memcmp(root, wots.root, config.cfg_hash.size) == 0) errors++;
+
+		printf("w=%3u: %3u chains (l1=%u, l2=%u of base %u), signature %4u B\n", w, (unsigned)wots.num_chains,
+			(unsigned)wots.code_digits, (unsigned)wots.csum_digits, (unsigned)wots.csum_base, (unsigned)(wots.num_chains*config.cfg_hash.size));
+		WOTS_free( &wots );
+	}
+
+	if (errors == 0) LOG_info("Winternitz w=4..256: all signatures valid, modified digests rejected");
+	else LOG_error("Winternitz w=4..256: %d errors!", errors);
+	return errors;
+}
+
+
+/*
+ * Signs and verifies different digests with a target-sum config. Every
+ * signature must take the same chain steps, and a modified counter must not verify.
+ * \return number of errors
+ */
+int test_target_sum(const WOTS_Config config, unsigned rounds){
+	WOTS_Wots wots = WOTS_init( &config);
+	hash_t seed[CFG_WOTS_SEED_SIZE] = { 't' };
+	key_s hashkey = { "hashkeyshashkeys" };
+	WOTS_chains_t signature[WOTS_sig_size( &config )];
+	hash_t msg_digest[config.cfg_hash.size];
+	hash_t root[config.cfg_hash.size];
+	const uint64_t verify_steps = wots.num_chains*(config.code_base-1) - wots.target_sum;
+	HASH_Stats stats;
+	uint64_t encodes = 0;
+	int errors = 0;
+
+	WOTS_import_seckey( &wots, seed, hashkey);
+	WOTS_generate_pubkey( &wots );
+	memset(msg_digest, 0x5A, config.cfg_hash.size);
+	for(unsigned idx = 0; idx < rounds; idx++){
+		HASH_hash( &(wots.hash), msg_digest, msg_digest, config.cfg_hash.size );
+
+		HASH_reset_stats();
+		if (WOTS_sign( &wots, msg_digest, signature) != 0) errors++;
+		HASH_get_stats( &stats );
+		if (CFG_HASH_PROFILING && stats.calls[HASH_PHASE_CHAIN] != wots.target_sum) errors++;
+		encodes += stats.calls[HASH_PHASE_ENCODE];
+
+		HASH_reset_stats();
+		if (!WOTS_verify( &wots, msg_digest, signature)) errors++;
+		HASH_get_stats( &stats );
+		if (CFG_HASH_PROFILING && stats.calls[HASH_PHASE_CHAIN] != verify_steps) errors++;
+	}
+	signature[wots.num_chains*config.cfg_hash.size + WOTS_COUNTER_SIZE-1] ^= 1;
+	WOTS_root_from_sig( &wots, msg_digest, signature, root);
+	if (memcmp(root, wots.root, config.cfg_hash.size) == 0) errors++;
+
+	if (errors == 0) LOG_info("Target sum %d: %d chains, sign %d and verify %d steps for every digest, %.1f digests per signature",
+		wots.target_sum, wots.num_chains, wots.target_sum, (int)verify_steps, (double)encodes/rounds);
+	else LOG_error("Target sum: %d errors!", errors);
+	HASH_reset_stats();
+	WOTS_free( &wots );
+	return errors;
+}
+
+
+/*
+ * WOTS_init() must reject target-sum configs that are out of reach or take
+ * more than WOTS_MAX_TARGET_TRIES counters per signature, and accept the others.
+ * \return number of errors
+ */
+int test_target_limits(){
+	const WOTS_Config accepted[] = {
+		WOTS_SHA2_256_W16_TARGET, WOTS_SHA2_256_W16_WOTSC, WOTS_BLAKE2B_160_W16_WOTSC,
+		{{HASH_SHA2, 32}, 16, WOTS_SEED_CHAINED, WOTS_ENC_TARGET_SUM, 3},        // 16^3 * ~90 tries
+		{{HASH_SHA2, 32}, 256, WOTS_SEED_CHAINED, WOTS_ENC_TARGET_SUM},
+		{{HASH_SHA2, 32}, 32, WOTS_SEED_CHAINED, WOTS_ENC_TARGET_SUM, 1},        // the zero digit is padded to 1 bit
+	};
+	const WOTS_Config rejected[] = {
+		{{HASH_SHA2, 32}, 16, WOTS_SEED_CHAINED, WOTS_ENC_TARGET_SUM, 4},        // 16^4 * ~90 tries
+		{{HASH_SHA2, 32}, 16, WOTS_SEED_CHAINED, WOTS_ENC_TARGET_SUM, 0, 900},   // far above the most likely sum 480
+		{{HASH_SHA2, 32}, 16, WOTS_SEED_CHAINED, WOTS_ENC_TARGET_SUM, 0, 961},   // out of reach
+		{{HASH_SHA2, 32}, 32, WOTS_SEED_CHAINED, WOTS_ENC_TARGET_SUM, 0, 1612},  // 52*31: the padded last digit is at most 16
+		{{HASH_SHA2, 32}, 16, WOTS_SEED_CHAINED, WOTS_ENC_TARGET_SUM, 64},       // no chain left
+	};
+	int errors = 0;
+
+	for (unsigned i = 0; i < sizeof(accepted)/sizeof(accepted[0]); i++){
+		WOTS_Wots wots = WOTS_init( &accepted[i] );
+		if (wots.root == NULL) errors++;
+		WOTS_free( &wots );
+	}
+	for (unsigned i = 0; i < sizeof(rejected)/sizeof(rejected[0]); i++){
+		WOTS_Wots wots = WOTS_init( &rejected[i] );
+		if (wots.root != NULL) errors++;
+		WOTS_free( &wots );
+	}
+
+	if (errors == 0) LOG_info("Target sum limits: reachable configs accepted, unreachable ones rejected");
+	else LOG_error("Target sum limits: %d errors!", errors);
+	return errors;
+}
+
+
 void benchmark_wots(const WOTS_Config config, unsigned rounds){
 
 	// generate WOTS
-	HASH_config(config.cfg_hash);
 	WOTS_Wots wots = WOTS_init( &config);
 	hash_t seed[CFG_WOTS_SEED_SIZE] = { 'x' };
 	key_s hashkey = { "hashkeyshashkeys" };
 	WOTS_import_seckey( &wots, seed, hashkey);
 	WOTS_generate_pubkey( &wots );
-	WOTS_chains_t signature[config.cfg_hash.size*(wots.num_chains)];
+	WOTS_chains_t signature[WOTS_sig_size( &config )];
 
 	hash_t msg_digest[config.cfg_hash.size];
 	memset(msg_digest, 0x88, config.cfg_hash.size);
@@ -97,7 +413,7 @@ void benchmark_wots(const WOTS_Config config, unsigned rounds){
 	bool succ;
 	HASH_reset_stats();	
 	for(int idx = 0; idx < rounds; idx++){
-		HASH_hash( seed, msg_digest, wots.config.cfg_hash.size );
+		HASH_hash( &(wots.hash), seed, msg_digest, wots.config.cfg_hash.size );
 
 			PROFILER_start( &prof_gen);
 		WOTS_import_seckey( &wots, seed, hashkey);
@@ -114,7 +430,7 @@ void benchmark_wots(const WOTS_Config config, unsigned rounds){
 
 		if (succ == false) LOG_error("WOTS Signature invalid!");
 
-		HASH_hash( msg_digest, msg_digest, wots.config.cfg_hash.size );
+		HASH_hash( &(wots.hash), msg_digest, msg_digest, wots.config.cfg_hash.size );
 	}
 
 	printf("\n\nStats:\n");
@@ -139,11 +455,43 @@ int main(){
 
 	average_wots(WOTS_BLAKE2B_160_W16);
 
+	average_wots(WOTS_BLAKE2B_TW_160_W16);
+
+	int errors = test_phase_stats(WOTS_SHA2_256_W16);
+	errors += test_indexed_seeds(WOTS_SHA2_256_W16_INDEXED);
+	errors += test_indexed_seeds(WOTS_BLAKE2B_TW_160_W16_INDEXED);
+	errors += test_winternitz(HASH_SHA2_256);
+	errors += test_winternitz(HASH_BLAKE2B_160);
+	errors += test_winternitz(HASH_SHAKE_256);   // n = 64 exceeds the seed size
+	errors += test_indexed_seeds((WOTS_Config){HASH_SHAKE_256, 16, WOTS_SEED_INDEXED});
+	errors += test_target_sum(WOTS_SHA2_256_W16_TARGET, 100);
+	errors += test_target_sum(WOTS_BLAKE2B_160_W16_TARGET, 100);
+	errors += test_target_sum(WOTS_SHA2_256_W16_WOTSC, 20);
+	errors += test_target_sum(WOTS_BLAKE2B_160_W16_WOTSC, 20);
+	errors += test_target_limits();
+	errors += test_backend_lanes(WOTS_SHA2_256_W4, "sha256", sha256_mb_limit);
+	errors += test_backend_lanes(WOTS_SHA2_256_W16, "sha256", sha256_mb_limit);
+	errors += test_backend_lanes(WOTS_SHA2_256_W256, "sha256", sha256_mb_limit);
+	errors += test_backend_lanes(WOTS_SHA2_256_W16_INDEXED, "sha256", sha256_mb_limit);
+	errors += test_backend_lanes(WOTS_SHA2_256_W16_WOTSC, "sha256", sha256_mb_limit);
+	errors += test_backend_lanes(WOTS_BLAKE2B_160_W16, "blake2b", blake2b_mb_limit);
+	errors += test_backend_lanes(WOTS_BLAKE2B_TW_160_W16, "blake2b", blake2b_mb_limit);
+	errors += test_backend_lanes(WOTS_BLAKE2B_TW_160_W16_INDEXED, "blake2b", blake2b_mb_limit);
+	errors += test_backend_lanes((WOTS_Config){HASH_SHAKE_128, 16}, "keccak", keccak_mb_limit);
+
 
 	const int ROUNDS = 100;
 	benchmark_wots(WOTS_SHA2_256_W16, ROUNDS);
+	benchmark_wots(WOTS_BLAKE2B_160_W16, ROUNDS);
+	benchmark_wots(WOTS_BLAKE2B_TW_160_W16, ROUNDS);
+	benchmark_wots(WOTS_SHA2_256_W16_INDEXED, ROUNDS);
+	benchmark_wots(WOTS_BLAKE2B_TW_160_W16_INDEXED, ROUNDS);
+	benchmark_wots(WOTS_SHA2_256_W16_TARGET, ROUNDS);
+	benchmark_wots(WOTS_SHA2_256_W16_WOTSC, ROUNDS);
+
+	errors += test_parallel_verify(WOTS_SHA2_256_W256, 3, ROUNDS);
 
 
-	return 0;
+	return errors;
 
 }
\ No newline at end of file
@@ -25,6 +25,7 @@
 // hash.h
 #define CFG_HASH_KEY_SIZE 16   // size of the hash key in bytes. Corresponds to the security string.
 #define CFG_HASH_PROFILING 1   // 1: profiling (performance statistics)  0: no profiling
+#define CFG_HASH_USE_OPENSSL_EVP 0  // 1: register OpenSSL EVP backends, add crypto to LIB_NAMES in the Makefile
 
 // sha256.h
 #define CFG_SHA256_USE_OPENSSL 0  // 1: use openssl 0: use c implementation
@@ -1,28 +1,107 @@
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "hash.h"
 #include "hashes/fips202.h"
+#include "hashes/fips202_mb.h"
 #include "hashes/blake2.h"
+#include "hashes/blake2b_mb.h"
 #include "hashes/sha256.h"
+#include "hashes/sha256_mb.h"
 
 
 #define HASH_VERBOSE 0    // 1: dump intermediate state, only use for debugging 
 #if HASH_VERBOSE
 #include <stdio.h>
-#include <string.h>
 #include <stdbool.h>
 #endif
 
 
-#if CFG_HASH_PROFILING
 #include <stdio.h>
-unsigned int G_profile_calls = 0;
-unsigned int G_profile_processed_bytes = 0;
+#include <inttypes.h>
+#include <time.h>
+
+#if CFG_HASH_USE_OPENSSL_EVP
+#include <openssl/evp.h>
 #endif
 
+#if CFG_HASH_PROFILING
+#include <stdatomic.h>
+
+/*
+ * Counters of one thread. Only the owning thread writes them, so relaxed
+ * load+store is enough and compiles to plain instructions. Other threads read
+ * them when merging. Blocks are linked into G_profile_list on first use. When
+ * the thread exits, profile_retire() adds its counts to the retired totals and
+ * frees the block, so the totals survive the end of a thread.
+ */
+typedef struct HASH_Counters {
+    _Atomic uint64_t calls[HASH_PHASE_NUM];
+    _Atomic uint64_t bytes[HASH_PHASE_NUM];
+    struct HASH_Counters* next;
+} HASH_Counters;
+
+static pthread_mutex_t G_profile_lock = PTHREAD_MUTEX_INITIALIZER;   // guards the list and the retired totals
+static HASH_Counters* G_profile_list = NULL;        // blocks of the running threads
+static uint64_t G_retired_calls[HASH_PHASE_NUM];    // counts of the exited threads
+static uint64_t G_retired_bytes[HASH_PHASE_NUM];
+static pthread_key_t G_profile_key;
+static pthread_once_t G_profile_once = PTHREAD_ONCE_INIT;
+static _Thread_local HASH_Counters* G_profile = NULL;
+static _Thread_local HASH_Phase_t G_profile_phase = HASH_PHASE_OTHER;
+
+
+/* destructor of G_profile_key: runs in the exiting thread */
+static void profile_retire(void* arg){
+    HASH_Counters* counters = arg;
+    pthread_mutex_lock(&G_profile_lock);
+    for (int p = 0; p < HASH_PHASE_NUM; p++){
+        G_retired_calls[p] += atomic_load_explicit(&(counters->calls[p]), memory_order_relaxed);
+        G_retired_bytes[p] += atomic_load_explicit(&(counters->bytes[p]), memory_order_relaxed);
+    }
+    HASH_Counters** link = &G_profile_list;
+    while (*link != counters) link = &((*link)->next);
+    *link = counters->next;
+    pthread_mutex_unlock(&G_profile_lock);
+    free(counters);
+    G_profile = NULL;   // a later hash in this thread registers again
+}
+
+
+static void profile_key_create(){
+    if (pthread_key_create(&G_profile_key, profile_retire) != 0){
+        printf("hash.c: no thread key for profiling counters!");
+        exit(1);
+    }
+}
+
+
+static HASH_Counters* profile_register(){
+    HASH_Counters* counters = calloc(1, sizeof(HASH_Counters));
+    if (counters == NULL){
+        printf("hash.c: out of memory for profiling counters!");
+        exit(1);
+    }
+    pthread_once(&G_profile_once, profile_key_create);
+    pthread_mutex_lock(&G_profile_lock);
+    counters->next = G_profile_list;
+    G_profile_list = counters;
+    pthread_mutex_unlock(&G_profile_lock);
+    pthread_setspecific(G_profile_key, counters);
+    return counters;
+}
+
+
+static inline void profile_count(uint64_t calls, uint64_t bytes){
+    if (G_profile == NULL) G_profile = profile_register();
+    _Atomic uint64_t* c = &(G_profile->calls[G_profile_phase]);
+    _Atomic uint64_t* b = &(G_profile->bytes[G_profile_phase]);
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + calls, memory_order_relaxed);
+    atomic_store_explicit(b, atomic_load_explicit(b, memory_order_relaxed) + bytes, memory_order_relaxed);
+}
+#endif
 
-/* global hash config */
-HASH_Config G_cfg = {HASH_SHA2, 32};
 
 const HASH_Config HASH_SHA2_256    = {HASH_SHA2, 32};    
 const HASH_Config HASH_SHAKE_128   = {HASH_SHAKE128, 32};
@@ -32,50 +111,732 @@ const HASH_Config HASH_BLAKE2B_160 = {HASH_BLAKE2B, 20};
 const HASH_Config HASH_BLAKE2B_192 = {HASH_BLAKE2B, 24}; 
 const HASH_Config HASH_BLAKE2B_224 = {HASH_BLAKE2B, 28}; 
 const HASH_Config HASH_BLAKE2B_256 = {HASH_BLAKE2B, 32}; 
+const HASH_Config HASH_BLAKE2B_TW_160 = {HASH_BLAKE2B_TW, 20};
+const HASH_Config HASH_BLAKE2B_TW_256 = {HASH_BLAKE2B_TW, 32};
+
 
+// ============================================================================
+// backends, one per algorithm. Selected once by HASH_ctx_init().
+// ============================================================================
 
-static void SHA256_full(byte_t *output, const byte_t *input, const size_t input_length, const key_s *key){
+/* SHA-256 and BLAKE2b use the compression function resolved in the context */
+static void sha256_init(SHA256_CTX* state, const HASH_Ctx* ctx){
+#if !CFG_SHA256_USE_OPENSSL
+    SHA256_Init_compress(state, (SHA256_Compress_fn)ctx->compress);
+#else
+    SHA256_Init(state);
+#endif
+}
+
+
+static void keyhash_sha256(const HASH_Ctx* ctx, byte_t *output, const byte_t *input, const size_t input_length, const key_s *key){
+#if !CFG_SHA256_USE_OPENSSL
+        // fast paths for the fixed lengths of chain steps (key + n) and tree nodes (2n)
+        const SHA256_Compress_fn compress = (SHA256_Compress_fn)ctx->compress;
+        if (key != 0 && CFG_HASH_KEY_SIZE == 16 && input_length == 32){ SHA256_Key16_32(compress, output, key->bytes, input); return; }
+        if (key == 0 && input_length == 64){ SHA256_64(compress, output, input); return; }
+        if (key != 0 && CFG_HASH_KEY_SIZE + input_length <= SHA256_SHORT_MAX){ SHA256_Short(compress, output, key->bytes, CFG_HASH_KEY_SIZE, input, input_length); return; }
+        if (key == 0 && input_length <= SHA256_SHORT_MAX){ SHA256_Short(compress, output, 0, 0, input, input_length); return; }
+#endif
         SHA256_CTX ctx_sha256;
-        SHA256_Init(&(ctx_sha256));
+        sha256_init(&(ctx_sha256), ctx);
         if (key != 0) SHA256_Update(&(ctx_sha256), key->bytes, CFG_HASH_KEY_SIZE);
         SHA256_Update(&(ctx_sha256), input, input_length);
         SHA256_Final(output, &(ctx_sha256));    
 }
 
 
-hash_t* HASH_init(const HASH_Config config){
-    return malloc(config.size);
+
+#if CFG_HASH_KEY_SIZE > 30  // 16 byte personalization + 14 spare salt bytes
+#error "HASH_BLAKE2B_TW supports keys of at most 30 bytes"
+#endif
+
+/*
+ * Maps a key to the BLAKE2b parameter block for HASH_BLAKE2B_TW.
+ * The tweak (key bytes 0 and 1, chain and step index in WOTS) goes to the salt,
+ * the rest of the key to the personalization. Both only modify the IV, so unlike
+ * a BLAKE2b key they cost no extra compression per call.
+ */
+static void BLAKE2B_tweak_params(byte_t salt[BLAKE2B_SALTBYTES], byte_t personal[BLAKE2B_PERSONALBYTES], const key_s* key){
+    memset(salt, 0, BLAKE2B_SALTBYTES);
+    memset(personal, 0, BLAKE2B_PERSONALBYTES);
+    for (int i = 0; i < CFG_HASH_KEY_SIZE; i++){
+        if (i < 2) salt[i] = key->bytes[i];
+        else if (i < BLAKE2B_PERSONALBYTES) personal[i] = key->bytes[i];
+        else salt[i - BLAKE2B_PERSONALBYTES + 2] = key->bytes[i];
+    }
+}
+
+
+static void keyhash_blake2b_tw(const HASH_Ctx* ctx, byte_t *output, const byte_t *input, const size_t input_length, const key_s *key){
+    byte_t salt[BLAKE2B_SALTBYTES];
+    byte_t personal[BLAKE2B_PERSONALBYTES];
+    blake2b_state state;
+
+    if (key != 0) BLAKE2B_tweak_params(salt, personal, key);
+    blake2b_init_compress(&state, (blake2b_compress_fn)ctx->compress, ctx->config.size, 0, 0, key ? salt : 0, key ? personal : 0);
+    blake2b_update(&state, input, input_length);
+    blake2b_final(&state, output, ctx->config.size);
+}
+
+
+static void keyhash_blake2b(const HASH_Ctx* ctx, byte_t *output, const byte_t *input, const size_t input_length, const key_s *key){
+    blake2b_state state;
+
+    blake2b_init_compress(&state, (blake2b_compress_fn)ctx->compress, ctx->config.size, key ? key->bytes : 0, key ? CFG_HASH_KEY_SIZE : 0, 0, 0);
+    blake2b_update(&state, input, input_length);
+    blake2b_final(&state, output, ctx->config.size);
+}
+
+
+static void keyhash_shake128(const HASH_Ctx* ctx, byte_t *output, const byte_t *input, const size_t input_length, const key_s *key){
+    shake128_keyed(output, ctx->config.size, key ? key->bytes : 0, key ? CFG_HASH_KEY_SIZE : 0, input, input_length);
+}
+
+
+static void keyhash_shake256(const HASH_Ctx* ctx, byte_t *output, const byte_t *input, const size_t input_length, const key_s *key){
+    shake256_keyed(output, ctx->config.size, key ? key->bytes : 0, key ? CFG_HASH_KEY_SIZE : 0, input, input_length);
+}
+
+
+static void keyhash_unknown(const HASH_Ctx* ctx, byte_t *output, const byte_t *input, const size_t input_length, const key_s *key){
+    printf("hash.c: algorithm unknown!");
+}
+
+
+
+/*
+ * Stream backends: the same keying as the keyhash backends above, with the
+ * state of the underlying implementation in HASH_Stream.state.
+ */
+_Static_assert(sizeof(SHA256_CTX) <= HASH_STREAM_STATE, "HASH_STREAM_STATE too small for SHA-256");
+_Static_assert(sizeof(blake2b_state) <= HASH_STREAM_STATE, "HASH_STREAM_STATE too small for BLAKE2b");
+_Static_assert(sizeof(shake_state) <= HASH_STREAM_STATE, "HASH_STREAM_STATE too small for SHAKE");
+
+static void stream_init_sha256(HASH_Stream* stream, const key_s* key){
+    SHA256_CTX* state = (SHA256_CTX*)stream->state;
+    sha256_init(state, stream->ctx);
+    if (key != 0) SHA256_Update(state, key->bytes, CFG_HASH_KEY_SIZE);
+}
+
+static void stream_update_sha256(HASH_Stream* stream, const byte_t *input, size_t input_length){
+    SHA256_Update((SHA256_CTX*)stream->state, input, input_length);
+}
+
+static void stream_final_sha256(HASH_Stream* stream, hash_t *output){
+    SHA256_Final(output, (SHA256_CTX*)stream->state);
+}
+
+
+static void stream_init_blake2b(HASH_Stream* stream, const key_s* key){
+    blake2b_init_compress((blake2b_state*)stream->state, (blake2b_compress_fn)stream->ctx->compress, stream->ctx->config.size,
+                          key ? key->bytes : 0, key ? CFG_HASH_KEY_SIZE : 0, 0, 0);
+}
+
+static void stream_init_blake2b_tw(HASH_Stream* stream, const key_s* key){
+    byte_t salt[BLAKE2B_SALTBYTES];
+    byte_t personal[BLAKE2B_PERSONALBYTES];
+
+    if (key != 0) BLAKE2B_tweak_params(salt, personal, key);
+    blake2b_init_compress((blake2b_state*)stream->state, (blake2b_compress_fn)stream->ctx->compress, stream->ctx->config.size,
+                          0, 0, key ? salt : 0, key ? personal : 0);
+}
+
+static void stream_update_blake2b(HASH_Stream* stream, const byte_t *input, size_t input_length){
+    blake2b_update((blake2b_state*)stream->state, input, input_length);
+}
+
+static void stream_final_blake2b(HASH_Stream* stream, hash_t *output){
+    blake2b_final((blake2b_state*)stream->state, output, stream->ctx->config.size);
+}
+
+
+static void stream_init_shake(HASH_Stream* stream, const key_s* key){
+    shake_state* state = (shake_state*)stream->state;
+    shake_init(state, (stream->ctx->config.algo == HASH_SHAKE128) ? SHAKE128_RATE : SHAKE256_RATE);
+    if (key != 0) shake_absorb(state, key->bytes, CFG_HASH_KEY_SIZE);
+}
+
+static void stream_update_shake(HASH_Stream* stream, const byte_t *input, size_t input_length){
+    shake_absorb((shake_state*)stream->state, input, input_length);
+}
+
+static void stream_final_shake(HASH_Stream* stream, hash_t *output){
+    shake_squeeze((shake_state*)stream->state, output, stream->ctx->config.size);
+}
+
+
+static void stream_init_unknown(HASH_Stream* stream, const key_s* key){
+    printf("hash.c: algorithm unknown!");
+}
+
+static void stream_update_unknown(HASH_Stream* stream, const byte_t *input, size_t input_length){}
+
+static void stream_final_unknown(HASH_Stream* stream, hash_t *output){}
+
+
+
+static void keyhash_xN_scalar(const HASH_Ctx* ctx, hash_t *const outputs[], const byte_t *const inputs[], size_t input_length, const key_s *const keys[], unsigned int num){
+    for (unsigned int i = 0; i < num; i++) ctx->keyhash(ctx, outputs[i], inputs[i], input_length, keys ? keys[i] : 0);
+}
+
+
+/*
+ * Batch backends. The multi-buffer kernels take the keys as prefixes, run on
+ * at most ctx->lanes lanes and leave the tail to the scalar backend.
+ */
+#define KEY_PREFIXES(prefixes, keys, num)                                               \
+    const byte_t* prefixes[num];                                                        \
+    if (keys != 0){                                                                     \
+        for (unsigned int i = 0; i < num; i++) prefixes[i] = keys[i]->bytes;           \
+    }
+
+#define SCALAR_TAIL(done)                                                               \
+    keyhash_xN_scalar(ctx, outputs + done, inputs + done, input_length, keys ? keys + done : 0, num - done)
+
+static void keyhash_xN_sha256(const HASH_Ctx* ctx, hash_t *const outputs[], const byte_t *const inputs[], size_t input_length, const key_s *const keys[], unsigned int num){
+    KEY_PREFIXES(prefixes, keys, num);
+    unsigned int done = sha256_mb(outputs, (keys != 0) ? prefixes : 0, (keys != 0) ? CFG_HASH_KEY_SIZE : 0, inputs, input_length, num, ctx->lanes);
+    SCALAR_TAIL(done);
+}
+
+
+static void keyhash_xN_blake2b(const HASH_Ctx* ctx, hash_t *const outputs[], const byte_t *const inputs[], size_t input_length, const key_s *const keys[], unsigned int num){
+    KEY_PREFIXES(prefixes, keys, num);
+    unsigned int done = blake2b_mb(outputs, ctx->config.size, (keys != 0) ? prefixes : 0, (keys != 0) ? CFG_HASH_KEY_SIZE : 0, inputs, input_length, num, ctx->lanes);
+    SCALAR_TAIL(done);
+}
+
+
+static void keyhash_xN_blake2b_tw(const HASH_Ctx* ctx, hash_t *const outputs[], const byte_t *const inputs[], size_t input_length, const key_s *const keys[], unsigned int num){
+    if (keys == 0){ keyhash_xN_blake2b(ctx, outputs, inputs, input_length, keys, num); return; }
+
+    byte_t salts[num][BLAKE2B_SALTBYTES];
+    byte_t personals[num][BLAKE2B_PERSONALBYTES];
+    const byte_t* salt_ptrs[num];
+    const byte_t* personal_ptrs[num];
+    for (unsigned int i = 0; i < num; i++){
+        BLAKE2B_tweak_params(salts[i], personals[i], keys[i]);
+        salt_ptrs[i] = salts[i];
+        personal_ptrs[i] = personals[i];
+    }
+    unsigned int done = blake2b_mb_salted(outputs, ctx->config.size, salt_ptrs, personal_ptrs, inputs, input_length, num, ctx->lanes);
+    SCALAR_TAIL(done);
+}
+
+
+static void keyhash_xN_shake128(const HASH_Ctx* ctx, hash_t *const outputs[], const byte_t *const inputs[], size_t input_length, const key_s *const keys[], unsigned int num){
+    KEY_PREFIXES(prefixes, keys, num);
+    unsigned int done = shake128_mb(outputs, ctx->config.size, (keys != 0) ? prefixes : 0, (keys != 0) ? CFG_HASH_KEY_SIZE : 0, inputs, input_length, num, ctx->lanes);
+    SCALAR_TAIL(done);
+}
+
+
+static void keyhash_xN_shake256(const HASH_Ctx* ctx, hash_t *const outputs[], const byte_t *const inputs[], size_t input_length, const key_s *const keys[], unsigned int num){
+    KEY_PREFIXES(prefixes, keys, num);
+    unsigned int done = shake256_mb(outputs, ctx->config.size, (keys != 0) ? prefixes : 0, (keys != 0) ? CFG_HASH_KEY_SIZE : 0, inputs, input_length, num, ctx->lanes);
+    SCALAR_TAIL(done);
+}
+
+#undef SCALAR_TAIL
+#undef KEY_PREFIXES
+
+
+
+#if CFG_HASH_USE_OPENSSL_EVP
+/*
+ * OpenSSL EVP backends. Each thread reuses one digest context.
+ */
+static const EVP_MD* G_evp_sha256 = NULL;
+static const EVP_MD* G_evp_shake128 = NULL;
+static const EVP_MD* G_evp_shake256 = NULL;
+static _Thread_local EVP_MD_CTX* G_evp_ctx = NULL;
+
+static const EVP_MD* evp_fetch(const char* name){
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    return EVP_MD_fetch(NULL, name, NULL);  // fetch once, EVP_sha256() & co. would fetch on every init
+#else
+    return EVP_get_digestbyname(name);
+#endif
+}
+
+
+static void keyhash_evp(const EVP_MD* md, byte_t *output, size_t output_length, bool xof, const byte_t *input, const size_t input_length, const key_s *key){
+    if (G_evp_ctx == NULL) G_evp_ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(G_evp_ctx, md, NULL);
+    if (key != 0) EVP_DigestUpdate(G_evp_ctx, key->bytes, CFG_HASH_KEY_SIZE);
+    EVP_DigestUpdate(G_evp_ctx, input, input_length);
+    if (xof) EVP_DigestFinalXOF(G_evp_ctx, output, output_length);
+    else EVP_DigestFinal_ex(G_evp_ctx, output, NULL);
+}
+
+
+static void keyhash_sha256_evp(const HASH_Ctx* ctx, byte_t *output, const byte_t *input, const size_t input_length, const key_s *key){
+    keyhash_evp(G_evp_sha256, output, 32, false, input, input_length, key);
+}
+
+
+static void keyhash_shake128_evp(const HASH_Ctx* ctx, byte_t *output, const byte_t *input, const size_t input_length, const key_s *key){
+    keyhash_evp(G_evp_shake128, output, ctx->config.size, true, input, input_length, key);
+}
+
+
+static void keyhash_shake256_evp(const HASH_Ctx* ctx, byte_t *output, const byte_t *input, const size_t input_length, const key_s *key){
+    keyhash_evp(G_evp_shake256, output, ctx->config.size, true, input, input_length, key);
+}
+
+
+/*
+ * EVP streams own a digest context, since keyhash calls may run between the
+ * updates on the same thread. Its pointer is stored in the state.
+ */
+static EVP_MD_CTX* stream_evp(const HASH_Stream* stream){
+    EVP_MD_CTX* evp;
+    memcpy(&evp, stream->state, sizeof(evp));
+    return evp;
+}
+
+static void stream_init_evp(HASH_Stream* stream, const key_s* key){
+    const EVP_MD* md = G_evp_sha256;
+    if (stream->ctx->config.algo == HASH_SHAKE128) md = G_evp_shake128;
+    if (stream->ctx->config.algo == HASH_SHAKE256) md = G_evp_shake256;
+    EVP_MD_CTX* evp = EVP_MD_CTX_new();
+    memcpy(stream->state, &evp, sizeof(evp));
+    EVP_DigestInit_ex(evp, md, NULL);
+    if (key != 0) EVP_DigestUpdate(evp, key->bytes, CFG_HASH_KEY_SIZE);
+}
+
+static void stream_update_evp(HASH_Stream* stream, const byte_t *input, size_t input_length){
+    EVP_DigestUpdate(stream_evp(stream), input, input_length);
+}
+
+static void stream_final_evp(HASH_Stream* stream, hash_t *output){
+    EVP_MD_CTX* evp = stream_evp(stream);
+    if (stream->ctx->config.algo == HASH_SHAKE128 || stream->ctx->config.algo == HASH_SHAKE256) EVP_DigestFinalXOF(evp, output, stream->ctx->config.size);
+    else EVP_DigestFinal_ex(evp, output, NULL);
+    EVP_MD_CTX_free(evp);
+}
+#endif
+
+
+
+// ============================================================================
+// backend registry
+// ============================================================================
+
+/*
+ * The compression functions and multi-buffer kernels are selected process-wide
+ * per family of algorithms. Installing a backend sets these switches; contexts
+ * created afterwards copy them, existing contexts keep theirs.
+ */
+typedef enum {
+    FAMILY_SHA256,   // HASH_SHA2, HASH_SHA3
+    FAMILY_BLAKE2B,  // HASH_BLAKE2B, HASH_BLAKE2B_TW
+    FAMILY_KECCAK,   // HASH_SHAKE128, HASH_SHAKE256
+    FAMILY_NUM
+} HASH_Family_t;
+
+typedef struct {
+    const char* backend;  // name of the installed backend
+    bool pinned;          // selected by the user, not changed by HASH_tune_backends()
+    bool evp;             // use the OpenSSL EVP keyhash
+} HASH_Family_s;
+
+typedef struct {
+    HASH_Family_t family;
+    const char* name;
+    int (*install)(HASH_Family_s* family);  // 0 on success, -1 if not supported by this CPU or build
+} HASH_Backend_s;
+
+
+static const char* G_family_names[FAMILY_NUM] = {"sha256", "blake2b", "keccak"};
+static const HASH_Config* G_family_tune_config[FAMILY_NUM] = {&HASH_SHA2_256, &HASH_BLAKE2B_256, &HASH_SHAKE_128};
+static HASH_Family_s G_families[FAMILY_NUM] = {{"auto"}, {"auto"}, {"auto"}};
+static pthread_once_t G_backends_once = PTHREAD_ONCE_INIT;
+
+static HASH_Ctx ctx_init(const HASH_Config config);
+
+
+static int install_sha256(HASH_Family_s* family, int backend, unsigned int max_lanes){
+#if !CFG_SHA256_USE_OPENSSL
+    if (SHA256_set_backend(backend) != 0) return -1;
+#endif
+    sha256_mb_limit(max_lanes);
+    family->evp = false;
+    return 0;
+}
+
+#if !CFG_SHA256_USE_OPENSSL
+static int backend_sha256_auto(HASH_Family_s* family){ return install_sha256(family, SHA256_BACKEND_AUTO, 0); }
+static int backend_sha256_ref(HASH_Family_s* family){ return install_sha256(family, SHA256_BACKEND_REF, 1); }
+static int backend_sha256_shani(HASH_Family_s* family){ return install_sha256(family, SHA256_BACKEND_SHANI, 1); }
+static int backend_sha256_mb(HASH_Family_s* family){
+    if (install_sha256(family, SHA256_BACKEND_AUTO, 0) != 0 || sha256_mb_lanes() == 1) return -1;
+    return 0;
+}
+#else
+static int backend_sha256_auto(HASH_Family_s* family){ return install_sha256(family, 0, 0); }
+static int backend_sha256_mb(HASH_Family_s* family){
+    if (install_sha256(family, 0, 0) != 0 || sha256_mb_lanes() == 1) return -1;
+    return 0;
+}
+#endif
+
+
+static int install_blake2b(HASH_Family_s* family, blake2b_backend_t backend, unsigned int max_lanes){
+    if (blake2b_set_backend(backend) != 0) return -1;
+    blake2b_mb_limit(max_lanes);
+    family->evp = false;
+    return 0;
+}
+
+static int backend_blake2b_auto(HASH_Family_s* family){ return install_blake2b(family, BLAKE2B_BACKEND_AUTO, 0); }
+static int backend_blake2b_ref(HASH_Family_s* family){ return install_blake2b(family, BLAKE2B_BACKEND_REF, 1); }
+static int backend_blake2b_avx2(HASH_Family_s* family){ return install_blake2b(family, BLAKE2B_BACKEND_AVX2, 1); }
+static int backend_blake2b_mb(HASH_Family_s* family){
+    if (install_blake2b(family, BLAKE2B_BACKEND_AUTO, 0) != 0 || blake2b_mb_lanes() == 1) return -1;
+    return 0;
+}
+
+
+static int backend_keccak_auto(HASH_Family_s* family){ keccak_mb_limit(0); family->evp = false; return 0; }
+static int backend_keccak_ref(HASH_Family_s* family){ keccak_mb_limit(1); family->evp = false; return 0; }
+static int backend_keccak_mb(HASH_Family_s* family){
+    keccak_mb_limit(0);
+    family->evp = false;
+    return (keccak_mb_lanes() == 1) ? -1 : 0;
+}
+
+
+#if CFG_HASH_USE_OPENSSL_EVP
+static int backend_sha256_openssl(HASH_Family_s* family){
+    if (G_evp_sha256 == NULL) G_evp_sha256 = evp_fetch("SHA256");
+    if (G_evp_sha256 == NULL) return -1;
+    sha256_mb_limit(1);
+    family->evp = true;
+    return 0;
+}
+
+static int backend_keccak_openssl(HASH_Family_s* family){
+    if (G_evp_shake128 == NULL) G_evp_shake128 = evp_fetch("SHAKE128");
+    if (G_evp_shake256 == NULL) G_evp_shake256 = evp_fetch("SHAKE256");
+    if (G_evp_shake128 == NULL || G_evp_shake256 == NULL) return -1;
+    keccak_mb_limit(1);
+    family->evp = true;
+    return 0;
+}
+#endif
+
+
+static const HASH_Backend_s G_backends[] = {
+    {FAMILY_SHA256, "auto", backend_sha256_auto},
+#if !CFG_SHA256_USE_OPENSSL
+    {FAMILY_SHA256, "ref", backend_sha256_ref},
+    {FAMILY_SHA256, "shani", backend_sha256_shani},
+#endif
+    {FAMILY_SHA256, "mb", backend_sha256_mb},
+#if CFG_HASH_USE_OPENSSL_EVP
+    {FAMILY_SHA256, "openssl", backend_sha256_openssl},
+#endif
+    {FAMILY_BLAKE2B, "auto", backend_blake2b_auto},
+    {FAMILY_BLAKE2B, "ref", backend_blake2b_ref},
+    {FAMILY_BLAKE2B, "avx2", backend_blake2b_avx2},
+    {FAMILY_BLAKE2B, "mb", backend_blake2b_mb},
+    {FAMILY_KECCAK, "auto", backend_keccak_auto},
+    {FAMILY_KECCAK, "ref", backend_keccak_ref},
+    {FAMILY_KECCAK, "mb", backend_keccak_mb},
+#if CFG_HASH_USE_OPENSSL_EVP
+    {FAMILY_KECCAK, "openssl", backend_keccak_openssl},
+#endif
+};
+#define NUM_BACKENDS (sizeof(G_backends)/sizeof(G_backends[0]))
+
+
+static int family_from_name(const char* name){
+    for (int f = 0; f < FAMILY_NUM; f++){
+        if (strcmp(name, G_family_names[f]) == 0) return f;
+    }
+    return -1;
+}
+
+
+static const HASH_Backend_s* find_backend(HASH_Family_t family, const char* name){
+    for (int i = 0; i < NUM_BACKENDS; i++){
+        if (G_backends[i].family == family && strcmp(name, G_backends[i].name) == 0) return &G_backends[i];
+    }
+    return NULL;
+}
+
+
+static int install_backend(const HASH_Backend_s* backend){
+    HASH_Family_s* family = &G_families[backend->family];
+    if (backend->install(family) != 0){
+        find_backend(backend->family, family->backend)->install(family);  // restore previous switches
+        return -1;
+    }
+    family->backend = backend->name;
+    return 0;
+}
+
+
+static uint64_t time_ns(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec;
+}
+
+
+#define TUNE_BATCH 16   // inputs per HASH_keyhash_xN() call, a multiple of all kernel widths
+#define TUNE_BYTES 8192 // bytes hashed per measurement
+#define TUNE_TRIALS 3   // the fastest of these is taken
+
+/*
+ * Times the installed backend of the config's family on the inputs of AMSA:
+ * keyed chain steps (n bytes), unkeyed tree nodes (2n bytes) and keyed WOTS
+ * public keys (pk_bytes), hashed one by one and in batches.
+ * \return sum of the nanoseconds per hash of all measurements
+ */
+static double tune_score(const HASH_Config config, size_t pk_bytes){
+    const HASH_Ctx ctx = ctx_init(config);
+    const size_t lengths[3] = {config.size, 2*config.size, pk_bytes};
+    const bool keyed[3] = {true, false, true};
+    byte_t* buffer = calloc(TUNE_BATCH, pk_bytes + 2*config.size);
+    hash_t* outputs[TUNE_BATCH];
+    const byte_t* inputs[TUNE_BATCH];
+    key_s key = {{0}};
+    const key_s* keys[TUNE_BATCH];
+    double score = 0;
+
+    for (int i = 0; i < TUNE_BATCH; i++){
+        outputs[i] = buffer + i*(pk_bytes + 2*config.size);
+        inputs[i] = outputs[i];
+        keys[i] = &key;
+    }
+
+    for (int l = 0; l < 3; l++){
+        const unsigned int rounds = 1 + TUNE_BYTES / (TUNE_BATCH*lengths[l]);
+        uint64_t best_scalar = UINT64_MAX;
+        uint64_t best_batch = UINT64_MAX;
+        for (int trial = 0; trial < TUNE_TRIALS; trial++){
+            uint64_t start = time_ns();
+            for (unsigned int r = 0; r < rounds*TUNE_BATCH; r++){
+                ctx.keyhash(&ctx, outputs[r % TUNE_BATCH], inputs[r % TUNE_BATCH], lengths[l], keyed[l] ? &key : 0);
+            }
+            uint64_t mid = time_ns();
+            for (unsigned int r = 0; r < rounds; r++){
+                HASH_keyhash_xN(&ctx, outputs, inputs, lengths[l], keyed[l] ? keys : 0, TUNE_BATCH);
+            }
+            uint64_t stop = time_ns();
+            if (mid - start < best_scalar) best_scalar = mid - start;
+            if (stop - mid < best_batch) best_batch = stop - mid;
+        }
+        score += (double)(best_scalar + best_batch) / (rounds*TUNE_BATCH);
+    }
+    free(buffer);
+    return score;
+}
+
+
+static int set_backend(const char* family, const char* name){
+    int f = family_from_name(family);
+    if (f < 0) return -1;
+    const HASH_Backend_s* backend = find_backend(f, name);
+    if (backend == NULL || install_backend(backend) != 0) return -1;
+    G_families[f].pinned = (strcmp(name, "auto") != 0);
+    return 0;
+}
+
+
+static void tune_backends(size_t pk_bytes){
+    for (int f = 0; f < FAMILY_NUM; f++){
+        if (G_families[f].pinned) continue;
+        const HASH_Backend_s* best = NULL;
+        double best_score = 0;
+        for (int i = 0; i < NUM_BACKENDS; i++){
+            if (G_backends[i].family != f || strcmp(G_backends[i].name, "auto") == 0) continue;
+            if (install_backend(&G_backends[i]) != 0) continue;
+            double score = tune_score(*G_family_tune_config[f], pk_bytes);
+            if (best == NULL || score < best_score){ best = &G_backends[i]; best_score = score; }
+        }
+        if (best != NULL) install_backend(best);
+    }
+}
+
+
+/*
+ * Applies AMSA_HASH_BACKEND, e.g. "sha256=shani,keccak=ref" or "tune".
+ * Runs once via load_backends(), so it must not call the public functions.
+ */
+static void load_env_backends(){
+    const char* env = getenv("AMSA_HASH_BACKEND");
+    if (env == NULL) return;
+
+    char items[256];
+    strncpy(items, env, sizeof(items) - 1);
+    items[sizeof(items) - 1] = 0;
+    bool tune = false;
+    for (char* item = strtok(items, ", "); item != NULL; item = strtok(NULL, ", ")){
+        char* name = strchr(item, '=');
+        if (strcmp(item, "tune") == 0){ tune = true; continue; }
+        if (name != NULL) *(name++) = 0;
+        if (name == NULL || set_backend(item, name) != 0){
+            printf("hash.c: AMSA_HASH_BACKEND: cannot select %s!\n", item);
+        }
+    }
+    if (tune) tune_backends(HASH_TUNE_PK_BYTES);
+}
+
+
+static void load_backends(){
+    pthread_once(&G_backends_once, load_env_backends);
+}
+
+
+
+// ============================================================================
+// public functions
+// ============================================================================
+
+/*
+ * Resolves the backend switches of the config's family into the context, so
+ * that later HASH_set_backend() or HASH_tune_backends() do not change it.
+ */
+static HASH_Ctx ctx_init(const HASH_Config config){
+    HASH_Ctx ctx;
+    ctx.config = config;
+    ctx.keyhash_xN = keyhash_xN_scalar;
+    ctx.lanes = 1;
+    ctx.compress = NULL;
+    ctx.stream_init = stream_init_unknown;
+    ctx.stream_update = stream_update_unknown;
+    ctx.stream_final = stream_final_unknown;
+
+    switch (config.algo) {
+        case HASH_SHA2:
+        case HASH_SHA3:
+            ctx.keyhash = keyhash_sha256;
+            ctx.keyhash_xN = keyhash_xN_sha256;
+            ctx.lanes = sha256_mb_lanes();
+            ctx.stream_init = stream_init_sha256;
+            ctx.stream_update = stream_update_sha256;
+            ctx.stream_final = stream_final_sha256;
+#if !CFG_SHA256_USE_OPENSSL
+            ctx.compress = (void (*)(void))SHA256_get_compress();
+#endif
+#if CFG_HASH_USE_OPENSSL_EVP
+            if (G_families[FAMILY_SHA256].evp){
+                ctx.keyhash = keyhash_sha256_evp;
+                ctx.stream_init = stream_init_evp;
+                ctx.stream_update = stream_update_evp;
+                ctx.stream_final = stream_final_evp;
+            }
+#endif
+            break;
+        case HASH_SHAKE128:
+            ctx.keyhash = keyhash_shake128;
+            ctx.keyhash_xN = keyhash_xN_shake128;
+            ctx.lanes = keccak_mb_lanes();
+            ctx.stream_init = stream_init_shake;
+            ctx.stream_update = stream_update_shake;
+            ctx.stream_final = stream_final_shake;
+#if CFG_HASH_USE_OPENSSL_EVP
+            if (G_families[FAMILY_KECCAK].evp){
+                ctx.keyhash = keyhash_shake128_evp;
+                ctx.stream_init = stream_init_evp;
+                ctx.stream_update = stream_update_evp;
+                ctx.stream_final = stream_final_evp;
+            }
+#endif
+            break;
+        case HASH_SHAKE256:
+            ctx.keyhash = keyhash_shake256;
+            ctx.keyhash_xN = keyhash_xN_shake256;
+            ctx.lanes = keccak_mb_lanes();
+            ctx.stream_init = stream_init_shake;
+            ctx.stream_update = stream_update_shake;
+            ctx.stream_final = stream_final_shake;
+#if CFG_HASH_USE_OPENSSL_EVP
+            if (G_families[FAMILY_KECCAK].evp){
+                ctx.keyhash = keyhash_shake256_evp;
+                ctx.stream_init = stream_init_evp;
+                ctx.stream_update = stream_update_evp;
+                ctx.stream_final = stream_final_evp;
+            }
+#endif
+            break;
+        case HASH_BLAKE2B:
+            ctx.keyhash = keyhash_blake2b;
+            ctx.keyhash_xN = keyhash_xN_blake2b;
+            ctx.lanes = blake2b_mb_lanes();
+            ctx.compress = (void (*)(void))blake2b_get_compress();
+            ctx.stream_init = stream_init_blake2b;
+            ctx.stream_update = stream_update_blake2b;
+            ctx.stream_final = stream_final_blake2b;
+            break;
+        case HASH_BLAKE2B_TW:
+            ctx.keyhash = keyhash_blake2b_tw;
+            ctx.keyhash_xN = keyhash_xN_blake2b_tw;
+            ctx.lanes = blake2b_mb_lanes();
+            ctx.compress = (void (*)(void))blake2b_get_compress();
+            ctx.stream_init = stream_init_blake2b_tw;
+            ctx.stream_update = stream_update_blake2b;
+            ctx.stream_final = stream_final_blake2b;
+            break;
+        default:
+            ctx.keyhash = keyhash_unknown;
+    }
+    return ctx;
 }
 
 
-void HASH_config(const HASH_Config config){
-    G_cfg = config;
+HASH_Ctx HASH_ctx_init(const HASH_Config config){
+    load_backends();
+    return ctx_init(config);
 }
 
-HASH_Config HASH_getconfig(){
-    return G_cfg;
+
+int HASH_set_backend(const char* family, const char* name){
+    load_backends();
+    return set_backend(family, name);
+}
+
+
+const char* HASH_get_backend(const char* family){
+    load_backends();
+    int f = family_from_name(family);
+    return (f < 0) ? NULL : G_families[f].backend;
+}
+
+
+const char* HASH_backend_name(const char* family, unsigned int idx){
+    int f = family_from_name(family);
+    for (int i = 0; i < NUM_BACKENDS; i++){
+        if (G_backends[i].family == f && idx-- == 0) return G_backends[i].name;
+    }
+    return NULL;
 }
 
 
-void HASH_keyhash(byte_t *output, const byte_t *input, size_t input_length, const key_s* key){
+void HASH_tune_backends(size_t pk_bytes){
+    load_backends();
+    tune_backends(pk_bytes);
+}
+
+
+hash_t* HASH_init(const HASH_Config config){
+    return malloc(config.size);
+}
+
+
+void HASH_keyhash(const HASH_Ctx* ctx, byte_t *output, const byte_t *input, size_t input_length, const key_s* key){
 #if HASH_VERBOSE
     printf("hash: "); int i; for (i=0; i< input_length; i++) printf( " %02x", ((unsigned char*)input)[i] );
 #endif
 #if CFG_HASH_PROFILING
-    G_profile_calls++;
-    G_profile_processed_bytes += (unsigned int)input_length;
+    profile_count(1, input_length);
 #endif
 
-    int key_len = CFG_HASH_KEY_SIZE;
-    if (key == 0){ key_len = 0;}
-    switch (G_cfg.algo) {
-        case HASH_SHA2: SHA256_full(output, input, input_length, key); break;  
-        case HASH_SHA3: SHA256_full(output, input, input_length, key); break;  
-        case HASH_SHAKE128: shake128(output, 16, input, input_length); break;  
-        case HASH_SHAKE256: shake256(output, 32, input, input_length); break;  
-        case HASH_BLAKE2B: blake2b(output, G_cfg.size, input, input_length, (char*)key, key_len); break;
-        default: printf("hash.c: algorithm unknown!");
-    }
+    ctx->keyhash(ctx, output, input, input_length, key);
 
 #if HASH_VERBOSE
         printf( " ->" );
@@ -84,32 +845,124 @@ void HASH_keyhash(byte_t *output, const byte_t *input, size_t input_length, cons
 }
 
 
+void HASH_keyhash_xN(const HASH_Ctx* ctx, hash_t *const outputs[], const byte_t *const inputs[], size_t input_length, const key_s *const keys[], unsigned int num){
+#if CFG_HASH_PROFILING
+    profile_count(num, (uint64_t)num * input_length);
+#endif
+    if (ctx->lanes == 1){  // no multi-lane backend: scalar fallback
+        keyhash_xN_scalar(ctx, outputs, inputs, input_length, keys, num);
+    } else {
+        ctx->keyhash_xN(ctx, outputs, inputs, input_length, keys, num);
+    }
+}
+
+
+void HASH_keyhash_init(const HASH_Ctx* ctx, HASH_Stream* stream, const key_s* key){
+    stream->ctx = ctx;
+    ctx->stream_init(stream, key);
+}
+
+
+void HASH_keyhash_update(HASH_Stream* stream, const byte_t *input, size_t input_length){
+#if CFG_HASH_PROFILING
+    profile_count(0, input_length);
+#endif
+    stream->ctx->stream_update(stream, input, input_length);
+}
+
+
+void HASH_keyhash_final(HASH_Stream* stream, hash_t *output){
+#if CFG_HASH_PROFILING
+    profile_count(1, 0);
+#endif
+    stream->ctx->stream_final(stream, output);
+}
+
+
+unsigned int HASH_lanes(const HASH_Ctx* ctx){
+    return ctx->lanes;
+}
+
+
 // simplified interface
-void HASH_hash(byte_t *output, const byte_t *input, size_t input_length) {
-    HASH_keyhash(output, input, input_length, 0);
+void HASH_hash(const HASH_Ctx* ctx, byte_t *output, const byte_t *input, size_t input_length) {
+    HASH_keyhash(ctx, output, input, input_length, 0);
 }
 
 
 
 
 /*
- * Print functions for debugging. Prints the hash in 2 hexadecimal values per output byte to stdout
+ * Print functions for debugging. Writes the hash in 2 hexadecimal values per output byte to str.
  */
-const char* HASH_hexstr(const byte_t *hash){
-    static char str[64*8 + 4] = {0};   // buffers 3 hashes of max 64 byte
-    static unsigned int call_idx = 0;
-    ++call_idx; if(call_idx == 4) call_idx = 0;
-
-    for (int i=0; i<G_cfg.size; i++){ sprintf( str+(call_idx*(G_cfg.size+1))+(i*2), "%02x", ((unsigned char *)hash)[i] ); }
-    return str+(call_idx* (G_cfg.size+1) );
+const char* HASH_tohex(char* str, const byte_t *hash, size_t size){
+    if (size > HASH_HEXSTR_MAX/2) size = HASH_HEXSTR_MAX/2;
+    for (size_t i = 0; i < size; i++){ sprintf( str + 2*i, "%02x", hash[i] ); }
+    str[2*size] = 0;
+    return str;
 }
 
 
 
 #if CFG_HASH_PROFILING
-void HASH_print_stats() { printf("HASH_PROFILE: Calls: %d,  Processed: %d B\n", G_profile_calls, G_profile_processed_bytes); }
-void HASH_reset_stats() { G_profile_calls = 0; G_profile_processed_bytes = 0;}
+static const char* G_phase_names[HASH_PHASE_NUM] = {"other", "seed", "chain", "wots_pk", "tree", "key", "encode"};
+
+HASH_Phase_t HASH_set_phase(HASH_Phase_t phase){
+    HASH_Phase_t previous = G_profile_phase;
+    G_profile_phase = phase;
+    return previous;
+}
+
+
+void HASH_get_stats(HASH_Stats* stats){
+    pthread_mutex_lock(&G_profile_lock);
+    for (int p = 0; p < HASH_PHASE_NUM; p++){
+        stats->calls[p] = G_retired_calls[p];
+        stats->bytes[p] = G_retired_bytes[p];
+    }
+    for (HASH_Counters* counters = G_profile_list; counters != NULL; counters = counters->next){
+        for (int p = 0; p < HASH_PHASE_NUM; p++){
+            stats->calls[p] += atomic_load_explicit(&(counters->calls[p]), memory_order_relaxed);
+            stats->bytes[p] += atomic_load_explicit(&(counters->bytes[p]), memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&G_profile_lock);
+}
+
+
+void HASH_print_stats() {
+    HASH_Stats stats;
+    uint64_t calls = 0;
+    uint64_t bytes = 0;
+    HASH_get_stats(&stats);
+    for (int p = 0; p < HASH_PHASE_NUM; p++){ calls += stats.calls[p]; bytes += stats.bytes[p]; }
+
+    printf("HASH_PROFILE: Calls: %" PRIu64 ",  Processed: %" PRIu64 " B", calls, bytes);
+    const char* sep = "  (";
+    for (int p = 0; p < HASH_PHASE_NUM; p++){
+        if (stats.calls[p] == 0) continue;
+        printf("%s%s: %" PRIu64, sep, G_phase_names[p], stats.calls[p]);
+        sep = ", ";
+    }
+    printf("%s\n", (calls > 0) ? ")" : "");
+}
+
+
+void HASH_reset_stats() {
+    pthread_mutex_lock(&G_profile_lock);
+    memset(G_retired_calls, 0, sizeof(G_retired_calls));
+    memset(G_retired_bytes, 0, sizeof(G_retired_bytes));
+    for (HASH_Counters* counters = G_profile_list; counters != NULL; counters = counters->next){
+        for (int p = 0; p < HASH_PHASE_NUM; p++){
+            atomic_store_explicit(&(counters->calls[p]), 0, memory_order_relaxed);
+            atomic_store_explicit(&(counters->bytes[p]), 0, memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&G_profile_lock);
+}
 #else
+HASH_Phase_t HASH_set_phase(HASH_Phase_t phase) { return HASH_PHASE_OTHER; }
+void HASH_get_stats(HASH_Stats* stats) { memset(stats, 0, sizeof(HASH_Stats)); }
 void HASH_print_stats() { }  // let compiler remove this
 void HASH_reset_stats() { }  // let compiler remove this
 #endif
@@ -29,6 +29,10 @@
 #define CFG_HASH_KEY_SIZE 16
 #endif
 
+#ifndef CFG_HASH_USE_OPENSSL_EVP
+#define CFG_HASH_USE_OPENSSL_EVP 0  // 1: register OpenSSL EVP backends, link with -lcrypto
+#endif
+
 #ifndef CFG_HASH_PROFILING
 #define CFG_HASH_PROFILING 1  // 1: profiling (performance statistics)  0: no profiling
 #endif
@@ -47,6 +51,7 @@ typedef enum {
     HASH_SHAKE128,
     HASH_SHAKE256,
     HASH_BLAKE2B,
+    HASH_BLAKE2B_TW,  // BLAKE2b keyed via salt (tweak bytes 0, 1) and personalization (rest of the key), no key block
 } HASH_Algo_t;
 
 
@@ -69,6 +74,70 @@ typedef struct {
 } key_s;
 
 
+/*
+ * Phases of the signature scheme. Every hash call is counted for the phase
+ * that is set for the calling thread (see HASH_set_phase).
+ */
+typedef enum {
+    HASH_PHASE_OTHER,    // untagged calls, e.g. message digests
+    HASH_PHASE_SEED,     // WOTS seed expansion
+    HASH_PHASE_CHAIN,    // WOTS chain steps
+    HASH_PHASE_WOTS_PK,  // WOTS public key compression
+    HASH_PHASE_TREE,     // Merkle tree nodes
+    HASH_PHASE_KEY,      // forward-secure next key and grow key derivation
+    HASH_PHASE_ENCODE,   // randomized WOTS message digests, e.g. counter search
+    HASH_PHASE_NUM
+} HASH_Phase_t;
+
+
+/*
+ * Hash statistics, merged over all threads.
+ */
+typedef struct {
+    uint64_t calls[HASH_PHASE_NUM];
+    uint64_t bytes[HASH_PHASE_NUM];
+} HASH_Stats;
+
+
+#define HASH_STREAM_STATE 256  // bytes, fits the state of every backend
+
+/*
+ * Incremental keyed hash (HASH_keyhash_init/update/final). Absorbs the input
+ * in pieces without buffering it and gives the same hash as HASH_keyhash() of
+ * the concatenated input.
+ */
+typedef struct HASH_Stream {
+    const struct HASH_Ctx* ctx;
+    uint64_t state[HASH_STREAM_STATE/8];   // backend state, aligned for 64 bit words
+} HASH_Stream;
+
+
+struct HASH_Ctx;
+typedef void (*HASH_keyhash_fn)(const struct HASH_Ctx* ctx, hash_t *output, const byte_t *input, size_t input_length, const key_s* key);
+typedef void (*HASH_keyhash_xN_fn)(const struct HASH_Ctx* ctx, hash_t *const outputs[], const byte_t *const inputs[], size_t input_length, const key_s *const keys[], unsigned int num);
+typedef void (*HASH_stream_init_fn)(HASH_Stream* stream, const key_s* key);
+typedef void (*HASH_stream_update_fn)(HASH_Stream* stream, const byte_t *input, size_t input_length);
+typedef void (*HASH_stream_final_fn)(HASH_Stream* stream, hash_t *output);
+
+
+/*
+ * Hash context: a config and the backend functions resolved for it.
+ * Every object that hashes carries its own context, so objects with different
+ * configs can be used side by side and from different threads.
+ * Read-only after HASH_ctx_init(): later backend changes do not affect it.
+ */
+typedef struct HASH_Ctx {
+    HASH_Config config;
+    HASH_keyhash_fn keyhash;
+    HASH_keyhash_xN_fn keyhash_xN;
+    unsigned int lanes;           // width of the multi-buffer kernels, 1 for none
+    void (*compress)(void);       // scalar compression function of SHA-256 or BLAKE2b, cast to its type
+    HASH_stream_init_fn stream_init;
+    HASH_stream_update_fn stream_update;
+    HASH_stream_final_fn stream_final;
+} HASH_Ctx;
+
+
 
 // ============================================================================
 // public constants
@@ -82,6 +151,8 @@ extern const HASH_Config HASH_BLAKE2B_160;
 extern const HASH_Config HASH_BLAKE2B_192; 
 extern const HASH_Config HASH_BLAKE2B_224; 
 extern const HASH_Config HASH_BLAKE2B_256; 
+extern const HASH_Config HASH_BLAKE2B_TW_160;
+extern const HASH_Config HASH_BLAKE2B_TW_256;
 
 
 
@@ -89,10 +160,57 @@ extern const HASH_Config HASH_BLAKE2B_256;
 // public functions
 // ============================================================================
 
-/* Sets the global hash algorithm and its parameters.
+/**
+ * Creates a hash context and selects the backend for the config.
  * \param[in] config struct that specifies algorithm and size of the hash
+ * \return hash context
+ */
+HASH_Ctx HASH_ctx_init(const HASH_Config config);
+
+/*
+ * Backend registry. The hash algorithms are grouped into families that share
+ * their implementation: "sha256", "blake2b" (and BLAKE2B_TW), "keccak" (SHAKE).
+ * Backends per family:
+ *   auto     default: fastest compression via CPUID, multi-buffer batches
+ *   ref      portable C, no batching
+ *   shani    SHA-256 with the x86 SHA extensions, no batching
+ *   avx2     BLAKE2b with the AVX2 compression, no batching
+ *   mb       fastest compression and multi-buffer SIMD batches
+ *   openssl  OpenSSL EVP, only if CFG_HASH_USE_OPENSSL_EVP is 1
+ * The environment variable AMSA_HASH_BACKEND pins backends when the first
+ * context is created, e.g. AMSA_HASH_BACKEND="sha256=shani,keccak=ref".
+ * The item "tune" runs HASH_tune_backends() for all families that are not pinned.
+ * Backends are process-wide and apply to contexts created afterwards; existing
+ * contexts keep theirs. Select them before threads create contexts.
  */
-void HASH_config(const HASH_Config config);
+#define HASH_TUNE_PK_BYTES (66*32)  // WOTS public key of SHA256_W16
+
+/**
+ * Installs and pins a backend.
+ * \param[in] family name of the family, e.g. "sha256"
+ * \param[in] name name of the backend, e.g. "shani". "auto" restores the default and unpins.
+ * \return 0 on success, -1 if unknown or not supported by this CPU or build
+ */
+int HASH_set_backend(const char* family, const char* name);
+
+/**
+ * Returns the name of the installed backend of a family or NULL for an unknown family.
+ */
+const char* HASH_get_backend(const char* family);
+
+/**
+ * Returns the name of the idx-th registered backend of a family or NULL after the last one.
+ * Registered backends may still be unsupported by this CPU.
+ */
+const char* HASH_backend_name(const char* family, unsigned int idx);
+
+/**
+ * Times all supported backends of each family that is not pinned on the
+ * input sizes of AMSA and installs the fastest. Takes some milliseconds.
+ * \param[in] pk_bytes size of a WOTS public key (num_chains*n), e.g. HASH_TUNE_PK_BYTES
+ */
+void HASH_tune_backends(size_t pk_bytes);
+
 
 /**
  * Allocates and initializes a byte array suitable to store a hash value. 
@@ -103,26 +221,91 @@ hash_t* HASH_init(const HASH_Config config);
 
 /**
  * Calculates the hash value of an arbitrary input without a key.
+ * \param[in] ctx hash context
  * \param[out] output pointer to the memory where the hash will be stored
  * \param[in] input pointer to the input
  * \param[in] input_length size of the input in bytes
  */
-void HASH_hash(hash_t *output, const byte_t *input, size_t input_length);
+void HASH_hash(const HASH_Ctx* ctx, hash_t *output, const byte_t *input, size_t input_length);
 
 /**
  * Calculates the hash value of an arbitrary input WITH a key.
+ * \param[in] ctx hash context
  * \param[out] output pointer to the memory where the hash will be stored
  * \param[in] input pointer to the input
  * \param[in] input_length size of the input in bytes
  * \param[in] key key that will modify the output of the hash function
  */
-void HASH_keyhash(hash_t *output, const byte_t *input, size_t input_length, const key_s* key);
+void HASH_keyhash(const HASH_Ctx* ctx, hash_t *output, const byte_t *input, size_t input_length, const key_s* key);
+
+
+/**
+ * Calculates the keyed hash values of num inputs of equal length at once.
+ * Independent inputs are hashed in parallel SIMD lanes if the CPU supports it.
+ * The result is identical to num calls of HASH_keyhash().
+ * \param[in] ctx hash context
+ * \param[out] outputs array of num pointers where the hashes will be stored. May alias inputs.
+ * \param[in] inputs array of num pointers to the inputs
+ * \param[in] input_length size of each input in bytes
+ * \param[in] keys array of num pointers to the keys or 0 to hash without keys
+ * \param[in] num number of inputs
+ */
+void HASH_keyhash_xN(const HASH_Ctx* ctx, hash_t *const outputs[], const byte_t *const inputs[], size_t input_length, const key_s *const keys[], unsigned int num);
+
+
+/**
+ * Starts an incremental keyed hash. The context must outlive the stream.
+ * \param[in] ctx hash context
+ * \param[out] stream state of the incremental hash
+ * \param[in] key key that will modify the output of the hash function or 0
+ */
+void HASH_keyhash_init(const HASH_Ctx* ctx, HASH_Stream* stream, const key_s* key);
+
+/**
+ * Absorbs the next piece of the input.
+ * \param[in,out] stream state of the incremental hash
+ * \param[in] input pointer to the input
+ * \param[in] input_length size of the input in bytes
+ */
+void HASH_keyhash_update(HASH_Stream* stream, const byte_t *input, size_t input_length);
+
+/**
+ * Finishes an incremental keyed hash. Counts as one call of the current phase.
+ * \param[in,out] stream state of the incremental hash, must be initialized again for reuse
+ * \param[out] output pointer to the memory where the hash will be stored
+ */
+void HASH_keyhash_final(HASH_Stream* stream, hash_t *output);
+
+
+/**
+ * Returns the number of inputs that HASH_keyhash_xN() processes in parallel.
+ * Batches should be a multiple of this to use all lanes. 1 if there is no SIMD backend.
+ */
+unsigned int HASH_lanes(const HASH_Ctx* ctx);
 
 
 
 /* helpers */
-const char* HASH_hexstr(const byte_t *hash); // for printing a hash
-void HASH_print_stats(); // benchmark
-void HASH_reset_stats();
+#define HASH_HEXSTR_MAX (2*64 + 1)
+const char* HASH_tohex(char* str, const byte_t *hash, size_t size);  // str needs 2*size+1 bytes
+#define HASH_hexstr(hash, size) HASH_tohex((char[HASH_HEXSTR_MAX]){0}, (const byte_t*)(hash), (size))  // for printing a hash, valid until the end of the statement's block
+
+/* profiling. All functions are no-ops if CFG_HASH_PROFILING is 0. */
+
+/**
+ * Sets the phase that the following hash calls of this thread are counted for.
+ * \param[in] phase new phase
+ * \return previous phase, to restore it after the tagged calls
+ */
+HASH_Phase_t HASH_set_phase(HASH_Phase_t phase);
+
+/**
+ * Merges the counters of all threads.
+ * \param[out] stats calls and processed bytes per phase
+ */
+void HASH_get_stats(HASH_Stats* stats);
+
+void HASH_print_stats(); // benchmark: total and breakdown per phase over all threads
+void HASH_reset_stats(); // resets the counters of all threads. Call only while no other thread hashes.
 
 #endif /* HASH_H_  */
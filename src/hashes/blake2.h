@@ -57,6 +57,11 @@ extern "C" {
     uint8_t  last_node;
   } blake2s_state;
 
+  struct blake2b_state__;
+
+  /* Compression function of a backend, see blake2b_get_compress() */
+  typedef void (*blake2b_compress_fn)( struct blake2b_state__ *S, const uint8_t block[BLAKE2B_BLOCKBYTES] );
+
   typedef struct blake2b_state__
   {
     uint64_t h[8];
@@ -65,6 +70,7 @@ extern "C" {
     uint8_t  buf[BLAKE2B_BLOCKBYTES];
     size_t   buflen;
     size_t   outlen;
+    blake2b_compress_fn compress;  /* fixed at init */
     uint8_t  last_node;
   } blake2b_state;
 
@@ -188,6 +194,27 @@ extern "C" {
   /* This is simply an alias for blake2b */
   int blake2( void *out, size_t outlen, const void *in, size_t inlen, const void *key, size_t keylen );
 
+  /* BLAKE2b with salt and personalization (BLAKE2B_SALTBYTES and BLAKE2B_PERSONALBYTES long, NULL for zero).
+   * Unlike a key, they only change the initial state and cost no extra compression. */
+  int blake2b_init_salt_personal( blake2b_state *S, size_t outlen, const void *salt, const void *personal );
+  int blake2b_salted( void *out, size_t outlen, const void *in, size_t inlen, const void *salt, const void *personal );
+
+  /* Implementations of the BLAKE2b compression function, chosen at runtime */
+  typedef enum {
+    BLAKE2B_BACKEND_AUTO,   /* fastest supported */
+    BLAKE2B_BACKEND_REF,    /* reference C */
+    BLAKE2B_BACKEND_AVX2    /* AVX2, one message per call */
+  } blake2b_backend_t;
+
+  int blake2b_set_backend( blake2b_backend_t backend );  /* -1 if not supported by the CPU */
+  blake2b_backend_t blake2b_get_backend( void );         /* never AUTO */
+  blake2b_compress_fn blake2b_get_compress( void );      /* of the backend in use, not changed by a later blake2b_set_backend() */
+
+  /* Keyed (key may be NULL) or salted (salt and personal may be NULL) init with the given
+   * compression function. The blake2b_init* functions above use the backend in use. */
+  int blake2b_init_compress( blake2b_state *S, blake2b_compress_fn compress, size_t outlen,
+                             const void *key, size_t keylen, const void *salt, const void *personal );
+
 #if defined(__cplusplus)
 }
 #endif
@@ -19,6 +19,7 @@
 
 #include "blake2.h"
 #include "blake2-impl.h"
+#include "../util/cpu.h"
 
 static const uint64_t blake2b_IV[8] =
 {
@@ -69,21 +70,22 @@ static void blake2b_increment_counter( blake2b_state *S, const uint64_t inc )
   S->t[1] += ( S->t[0] < inc );
 }
 
-static void blake2b_init0( blake2b_state *S )
+static void blake2b_init0( blake2b_state *S, blake2b_compress_fn compress )
 {
   size_t i;
   memset( S, 0, sizeof( blake2b_state ) );
 
   for( i = 0; i < 8; ++i ) S->h[i] = blake2b_IV[i];
+  S->compress = compress;
 }
 
 /* init xors IV with input parameter block */
-int blake2b_init_param( blake2b_state *S, const blake2b_param *P )
+static int blake2b_init_param_compress( blake2b_state *S, const blake2b_param *P, blake2b_compress_fn compress )
 {
   const uint8_t *p = ( const uint8_t * )( P );
   size_t i;
 
-  blake2b_init0( S );
+  blake2b_init0( S, compress );
 
   /* IV XOR ParamBlock */
   for( i = 0; i < 8; ++i )
@@ -93,37 +95,24 @@ int blake2b_init_param( blake2b_state *S, const blake2b_param *P )
   return 0;
 }
 
-
-
-int blake2b_init( blake2b_state *S, size_t outlen )
+int blake2b_init_param( blake2b_state *S, const blake2b_param *P )
 {
-  blake2b_param P[1];
-
-  if ( ( !outlen ) || ( outlen > BLAKE2B_OUTBYTES ) ) return -1;
-
-  P->digest_length = (uint8_t)outlen;
-  P->key_length    = 0;
-  P->fanout        = 1;
-  P->depth         = 1;
-  store32( &P->leaf_length, 0 );
-  store32( &P->node_offset, 0 );
-  store32( &P->xof_length, 0 );
-  P->node_depth    = 0;
-  P->inner_length  = 0;
-  memset( P->reserved, 0, sizeof( P->reserved ) );
-  memset( P->salt,     0, sizeof( P->salt ) );
-  memset( P->personal, 0, sizeof( P->personal ) );
-  return blake2b_init_param( S, P );
+  return blake2b_init_param_compress( S, P, blake2b_get_compress() );
 }
 
 
-int blake2b_init_key( blake2b_state *S, size_t outlen, const void *key, size_t keylen )
+
+/* salt and personal may be NULL for all-zero fields */
+int blake2b_init_compress( blake2b_state *S, blake2b_compress_fn compress, size_t outlen,
+                           const void *key, size_t keylen, const void *salt, const void *personal )
 {
   blake2b_param P[1];
 
   if ( ( !outlen ) || ( outlen > BLAKE2B_OUTBYTES ) ) return -1;
 
-  if ( !key || !keylen || keylen > BLAKE2B_KEYBYTES ) return -1;
+  if ( !key ) keylen = 0;
+
+  if ( keylen > BLAKE2B_KEYBYTES ) return -1;
 
   P->digest_length = (uint8_t)outlen;
   P->key_length    = (uint8_t)keylen;
@@ -135,11 +124,14 @@ int blake2b_init_key( blake2b_state *S, size_t outlen, const void *key, size_t k
   P->node_depth    = 0;
   P->inner_length  = 0;
   memset( P->reserved, 0, sizeof( P->reserved ) );
-  memset( P->salt,     0, sizeof( P->salt ) );
-  memset( P->personal, 0, sizeof( P->personal ) );
+  if( salt ) memcpy( P->salt, salt, sizeof( P->salt ) );
+  else memset( P->salt, 0, sizeof( P->salt ) );
+  if( personal ) memcpy( P->personal, personal, sizeof( P->personal ) );
+  else memset( P->personal, 0, sizeof( P->personal ) );
 
-  if( blake2b_init_param( S, P ) < 0 ) return -1;
+  if( blake2b_init_param_compress( S, P, compress ) < 0 ) return -1;
 
+  if( keylen > 0 )
   {
     uint8_t block[BLAKE2B_BLOCKBYTES];
     memset( block, 0, BLAKE2B_BLOCKBYTES );
@@ -150,6 +142,26 @@ int blake2b_init_key( blake2b_state *S, size_t outlen, const void *key, size_t k
   return 0;
 }
 
+
+int blake2b_init( blake2b_state *S, size_t outlen )
+{
+  return blake2b_init_compress( S, blake2b_get_compress(), outlen, NULL, 0, NULL, NULL );
+}
+
+
+int blake2b_init_key( blake2b_state *S, size_t outlen, const void *key, size_t keylen )
+{
+  if ( !key || !keylen ) return -1;
+
+  return blake2b_init_compress( S, blake2b_get_compress(), outlen, key, keylen, NULL, NULL );
+}
+
+/* salt and personal may be NULL for all-zero fields */
+int blake2b_init_salt_personal( blake2b_state *S, size_t outlen, const void *salt, const void *personal )
+{
+  return blake2b_init_compress( S, blake2b_get_compress(), outlen, NULL, 0, salt, personal );
+}
+
 #define G(r,i,a,b,c,d)                      \
   do {                                      \
     a = a + b + m[blake2b_sigma[r][2*i+0]]; \
@@ -174,7 +186,7 @@ int blake2b_init_key( blake2b_state *S, size_t outlen, const void *key, size_t k
     G(r,7,v[ 3],v[ 4],v[ 9],v[14]); \
   } while(0)
 
-static void blake2b_compress( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
+static void blake2b_compress_ref( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
 {
   uint64_t m[16];
   uint64_t v[16];
@@ -218,6 +230,139 @@ static void blake2b_compress( blake2b_state *S, const uint8_t block[BLAKE2B_BLOC
 #undef G
 #undef ROUND
 
+
+#if CPU_X86
+#include <immintrin.h>
+
+/*
+ * AVX2 compression of a single message. Each row of the 4x4 state matrix
+ * is one register; the diagonal step rotates rows b, c and d so that the
+ * diagonals become columns.
+ */
+#define ROTR32_AVX2(x) _mm256_shuffle_epi32(x, _MM_SHUFFLE(2,3,0,1))
+#define ROTR24_AVX2(x) _mm256_shuffle_epi8(x, r24)
+#define ROTR16_AVX2(x) _mm256_shuffle_epi8(x, r16)
+#define ROTR63_AVX2(x) _mm256_or_si256(_mm256_srli_epi64(x, 63), _mm256_add_epi64(x, x))
+
+#define G_AVX2(a,b,c,d,m0,m1)                                  \
+  do {                                                         \
+    a = _mm256_add_epi64(_mm256_add_epi64(a, b), m0);          \
+    d = ROTR32_AVX2(_mm256_xor_si256(d, a));                   \
+    c = _mm256_add_epi64(c, d);                                \
+    b = ROTR24_AVX2(_mm256_xor_si256(b, c));                   \
+    a = _mm256_add_epi64(_mm256_add_epi64(a, b), m1);          \
+    d = ROTR16_AVX2(_mm256_xor_si256(d, a));                   \
+    c = _mm256_add_epi64(c, d);                                \
+    b = ROTR63_AVX2(_mm256_xor_si256(b, c));                   \
+  } while(0)
+
+#define MSG_AVX2(r,i0,i1,i2,i3) \
+  _mm256_set_epi64x(m[blake2b_sigma[r][i3]], m[blake2b_sigma[r][i2]], m[blake2b_sigma[r][i1]], m[blake2b_sigma[r][i0]])
+
+#define ROUND_AVX2(r)                                                    \
+  do {                                                                   \
+    G_AVX2(a, b, c, d, MSG_AVX2(r, 0, 2, 4, 6), MSG_AVX2(r, 1, 3, 5, 7));  \
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(0,3,2,1));               \
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1,0,3,2));               \
+    d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(2,1,0,3));               \
+    G_AVX2(a, b, c, d, MSG_AVX2(r, 8, 10, 12, 14), MSG_AVX2(r, 9, 11, 13, 15)); \
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(2,1,0,3));               \
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1,0,3,2));               \
+    d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(0,3,2,1));               \
+  } while(0)
+
+CPU_TARGET("avx2")
+static void blake2b_compress_avx2( blake2b_state *S, const uint8_t block[BLAKE2B_BLOCKBYTES] )
+{
+  const __m256i r16 = _mm256_setr_epi8( 2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+                                        2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9 );
+  const __m256i r24 = _mm256_setr_epi8( 3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+                                        3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10 );
+  const __m256i h0 = _mm256_loadu_si256( (const __m256i*)&S->h[0] );
+  const __m256i h1 = _mm256_loadu_si256( (const __m256i*)&S->h[4] );
+  __m256i a, b, c, d;
+  uint64_t m[16];
+  size_t i;
+
+  for( i = 0; i < 16; ++i ) {
+    m[i] = load64( block + i * sizeof( m[i] ) );
+  }
+
+  a = h0;
+  b = h1;
+  c = _mm256_loadu_si256( (const __m256i*)&blake2b_IV[0] );
+  d = _mm256_xor_si256( _mm256_loadu_si256( (const __m256i*)&blake2b_IV[4] ),
+                        _mm256_set_epi64x( S->f[1], S->f[0], S->t[1], S->t[0] ) );
+
+  ROUND_AVX2( 0 );
+  ROUND_AVX2( 1 );
+  ROUND_AVX2( 2 );
+  ROUND_AVX2( 3 );
+  ROUND_AVX2( 4 );
+  ROUND_AVX2( 5 );
+  ROUND_AVX2( 6 );
+  ROUND_AVX2( 7 );
+  ROUND_AVX2( 8 );
+  ROUND_AVX2( 9 );
+  ROUND_AVX2( 10 );
+  ROUND_AVX2( 11 );
+
+  _mm256_storeu_si256( (__m256i*)&S->h[0], _mm256_xor_si256( h0, _mm256_xor_si256( a, c ) ) );
+  _mm256_storeu_si256( (__m256i*)&S->h[4], _mm256_xor_si256( h1, _mm256_xor_si256( b, d ) ) );
+}
+
+#undef ROTR32_AVX2
+#undef ROTR24_AVX2
+#undef ROTR16_AVX2
+#undef ROTR63_AVX2
+#undef G_AVX2
+#undef MSG_AVX2
+#undef ROUND_AVX2
+#endif /* CPU_X86 */
+
+
+/*
+ * Backend dispatch. The first blake2b_get_compress() resolves the fastest
+ * backend via CPUID. Every state keeps the compression function it was
+ * initialized with.
+ */
+static blake2b_compress_fn blake2b_compress = NULL;
+
+int blake2b_set_backend( blake2b_backend_t backend )
+{
+  switch( backend ) {
+    case BLAKE2B_BACKEND_AUTO:
+      if( blake2b_set_backend( BLAKE2B_BACKEND_AVX2 ) == 0 ) return 0;
+      return blake2b_set_backend( BLAKE2B_BACKEND_REF );
+    case BLAKE2B_BACKEND_REF:
+      blake2b_compress = blake2b_compress_ref;
+      return 0;
+    case BLAKE2B_BACKEND_AVX2:
+#if CPU_X86
+      if( !CPU_has( CPU_AVX2 ) ) return -1;
+      blake2b_compress = blake2b_compress_avx2;
+      return 0;
+#endif
+    default:
+      return -1;
+  }
+}
+
+blake2b_compress_fn blake2b_get_compress( void )
+{
+  if( blake2b_compress == NULL ) blake2b_set_backend( BLAKE2B_BACKEND_AUTO );
+  return blake2b_compress;
+}
+
+blake2b_backend_t blake2b_get_backend( void )
+{
+#if CPU_X86
+  if( blake2b_get_compress() == blake2b_compress_avx2 ) return BLAKE2B_BACKEND_AVX2;
+#endif
+  return BLAKE2B_BACKEND_REF;
+}
+
+
 int blake2b_update( blake2b_state *S, const void *pin, size_t inlen )
 {
   const unsigned char * in = (const unsigned char *)pin;
@@ -230,11 +375,11 @@ int blake2b_update( blake2b_state *S, const void *pin, size_t inlen )
       S->buflen = 0;
       memcpy( S->buf + left, in, fill ); /* Fill buffer */
       blake2b_increment_counter( S, BLAKE2B_BLOCKBYTES );
-      blake2b_compress( S, S->buf ); /* Compress */
+      S->compress( S, S->buf ); /* Compress */
       in += fill; inlen -= fill;
       while(inlen > BLAKE2B_BLOCKBYTES) {
         blake2b_increment_counter(S, BLAKE2B_BLOCKBYTES);
-        blake2b_compress( S, in );
+        S->compress( S, in );
         in += BLAKE2B_BLOCKBYTES;
         inlen -= BLAKE2B_BLOCKBYTES;
       }
@@ -259,7 +404,7 @@ int blake2b_final( blake2b_state *S, void *out, size_t outlen )
   blake2b_increment_counter( S, S->buflen );
   blake2b_set_lastblock( S );
   memset( S->buf + S->buflen, 0, BLAKE2B_BLOCKBYTES - S->buflen ); /* Padding */
-  blake2b_compress( S, S->buf );
+  S->compress( S, S->buf );
 
   for( i = 0; i < 8; ++i ) /* Output full hash to temp buffer */
     store64( buffer + sizeof( S->h[i] ) * i, S->h[i] );
@@ -299,6 +444,21 @@ int blake2b( void *out, size_t outlen, const void *in, size_t inlen, const void
   return 0;
 }
 
+int blake2b_salted( void *out, size_t outlen, const void *in, size_t inlen, const void *salt, const void *personal )
+{
+  blake2b_state S[1];
+
+  if ( NULL == in && inlen > 0 ) return -1;
+
+  if ( NULL == out ) return -1;
+
+  if( blake2b_init_salt_personal( S, outlen, salt, personal ) < 0 ) return -1;
+
+  blake2b_update( S, ( const uint8_t * )in, inlen );
+  blake2b_final( S, out, outlen );
+  return 0;
+}
+
 int blake2( void *out, size_t outlen, const void *in, size_t inlen, const void *key, size_t keylen ) {
   return blake2b(out, outlen, in, inlen, key, keylen);
 }
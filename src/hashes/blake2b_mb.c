@@ -0,0 +1,295 @@
+/*
+ * Multi-buffer BLAKE2b
+ *
+ * Hashes 4 independent messages at once by keeping the same state word of
+ * every message in one AVX2 register. This pays off for many short keyed
+ * messages, e.g. the WOTS chain steps, where a single message leaves most of
+ * the vector width of the row-wise compression unused.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "blake2.h"
+#include "blake2b_mb.h"
+#include "../util/cpu.h"
+
+
+static const uint64_t blake2b_mb_IV[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const uint8_t blake2b_mb_sigma[12][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+};
+
+
+static uint64_t mb_load64(const unsigned char *p){
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));   // only used on little endian x86
+    return w;
+}
+
+
+/*
+ * Writes the idx-th 128 byte block of key block || in (zero padded).
+ * The key block is the key padded to 128 bytes and only present if keylen > 0.
+ */
+static void mb_fill_block(unsigned char block[BLAKE2B_BLOCKBYTES],
+                          const unsigned char *key, size_t keylen,
+                          const unsigned char *in, size_t inlen,
+                          size_t idx)
+{
+    const size_t prefixlen = keylen ? BLAKE2B_BLOCKBYTES : 0;
+    const size_t total = prefixlen + inlen;
+    const size_t pos = idx * BLAKE2B_BLOCKBYTES;   // offset of the block within the message
+    size_t lo, hi;
+
+    memset(block, 0, BLAKE2B_BLOCKBYTES);
+    if (pos < prefixlen) memcpy(block, key, keylen);
+    lo = (pos > prefixlen) ? pos : prefixlen;
+    hi = (pos + BLAKE2B_BLOCKBYTES < total) ? pos + BLAKE2B_BLOCKBYTES : total;
+    if (lo < hi) memcpy(block + (lo - pos), in + (lo - prefixlen), hi - lo);
+}
+
+
+#if CPU_X86
+#include <immintrin.h>
+
+#define ROTR32(x) _mm256_shuffle_epi32(x, _MM_SHUFFLE(2,3,0,1))
+#define ROTR24(x) _mm256_shuffle_epi8(x, r24)
+#define ROTR16(x) _mm256_shuffle_epi8(x, r16)
+#define ROTR63(x) _mm256_or_si256(_mm256_srli_epi64(x, 63), _mm256_add_epi64(x, x))
+
+#define G(r,i,a,b,c,d)                                                              \
+    do {                                                                            \
+        a = _mm256_add_epi64(_mm256_add_epi64(a, b), m[blake2b_mb_sigma[r][2*i+0]]);  \
+        d = ROTR32(_mm256_xor_si256(d, a));                                         \
+        c = _mm256_add_epi64(c, d);                                                 \
+        b = ROTR24(_mm256_xor_si256(b, c));                                         \
+        a = _mm256_add_epi64(_mm256_add_epi64(a, b), m[blake2b_mb_sigma[r][2*i+1]]);  \
+        d = ROTR16(_mm256_xor_si256(d, a));                                         \
+        c = _mm256_add_epi64(c, d);                                                 \
+        b = ROTR63(_mm256_xor_si256(b, c));                                         \
+    } while(0)
+
+#define ROUND(r)                                \
+    do {                                        \
+        G(r,0,v[ 0],v[ 4],v[ 8],v[12]);         \
+        G(r,1,v[ 1],v[ 5],v[ 9],v[13]);         \
+        G(r,2,v[ 2],v[ 6],v[10],v[14]);         \
+        G(r,3,v[ 3],v[ 7],v[11],v[15]);         \
+        G(r,4,v[ 0],v[ 5],v[10],v[15]);         \
+        G(r,5,v[ 1],v[ 6],v[11],v[12]);         \
+        G(r,6,v[ 2],v[ 7],v[ 8],v[13]);         \
+        G(r,7,v[ 3],v[ 4],v[ 9],v[14]);         \
+    } while(0)
+
+/* out[j+k] = lane k of word j+k, i.e. a 4x4 transpose of 64 bit words */
+#define TRANSPOSE4(o0, o1, o2, o3, r0, r1, r2, r3)              \
+    do {                                                        \
+        __m256i t0 = _mm256_unpacklo_epi64(r0, r1);             \
+        __m256i t1 = _mm256_unpackhi_epi64(r0, r1);             \
+        __m256i t2 = _mm256_unpacklo_epi64(r2, r3);             \
+        __m256i t3 = _mm256_unpackhi_epi64(r2, r3);             \
+        o0 = _mm256_permute2x128_si256(t0, t2, 0x20);           \
+        o1 = _mm256_permute2x128_si256(t1, t3, 0x20);           \
+        o2 = _mm256_permute2x128_si256(t0, t2, 0x31);           \
+        o3 = _mm256_permute2x128_si256(t1, t3, 0x31);           \
+    } while(0)
+
+
+CPU_TARGET("avx2")
+static void blake2b_mb_x4(unsigned char *const out[], size_t outlen,
+                          const unsigned char *const key[], size_t keylen,
+                          const unsigned char *const salt[], const unsigned char *const personal[],
+                          const unsigned char *const in[], size_t inlen)
+{
+    const __m256i r16 = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+                                         2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+    const __m256i r24 = _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+                                         3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+    const size_t total = (keylen ? BLAKE2B_BLOCKBYTES : 0) + inlen;
+    const size_t nblocks = (total == 0) ? 1 : (total + BLAKE2B_BLOCKBYTES - 1) / BLAKE2B_BLOCKBYTES;
+    unsigned char block[4][BLAKE2B_BLOCKBYTES];
+    uint64_t digest[4][8];
+    __m256i h[8], m[16], v[16];
+    size_t idx, i;
+
+    for (i = 0; i < 8; i++) h[i] = _mm256_set1_epi64x((long long)blake2b_mb_IV[i]);
+    h[0] = _mm256_xor_si256(h[0], _mm256_set1_epi64x((long long)(0x01010000ULL ^ (keylen << 8) ^ outlen)));
+    for (i = 0; i < 2; i++) {
+        if (salt) h[4 + i] = _mm256_xor_si256(h[4 + i], _mm256_set_epi64x(
+            (long long)mb_load64(salt[3] + 8*i), (long long)mb_load64(salt[2] + 8*i),
+            (long long)mb_load64(salt[1] + 8*i), (long long)mb_load64(salt[0] + 8*i)));
+        if (personal) h[6 + i] = _mm256_xor_si256(h[6 + i], _mm256_set_epi64x(
+            (long long)mb_load64(personal[3] + 8*i), (long long)mb_load64(personal[2] + 8*i),
+            (long long)mb_load64(personal[1] + 8*i), (long long)mb_load64(personal[0] + 8*i)));
+    }
+
+    for (idx = 0; idx < nblocks; idx++) {
+        const uint64_t t = (idx == nblocks - 1) ? total : (idx + 1) * BLAKE2B_BLOCKBYTES;
+
+        for (i = 0; i < 4; i++) mb_fill_block(block[i], key ? key[i] : NULL, keylen, in[i], inlen, idx);
+        for (i = 0; i < 16; i += 4) {
+            TRANSPOSE4(m[i], m[i+1], m[i+2], m[i+3],
+                       _mm256_loadu_si256((const __m256i*)(block[0] + 8*i)),
+                       _mm256_loadu_si256((const __m256i*)(block[1] + 8*i)),
+                       _mm256_loadu_si256((const __m256i*)(block[2] + 8*i)),
+                       _mm256_loadu_si256((const __m256i*)(block[3] + 8*i)));
+        }
+
+        for (i = 0; i < 8; i++) v[i] = h[i];
+        for (i = 0; i < 8; i++) v[i + 8] = _mm256_set1_epi64x((long long)blake2b_mb_IV[i]);
+        v[12] = _mm256_xor_si256(v[12], _mm256_set1_epi64x((long long)t));
+        if (idx == nblocks - 1) v[14] = _mm256_xor_si256(v[14], _mm256_set1_epi64x(-1));
+
+        ROUND(0); ROUND(1); ROUND(2); ROUND(3); ROUND(4); ROUND(5);
+        ROUND(6); ROUND(7); ROUND(8); ROUND(9); ROUND(10); ROUND(11);
+
+        for (i = 0; i < 8; i++) h[i] = _mm256_xor_si256(h[i], _mm256_xor_si256(v[i], v[i + 8]));
+    }
+
+    for (i = 0; i < 8; i += 4) {
+        __m256i o0, o1, o2, o3;
+        TRANSPOSE4(o0, o1, o2, o3, h[i], h[i+1], h[i+2], h[i+3]);
+        _mm256_storeu_si256((__m256i*)&digest[0][i], o0);
+        _mm256_storeu_si256((__m256i*)&digest[1][i], o1);
+        _mm256_storeu_si256((__m256i*)&digest[2][i], o2);
+        _mm256_storeu_si256((__m256i*)&digest[3][i], o3);
+    }
+    for (i = 0; i < 4; i++) memcpy(out[i], digest[i], outlen);   // x86 is little endian
+}
+
+#undef ROTR32
+#undef ROTR24
+#undef ROTR16
+#undef ROTR63
+#undef G
+#undef ROUND
+#undef TRANSPOSE4
+#endif /* CPU_X86 */
+
+
+typedef void (*blake2b_mb_kernel_t)(unsigned char *const out[], size_t outlen,
+                                    const unsigned char *const key[], size_t keylen,
+                                    const unsigned char *const salt[], const unsigned char *const personal[],
+                                    const unsigned char *const in[], size_t inlen);
+
+/*
+ * Runs a kernel on fewer than lanes messages by repeating the last message
+ * in the unused lanes and discarding their digests.
+ */
+static void blake2b_mb_padded(blake2b_mb_kernel_t kernel, unsigned int lanes,
+                              unsigned char *const out[], size_t outlen,
+                              const unsigned char *const key[], size_t keylen,
+                              const unsigned char *const salt[], const unsigned char *const personal[],
+                              const unsigned char *const in[], size_t inlen,
+                              unsigned int num)
+{
+    unsigned char dummy[BLAKE2B_OUTBYTES];
+    unsigned char *lane_out[BLAKE2B_MB_MAX_LANES];
+    const unsigned char *lane_key[BLAKE2B_MB_MAX_LANES];
+    const unsigned char *lane_salt[BLAKE2B_MB_MAX_LANES];
+    const unsigned char *lane_personal[BLAKE2B_MB_MAX_LANES];
+    const unsigned char *lane_in[BLAKE2B_MB_MAX_LANES];
+    unsigned int i;
+
+    for (i = 0; i < lanes; i++) {
+        unsigned int src = (i < num) ? i : num - 1;
+        lane_out[i] = (i < num) ? out[i] : dummy;
+        lane_key[i] = key ? key[src] : NULL;
+        lane_salt[i] = salt ? salt[src] : NULL;
+        lane_personal[i] = personal ? personal[src] : NULL;
+        lane_in[i] = in[src];
+    }
+    kernel(lane_out, outlen, key ? lane_key : NULL, keylen,
+           salt ? lane_salt : NULL, personal ? lane_personal : NULL, lane_in, inlen);
+}
+
+
+
+static unsigned int G_blake2b_mb_limit = BLAKE2B_MB_MAX_LANES;
+
+/* checks if a kernel is allowed and supported */
+static int blake2b_mb_use(unsigned int lanes, unsigned int max_lanes){
+    if (lanes > max_lanes) return 0;
+#if CPU_X86
+    if (lanes == 4) return CPU_has(CPU_AVX2);
+#endif
+    return lanes == 1;
+}
+
+
+void blake2b_mb_limit(unsigned int max_lanes){
+    G_blake2b_mb_limit = (max_lanes == 0) ? BLAKE2B_MB_MAX_LANES : max_lanes;
+}
+
+
+unsigned int blake2b_mb_lanes(void){
+    if (blake2b_mb_use(4, G_blake2b_mb_limit)) return 4;
+    return 1;
+}
+
+
+/* common dispatcher of blake2b_mb() and blake2b_mb_salted() */
+static unsigned int blake2b_mb_run(unsigned char *const out[], size_t outlen,
+                                   const unsigned char *const key[], size_t keylen,
+                                   const unsigned char *const salt[], const unsigned char *const personal[],
+                                   const unsigned char *const in[], size_t inlen,
+                                   unsigned int num, unsigned int max_lanes)
+{
+    unsigned int done = 0;
+
+#define MB_OFS(ptrs) ((ptrs) ? (ptrs) + done : NULL)
+#define MB_RUN(kernel, lanes)                                                                           \
+    for (; num - done >= (lanes); done += (lanes)) {                                                    \
+        kernel(out + done, outlen, MB_OFS(key), keylen, MB_OFS(salt), MB_OFS(personal), in + done, inlen); \
+    }
+
+#if CPU_X86
+    if (blake2b_mb_use(4, max_lanes)) {
+        MB_RUN(blake2b_mb_x4, 4);
+        if (num - done >= 2) {  // a half empty kernel is still faster than two scalar calls
+            blake2b_mb_padded(blake2b_mb_x4, 4, out + done, outlen, MB_OFS(key), keylen,
+                              MB_OFS(salt), MB_OFS(personal), in + done, inlen, num - done);
+            done = num;
+        }
+    }
+#endif
+#undef MB_RUN
+#undef MB_OFS
+    return done;
+}
+
+
+unsigned int blake2b_mb(unsigned char *const out[], size_t outlen,
+                        const unsigned char *const key[], size_t keylen,
+                        const unsigned char *const in[], size_t inlen,
+                        unsigned int num, unsigned int max_lanes)
+{
+    return blake2b_mb_run(out, outlen, key, keylen, NULL, NULL, in, inlen, num, max_lanes);
+}
+
+
+unsigned int blake2b_mb_salted(unsigned char *const out[], size_t outlen,
+                               const unsigned char *const salt[], const unsigned char *const personal[],
+                               const unsigned char *const in[], size_t inlen,
+                               unsigned int num, unsigned int max_lanes)
+{
+    return blake2b_mb_run(out, outlen, NULL, 0, salt, personal, in, inlen, num, max_lanes);
+}
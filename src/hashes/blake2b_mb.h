@@ -0,0 +1,43 @@
+#if !defined(BLAKE2B_MB_H_)
+#define BLAKE2B_MB_H_
+
+/*
+ * Multi-buffer BLAKE2b. Hashes several independent messages of equal length
+ * with keys of equal length in parallel SIMD lanes (4-way AVX2). The kernel is
+ * selected at runtime. Messages that do not fill a full set of lanes are
+ * left to the caller's scalar implementation.
+ */
+
+#include <stddef.h>
+
+/* Maximum number of lanes of any kernel */
+#define BLAKE2B_MB_MAX_LANES 4
+
+/* Returns the number of messages the widest available kernel hashes at once. 1 if no SIMD is available. */
+unsigned int blake2b_mb_lanes(void);
+
+/* Restricts the dispatcher to kernels with at most max_lanes lanes, e.g. to
+ * test or benchmark the scalar path. 0 removes the restriction.
+ */
+void blake2b_mb_limit(unsigned int max_lanes);
+
+/* Computes out[i] = BLAKE2b-outlen( in[i], key = key[i] ) for the first messages
+ * with kernels of at most max_lanes lanes, e.g. from blake2b_mb_lanes().
+ * All keys have keylen bytes (at most 64) and all inputs have inlen bytes.
+ * key may be NULL if keylen is 0. out[i] may alias in[i].
+ * Returns the number of hashed messages, the caller hashes the rest.
+ */
+unsigned int blake2b_mb(unsigned char *const out[], size_t outlen,
+                        const unsigned char *const key[], size_t keylen,
+                        const unsigned char *const in[], size_t inlen,
+                        unsigned int num, unsigned int max_lanes);
+
+/* Computes out[i] = BLAKE2b-outlen( in[i] ) with salt[i] and personal[i] in the
+ * parameter block, see blake2b_salted(). Both have 16 bytes; either array may be NULL for zero fields.
+ */
+unsigned int blake2b_mb_salted(unsigned char *const out[], size_t outlen,
+                               const unsigned char *const salt[], const unsigned char *const personal[],
+                               const unsigned char *const in[], size_t inlen,
+                               unsigned int num, unsigned int max_lanes);
+
+#endif /* ifdef(BLAKE2B_MB_H_) */
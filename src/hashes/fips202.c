@@ -355,6 +355,41 @@ static void keccak_absorb(uint64_t *s, unsigned int r,
     }
 }
 
+/* Absorbs prefix || m. The prefix must be shorter than the rate. */
+static void keccak_absorb_prefixed(uint64_t *s, unsigned int r,
+                                   const unsigned char *prefix, unsigned long long prefixlen,
+                                   const unsigned char *m, unsigned long long mlen,
+                                   unsigned char p)
+{
+    unsigned long long i;
+    unsigned char t[200];
+
+    assert(prefixlen < r);
+    if (prefixlen > 0 && prefixlen + mlen < r) {
+        /* everything fits into the padded last block */
+        memset(t, 0, r);
+        memcpy(t, prefix, prefixlen);
+        memcpy(t + prefixlen, m, mlen);
+        t[prefixlen + mlen] = p;
+        t[r - 1] |= 128;
+        for (i = 0; i < r / 8; ++i) {
+            s[i] ^= load64(t + 8 * i);
+        }
+        return;
+    }
+    if (prefixlen > 0) {
+        memcpy(t, prefix, prefixlen);
+        memcpy(t + prefixlen, m, r - prefixlen);
+        for (i = 0; i < r / 8; ++i) {
+            s[i] ^= load64(t + 8 * i);
+        }
+        KeccakF1600_StatePermute(s);
+        m += r - prefixlen;
+        mlen -= r - prefixlen;
+    }
+    keccak_absorb(s, r, m, mlen, p);
+}
+
 static void keccak_squeezeblocks(unsigned char *h, unsigned long long nblocks,
                                  uint64_t *s, unsigned int r)
 {
@@ -370,8 +405,9 @@ static void keccak_squeezeblocks(unsigned char *h, unsigned long long nblocks,
     }
 }
 
-void shake128(unsigned char *out, unsigned long long outlen,
-              const unsigned char *in, unsigned long long inlen)
+static void shake(unsigned int r, unsigned char *out, unsigned long long outlen,
+                  const unsigned char *key, unsigned long long keylen,
+                  const unsigned char *in, unsigned long long inlen)
 {
     unsigned long long i;
     uint64_t s[25];
@@ -380,38 +416,95 @@ void shake128(unsigned char *out, unsigned long long outlen,
     for (i = 0; i < 25; i++) {
         s[i] = 0;
     }
-    keccak_absorb(s, SHAKE128_RATE, in, inlen, 0x1F);
+    keccak_absorb_prefixed(s, r, key, keylen, in, inlen, 0x1F);
 
-    keccak_squeezeblocks(out, outlen / SHAKE128_RATE, s, SHAKE128_RATE);
-    out += (outlen / SHAKE128_RATE) * SHAKE128_RATE;
+    keccak_squeezeblocks(out, outlen / r, s, r);
+    out += (outlen / r) * r;
 
-    if (outlen % SHAKE128_RATE) {
-        keccak_squeezeblocks(d, 1, s, SHAKE128_RATE);
-        for (i = 0; i < outlen % SHAKE128_RATE; i++) {
+    if (outlen % r) {
+        keccak_squeezeblocks(d, 1, s, r);
+        for (i = 0; i < outlen % r; i++) {
             out[i] = d[i];
         }
     }
 }
 
-void shake256(unsigned char *output, unsigned long long outlen,
+void shake128(unsigned char *out, unsigned long long outlen,
               const unsigned char *in, unsigned long long inlen)
 {
-    unsigned long long i;
-    uint64_t s[25];
-    unsigned char d[SHAKE256_RATE];
+    shake(SHAKE128_RATE, out, outlen, 0, 0, in, inlen);
+}
+
+void shake256(unsigned char *out, unsigned long long outlen,
+              const unsigned char *in, unsigned long long inlen)
+{
+    shake(SHAKE256_RATE, out, outlen, 0, 0, in, inlen);
+}
+
+void shake128_keyed(unsigned char *out, unsigned long long outlen,
+                    const unsigned char *key, unsigned long long keylen,
+                    const unsigned char *in, unsigned long long inlen)
+{
+    shake(SHAKE128_RATE, out, outlen, key, keylen, in, inlen);
+}
+
+void shake256_keyed(unsigned char *out, unsigned long long outlen,
+                    const unsigned char *key, unsigned long long keylen,
+                    const unsigned char *in, unsigned long long inlen)
+{
+    shake(SHAKE256_RATE, out, outlen, key, keylen, in, inlen);
+}
+
+
+void shake_init(shake_state *state, unsigned int rate)
+{
+    unsigned int i;
 
     for (i = 0; i < 25; i++) {
-        s[i] = 0;
+        state->s[i] = 0;
     }
-    keccak_absorb(s, SHAKE256_RATE, in, inlen, 0x1F);
+    state->rate = rate;
+    state->pos = 0;
+}
 
-    keccak_squeezeblocks(output, outlen / SHAKE256_RATE, s, SHAKE256_RATE);
-    output += (outlen / SHAKE256_RATE) * SHAKE256_RATE;
+void shake_absorb(shake_state *state, const unsigned char *in, unsigned long long inlen)
+{
+    while (inlen > 0) {
+        if (state->pos == 0 && inlen >= state->rate) {  /* whole blocks */
+            unsigned int i;
+            for (i = 0; i < state->rate / 8; ++i) {
+                state->s[i] ^= load64(in + 8 * i);
+            }
+            KeccakF1600_StatePermute(state->s);
+            in += state->rate;
+            inlen -= state->rate;
+            continue;
+        }
+        state->s[state->pos / 8] ^= (uint64_t)(*in++) << (8 * (state->pos % 8));
+        inlen--;
+        if (++state->pos == state->rate) {
+            KeccakF1600_StatePermute(state->s);
+            state->pos = 0;
+        }
+    }
+}
 
-    if (outlen % SHAKE256_RATE) {
-        keccak_squeezeblocks(d, 1, s, SHAKE256_RATE);
-        for (i = 0; i < outlen % SHAKE256_RATE; i++) {
-            output[i] = d[i];
+void shake_squeeze(shake_state *state, unsigned char *out, unsigned long long outlen)
+{
+    const unsigned int r = state->rate;
+    unsigned char d[SHAKE128_RATE];
+    unsigned long long i;
+
+    state->s[state->pos / 8] ^= (uint64_t)0x1F << (8 * (state->pos % 8));
+    state->s[(r - 1) / 8] ^= (uint64_t)128 << (8 * ((r - 1) % 8));
+
+    keccak_squeezeblocks(out, outlen / r, state->s, r);
+    out += (outlen / r) * r;
+
+    if (outlen % r) {
+        keccak_squeezeblocks(d, 1, state->s, r);
+        for (i = 0; i < outlen % r; i++) {
+            out[i] = d[i];
         }
     }
 }
@@ -1,6 +1,8 @@
 #ifndef XMSS_FIPS202_H
 #define XMSS_FIPS202_H
 
+#include <stdint.h>
+
 #define SHAKE128_RATE 168
 #define SHAKE256_RATE 136
 
@@ -16,4 +18,30 @@ void shake128(unsigned char *out, unsigned long long outlen,
 void shake256(unsigned char *out, unsigned long long outlen,
               const unsigned char *in, unsigned long long inlen);
 
+/* Evaluates SHAKE-128 on `key' || `in'. `keylen' must be less than SHAKE128_RATE. */
+void shake128_keyed(unsigned char *out, unsigned long long outlen,
+                    const unsigned char *key, unsigned long long keylen,
+                    const unsigned char *in, unsigned long long inlen);
+
+/* Evaluates SHAKE-256 on `key' || `in'. `keylen' must be less than SHAKE256_RATE. */
+void shake256_keyed(unsigned char *out, unsigned long long outlen,
+                    const unsigned char *key, unsigned long long keylen,
+                    const unsigned char *in, unsigned long long inlen);
+
+/* Incremental SHAKE: init with the rate, absorb any number of times, then squeeze once */
+typedef struct {
+    uint64_t s[25];
+    unsigned int rate;
+    unsigned int pos;    /* bytes absorbed into the current block */
+} shake_state;
+
+void shake_init(shake_state *state, unsigned int rate);
+
+void shake_absorb(shake_state *state, const unsigned char *in, unsigned long long inlen);
+
+void shake_squeeze(shake_state *state, unsigned char *out, unsigned long long outlen);
+
+/* Keccak-f[1600] on a state of 25 lanes */
+void KeccakF1600_StatePermute(uint64_t *state);
+
 #endif
@@ -0,0 +1,278 @@
+/*
+ * Multi-buffer SHAKE
+ *
+ * Runs 4 independent Keccak-f[1600] permutations at once by keeping the same
+ * lane of every state in one AVX2 register. Keccak has no data dependent
+ * shuffles, so every step of the permutation maps to one vector instruction.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "fips202.h"
+#include "fips202_mb.h"
+#include "../util/cpu.h"
+
+
+static const uint64_t keccak_mb_RC[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808aULL,
+    0x8000000080008000ULL, 0x000000000000808bULL, 0x0000000080000001ULL,
+    0x8000000080008081ULL, 0x8000000000008009ULL, 0x000000000000008aULL,
+    0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000aULL,
+    0x000000008000808bULL, 0x800000000000008bULL, 0x8000000000008089ULL,
+    0x8000000000008003ULL, 0x8000000000008002ULL, 0x8000000000000080ULL,
+    0x000000000000800aULL, 0x800000008000000aULL, 0x8000000080008081ULL,
+    0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL
+};
+
+
+/*
+ * Writes the idx-th block of rate bytes of key || in with SHAKE padding.
+ */
+static void mb_fill_block(unsigned char *block, unsigned int rate,
+                          const unsigned char *key, size_t keylen,
+                          const unsigned char *in, size_t inlen,
+                          size_t idx, size_t nblocks)
+{
+    const size_t total = keylen + inlen;
+    const size_t pos = idx * rate;   // offset of the block within the message
+    size_t lo, hi;
+
+    memset(block, 0, rate);
+    if (pos < keylen) memcpy(block, key, keylen);   // keylen < rate
+    lo = (pos > keylen) ? pos : keylen;
+    hi = (pos + rate < total) ? pos + rate : total;
+    if (lo < hi) memcpy(block + (lo - pos), in + (lo - keylen), hi - lo);
+
+    if (idx == nblocks - 1) {
+        block[total - pos] ^= 0x1F;
+        block[rate - 1] ^= 0x80;
+    }
+}
+
+
+#if CPU_X86
+#include <immintrin.h>
+
+#define ROL(x, n) _mm256_or_si256(_mm256_slli_epi64(x, n), _mm256_srli_epi64(x, 64 - (n)))
+#define XOR5(a, b, c, d, e) _mm256_xor_si256(_mm256_xor_si256(_mm256_xor_si256(a, b), _mm256_xor_si256(c, d)), e)
+
+/* one Keccak round on A with lanes A[x + 5*y], fully unrolled so that all rotations are immediates */
+#define KECCAK_ROUND(A, rc)                                                         \
+    do {                                                                            \
+        __m256i C0, C1, C2, C3, C4, D0, D1, D2, D3, D4;                             \
+        __m256i B[25];                                                              \
+        C0 = XOR5(A[0], A[5], A[10], A[15], A[20]);                                 \
+        C1 = XOR5(A[1], A[6], A[11], A[16], A[21]);                                 \
+        C2 = XOR5(A[2], A[7], A[12], A[17], A[22]);                                 \
+        C3 = XOR5(A[3], A[8], A[13], A[18], A[23]);                                 \
+        C4 = XOR5(A[4], A[9], A[14], A[19], A[24]);                                 \
+        D0 = _mm256_xor_si256(C4, ROL(C1, 1));                                      \
+        D1 = _mm256_xor_si256(C0, ROL(C2, 1));                                      \
+        D2 = _mm256_xor_si256(C1, ROL(C3, 1));                                      \
+        D3 = _mm256_xor_si256(C2, ROL(C4, 1));                                      \
+        D4 = _mm256_xor_si256(C3, ROL(C0, 1));                                      \
+        B[0] = _mm256_xor_si256(A[0], D0);                                          \
+        B[10] = ROL(_mm256_xor_si256(A[1], D1), 1);                                 \
+        B[20] = ROL(_mm256_xor_si256(A[2], D2), 62);                                \
+        B[5] = ROL(_mm256_xor_si256(A[3], D3), 28);                                 \
+        B[15] = ROL(_mm256_xor_si256(A[4], D4), 27);                                \
+        B[16] = ROL(_mm256_xor_si256(A[5], D0), 36);                                \
+        B[1] = ROL(_mm256_xor_si256(A[6], D1), 44);                                 \
+        B[11] = ROL(_mm256_xor_si256(A[7], D2), 6);                                 \
+        B[21] = ROL(_mm256_xor_si256(A[8], D3), 55);                                \
+        B[6] = ROL(_mm256_xor_si256(A[9], D4), 20);                                 \
+        B[7] = ROL(_mm256_xor_si256(A[10], D0), 3);                                 \
+        B[17] = ROL(_mm256_xor_si256(A[11], D1), 10);                               \
+        B[2] = ROL(_mm256_xor_si256(A[12], D2), 43);                                \
+        B[12] = ROL(_mm256_xor_si256(A[13], D3), 25);                               \
+        B[22] = ROL(_mm256_xor_si256(A[14], D4), 39);                               \
+        B[23] = ROL(_mm256_xor_si256(A[15], D0), 41);                               \
+        B[8] = ROL(_mm256_xor_si256(A[16], D1), 45);                                \
+        B[18] = ROL(_mm256_xor_si256(A[17], D2), 15);                               \
+        B[3] = ROL(_mm256_xor_si256(A[18], D3), 21);                                \
+        B[13] = ROL(_mm256_xor_si256(A[19], D4), 8);                                \
+        B[14] = ROL(_mm256_xor_si256(A[20], D0), 18);                               \
+        B[24] = ROL(_mm256_xor_si256(A[21], D1), 2);                                \
+        B[9] = ROL(_mm256_xor_si256(A[22], D2), 61);                                \
+        B[19] = ROL(_mm256_xor_si256(A[23], D3), 56);                               \
+        B[4] = ROL(_mm256_xor_si256(A[24], D4), 14);                                \
+        A[0] = _mm256_xor_si256(B[0], _mm256_andnot_si256(B[1], B[2]));             \
+        A[1] = _mm256_xor_si256(B[1], _mm256_andnot_si256(B[2], B[3]));             \
+        A[2] = _mm256_xor_si256(B[2], _mm256_andnot_si256(B[3], B[4]));             \
+        A[3] = _mm256_xor_si256(B[3], _mm256_andnot_si256(B[4], B[0]));             \
+        A[4] = _mm256_xor_si256(B[4], _mm256_andnot_si256(B[0], B[1]));             \
+        A[5] = _mm256_xor_si256(B[5], _mm256_andnot_si256(B[6], B[7]));             \
+        A[6] = _mm256_xor_si256(B[6], _mm256_andnot_si256(B[7], B[8]));             \
+        A[7] = _mm256_xor_si256(B[7], _mm256_andnot_si256(B[8], B[9]));             \
+        A[8] = _mm256_xor_si256(B[8], _mm256_andnot_si256(B[9], B[5]));             \
+        A[9] = _mm256_xor_si256(B[9], _mm256_andnot_si256(B[5], B[6]));             \
+        A[10] = _mm256_xor_si256(B[10], _mm256_andnot_si256(B[11], B[12]));         \
+        A[11] = _mm256_xor_si256(B[11], _mm256_andnot_si256(B[12], B[13]));         \
+        A[12] = _mm256_xor_si256(B[12], _mm256_andnot_si256(B[13], B[14]));         \
+        A[13] = _mm256_xor_si256(B[13], _mm256_andnot_si256(B[14], B[10]));         \
+        A[14] = _mm256_xor_si256(B[14], _mm256_andnot_si256(B[10], B[11]));         \
+        A[15] = _mm256_xor_si256(B[15], _mm256_andnot_si256(B[16], B[17]));         \
+        A[16] = _mm256_xor_si256(B[16], _mm256_andnot_si256(B[17], B[18]));         \
+        A[17] = _mm256_xor_si256(B[17], _mm256_andnot_si256(B[18], B[19]));         \
+        A[18] = _mm256_xor_si256(B[18], _mm256_andnot_si256(B[19], B[15]));         \
+        A[19] = _mm256_xor_si256(B[19], _mm256_andnot_si256(B[15], B[16]));         \
+        A[20] = _mm256_xor_si256(B[20], _mm256_andnot_si256(B[21], B[22]));         \
+        A[21] = _mm256_xor_si256(B[21], _mm256_andnot_si256(B[22], B[23]));         \
+        A[22] = _mm256_xor_si256(B[22], _mm256_andnot_si256(B[23], B[24]));         \
+        A[23] = _mm256_xor_si256(B[23], _mm256_andnot_si256(B[24], B[20]));         \
+        A[24] = _mm256_xor_si256(B[24], _mm256_andnot_si256(B[20], B[21]));         \
+        A[0] = _mm256_xor_si256(A[0], _mm256_set1_epi64x((long long)(rc)));         \
+    } while(0)
+
+
+CPU_TARGET("avx2")
+static void keccak_permute_x4(__m256i A[25]){
+    int round;
+    for (round = 0; round < 24; round++) KECCAK_ROUND(A, keccak_mb_RC[round]);
+}
+
+
+CPU_TARGET("avx2")
+void KeccakF1600_StatePermute4x(uint64_t state[4*25]){
+    __m256i A[25];
+    int i;
+    for (i = 0; i < 25; i++) A[i] = _mm256_loadu_si256((const __m256i*)&state[4*i]);
+    keccak_permute_x4(A);
+    for (i = 0; i < 25; i++) _mm256_storeu_si256((__m256i*)&state[4*i], A[i]);
+}
+
+
+CPU_TARGET("avx2")
+static void shake_mb_x4(unsigned int rate,
+                        unsigned char *const out[], size_t outlen,
+                        const unsigned char *const key[], size_t keylen,
+                        const unsigned char *const in[], size_t inlen)
+{
+    const size_t nblocks = (keylen + inlen) / rate + 1;   // the padding always fits into the last block
+    unsigned char block[4][SHAKE128_RATE];
+    uint64_t lanes[4][25];
+    __m256i A[25];
+    size_t idx, pos, i, j;
+
+    for (i = 0; i < 25; i++) A[i] = _mm256_setzero_si256();
+
+    for (idx = 0; idx < nblocks; idx++) {
+        for (j = 0; j < 4; j++) mb_fill_block(block[j], rate, key ? key[j] : NULL, keylen, in[j], inlen, idx, nblocks);
+        for (i = 0; i < rate / 8; i++) {
+            uint64_t w[4];
+            for (j = 0; j < 4; j++) memcpy(&w[j], block[j] + 8*i, 8);   // x86 is little endian
+            A[i] = _mm256_xor_si256(A[i], _mm256_set_epi64x((long long)w[3], (long long)w[2], (long long)w[1], (long long)w[0]));
+        }
+        keccak_permute_x4(A);
+    }
+
+    for (pos = 0; pos < outlen; pos += rate) {
+        const size_t len = (outlen - pos < rate) ? outlen - pos : rate;
+        if (pos > 0) keccak_permute_x4(A);
+        for (i = 0; i < (len + 7) / 8; i++) {
+            uint64_t w[4];
+            _mm256_storeu_si256((__m256i*)w, A[i]);
+            for (j = 0; j < 4; j++) lanes[j][i] = w[j];
+        }
+        for (j = 0; j < 4; j++) memcpy(out[j] + pos, lanes[j], len);
+    }
+}
+
+/*
+ * Runs the kernel on fewer than 4 messages by repeating the last message
+ * in the unused lanes and discarding their output. outlen is at most SHAKE128_RATE.
+ */
+static void shake_mb_padded_x4(unsigned int rate,
+                               unsigned char *const out[], size_t outlen,
+                               const unsigned char *const key[], size_t keylen,
+                               const unsigned char *const in[], size_t inlen,
+                               unsigned int num)
+{
+    unsigned char dummy[SHAKE128_RATE];
+    unsigned char *lane_out[4];
+    const unsigned char *lane_key[4];
+    const unsigned char *lane_in[4];
+    unsigned int i;
+
+    for (i = 0; i < 4; i++) {
+        unsigned int src = (i < num) ? i : num - 1;
+        lane_out[i] = (i < num) ? out[i] : dummy;
+        lane_key[i] = key ? key[src] : NULL;
+        lane_in[i] = in[src];
+    }
+    shake_mb_x4(rate, lane_out, outlen, key ? lane_key : NULL, keylen, lane_in, inlen);
+}
+
+#undef ROL
+#undef XOR5
+#undef KECCAK_ROUND
+#endif /* CPU_X86 */
+
+
+static unsigned int G_keccak_mb_limit = KECCAK_MB_MAX_LANES;
+
+/* checks if a kernel is allowed and supported */
+static int keccak_mb_use(unsigned int lanes, unsigned int max_lanes){
+    if (lanes > max_lanes) return 0;
+#if CPU_X86
+    if (lanes == 4) return CPU_has(CPU_AVX2);
+#endif
+    return lanes == 1;
+}
+
+
+void keccak_mb_limit(unsigned int max_lanes){
+    G_keccak_mb_limit = (max_lanes == 0) ? KECCAK_MB_MAX_LANES : max_lanes;
+}
+
+
+unsigned int keccak_mb_lanes(void){
+    if (keccak_mb_use(4, G_keccak_mb_limit)) return 4;
+    return 1;
+}
+
+
+static unsigned int shake_mb(unsigned int rate,
+                             unsigned char *const out[], size_t outlen,
+                             const unsigned char *const key[], size_t keylen,
+                             const unsigned char *const in[], size_t inlen,
+                             unsigned int num, unsigned int max_lanes)
+{
+    unsigned int done = 0;
+
+#define MB_RUN(kernel, lanes)                                                                   \
+    for (; num - done >= (lanes); done += (lanes)) {                                            \
+        kernel(rate, out + done, outlen, key ? key + done : NULL, keylen, in + done, inlen);    \
+    }
+
+#if CPU_X86
+    if (keccak_mb_use(4, max_lanes)) {
+        MB_RUN(shake_mb_x4, 4);
+        if (num - done >= 2 && outlen <= SHAKE128_RATE) {  // a half empty kernel is still faster than two scalar calls
+            shake_mb_padded_x4(rate, out + done, outlen, key ? key + done : NULL, keylen, in + done, inlen, num - done);
+            done = num;
+        }
+    }
+#endif
+#undef MB_RUN
+    return done;
+}
+
+
+unsigned int shake128_mb(unsigned char *const out[], size_t outlen,
+                         const unsigned char *const key[], size_t keylen,
+                         const unsigned char *const in[], size_t inlen,
+                         unsigned int num, unsigned int max_lanes)
+{
+    return shake_mb(SHAKE128_RATE, out, outlen, key, keylen, in, inlen, num, max_lanes);
+}
+
+
+unsigned int shake256_mb(unsigned char *const out[], size_t outlen,
+                         const unsigned char *const key[], size_t keylen,
+                         const unsigned char *const in[], size_t inlen,
+                         unsigned int num, unsigned int max_lanes)
+{
+    return shake_mb(SHAKE256_RATE, out, outlen, key, keylen, in, inlen, num, max_lanes);
+}
@@ -0,0 +1,47 @@
+#ifndef FIPS202_MB_H
+#define FIPS202_MB_H
+
+/*
+ * Multi-buffer SHAKE. Hashes several independent messages of equal length in
+ * parallel SIMD lanes (4-way AVX2 Keccak-f[1600]). The kernel is selected at
+ * runtime. Messages that do not fill a full set of lanes are left to the
+ * caller's scalar implementation.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Maximum number of lanes of any kernel */
+#define KECCAK_MB_MAX_LANES 4
+
+/* Returns the number of messages the widest available kernel hashes at once. 1 if no SIMD is available. */
+unsigned int keccak_mb_lanes(void);
+
+/* Restricts the dispatcher to kernels with at most max_lanes lanes, e.g. to
+ * test or benchmark the scalar path. 0 removes the restriction.
+ */
+void keccak_mb_limit(unsigned int max_lanes);
+
+/* Keccak-f[1600] on 4 interleaved states: state[5*y+x] holds lane (x,y) of
+ * state i at state[4*(5*y+x)+i]. Requires AVX2, see keccak_mb_lanes().
+ */
+void KeccakF1600_StatePermute4x(uint64_t state[4*25]);
+
+/* Computes out[i] = SHAKE128( key[i] || in[i] ) with outlen bytes for the first
+ * messages with kernels of at most max_lanes lanes, e.g. from keccak_mb_lanes().
+ * All keys have keylen bytes (less than SHAKE128_RATE) and all inputs have inlen bytes.
+ * key may be NULL if keylen is 0. out[i] may alias in[i].
+ * Returns the number of hashed messages, the caller hashes the rest.
+ */
+unsigned int shake128_mb(unsigned char *const out[], size_t outlen,
+                         const unsigned char *const key[], size_t keylen,
+                         const unsigned char *const in[], size_t inlen,
+                         unsigned int num, unsigned int max_lanes);
+
+/* Like shake128_mb() for SHAKE256, keylen must be less than SHAKE256_RATE. */
+unsigned int shake256_mb(unsigned char *const out[], size_t outlen,
+                         const unsigned char *const key[], size_t keylen,
+                         const unsigned char *const in[], size_t inlen,
+                         unsigned int num, unsigned int max_lanes);
+
+#endif
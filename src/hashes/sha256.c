@@ -11,16 +11,16 @@
  * Tom St Denis, tomstdenis@gmail.com, http://libtomcrypt.org
  */
 
+#include <stdint.h>
 #include <string.h>
 #include "sha256.h"
-#include "endian.h"
+#include "../util/cpu.h"
 
 #if !CFG_SHA256_USE_OPENSSL
 
 /* If we don't have OpenSSL, here's a SHA256 implementation */
-#define SHA256_FINALCOUNT_SIZE  8
 #define SHA256_K_SIZE	        64
-static const unsigned long K[SHA256_K_SIZE] = {
+static const uint32_t K[SHA256_K_SIZE] = {
     0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL, 0x3956c25bUL,
     0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL, 0xd807aa98UL, 0x12835b01UL,
     0x243185beUL, 0x550c7dc3UL, 0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL,
@@ -38,17 +38,12 @@ static const unsigned long K[SHA256_K_SIZE] = {
 
 /* Various logical functions */
 
-/* Rotate x right by rot bits */
-static unsigned long RORc(unsigned long x, int rot) {
-    rot &= 31; if (rot == 0) return x;
-    unsigned long right = ((x&0xFFFFFFFFUL)>>rot );
-    unsigned long left  = ((x&0xFFFFFFFFUL)<<(32-rot) );
-    return (right|left) & 0xFFFFFFFFUL;
-}
+/* Rotate x right by rot bits, compiles to a single ror */
+#define RORc(x, rot)    (((x) >> (rot)) | ((x) << (32 - (rot))))
 #define Ch(x,y,z)       (z ^ (x & (y ^ z)))
 #define Maj(x,y,z)      (((x | y) & z) | (x & y)) 
 #define S(x, n)         RORc((x),(n))
-#define R(x, n)         (((x)&0xFFFFFFFFUL)>>(n))
+#define R(x, n)         ((x)>>(n))
 #define Sigma0(x)       (S(x, 2) ^ S(x, 13) ^ S(x, 22))
 #define Sigma1(x)       (S(x, 6) ^ S(x, 11) ^ S(x, 25))
 #define Gamma0(x)       (S(x, 7) ^ S(x, 18) ^ R(x, 3))
@@ -56,90 +51,291 @@ static unsigned long RORc(unsigned long x, int rot) {
 
 
 
+/* Big endian loads and stores. Compile to a load and bswap where possible. */
+static inline uint32_t load_bigendian(const unsigned char *p)
+{
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    uint32_t w;
+    memcpy(&w, p, sizeof w);
+    return __builtin_bswap32(w);
+#elif defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    uint32_t w;
+    memcpy(&w, p, sizeof w);
+    return w;
+#else
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+#endif
+}
+
+static inline void store_bigendian(unsigned char *p, uint32_t x)
+{
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    x = __builtin_bswap32(x);
+    memcpy(p, &x, sizeof x);
+#elif defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    memcpy(p, &x, sizeof x);
+#else
+    p[0] = (unsigned char)(x >> 24);
+    p[1] = (unsigned char)(x >> 16);
+    p[2] = (unsigned char)(x >>  8);
+    p[3] = (unsigned char)(x);
+#endif
+}
+
+
 
-void put_bigendian( void *target, unsigned long long value, size_t bytes ) {
-    unsigned char *b = target;
+/*
+ * K[i] + W[i] of the padding block of a 64 byte message, i.e. a block with
+ * 0x80, zeros and the bit length 512. Its message schedule is constant.
+ */
+static const uint32_t KW_PAD64[SHA256_K_SIZE] = {
+    0xc28a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL, 0x3956c25bUL,
+    0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL, 0xd807aa98UL, 0x12835b01UL,
+    0x243185beUL, 0x550c7dc3UL, 0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL,
+    0xc19bf374UL, 0x649b69c1UL, 0xf0fe4786UL, 0x0fe1edc6UL, 0x240cf254UL,
+    0x4fe9346fUL, 0x6cc984beUL, 0x61b9411eUL, 0x16f988faUL, 0xf2c65152UL,
+    0xa88e5a6dUL, 0xb019fc65UL, 0xb9d99ec7UL, 0x9a1231c3UL, 0xe70eeaa0UL,
+    0xfdb1232bUL, 0xc7353eb0UL, 0x3069bad5UL, 0xcb976d5fUL, 0x5a0f118fUL,
+    0xdc1eeefdUL, 0x0a35b689UL, 0xde0b7a04UL, 0x58f4ca9dUL, 0xe15d5b16UL,
+    0x007f3e86UL, 0x37088980UL, 0xa507ea32UL, 0x6fab9537UL, 0x17406110UL,
+    0x0d8cd6f1UL, 0xcdaa3b6dUL, 0xc0bbbe37UL, 0x83613bdaUL, 0xdb48a363UL,
+    0x0b02e931UL, 0x6fd15ca7UL, 0x521afacaUL, 0x31338431UL, 0x6ed41a95UL,
+    0x6d437890UL, 0xc39c91f2UL, 0x9eccabbdUL, 0xb5c9a0e6UL, 0x532fb63cUL,
+    0xd2c741c6UL, 0x07237ea3UL, 0xa4954b68UL, 0x4c191d76UL
+};
+
+/* padding block of a 64 byte message for backends that need the bytes */
+static const unsigned char PAD64[64] = {
+    0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0x00
+};
+
+
+
+/*
+ * Round macros of the portable compression function. The 64 rounds are fully
+ * unrolled and the working variables are renamed instead of rotated, so the
+ * compiler can keep them in registers. KW(i) has to provide K[i] + W[i].
+ */
+#define RND(a,b,c,d,e,f,g,h,i)                                             \
+    t0 = h + Sigma1(e) + Ch(e, f, g) + KW(i);                              \
+    t1 = Sigma0(a) + Maj(a, b, c);                                         \
+    d += t0;                                                               \
+    h  = t0 + t1;
+
+#define RND8(i)                                                            \
+    RND(S0,S1,S2,S3,S4,S5,S6,S7,(i)+0);                                    \
+    RND(S7,S0,S1,S2,S3,S4,S5,S6,(i)+1);                                    \
+    RND(S6,S7,S0,S1,S2,S3,S4,S5,(i)+2);                                    \
+    RND(S5,S6,S7,S0,S1,S2,S3,S4,(i)+3);                                    \
+    RND(S4,S5,S6,S7,S0,S1,S2,S3,(i)+4);                                    \
+    RND(S3,S4,S5,S6,S7,S0,S1,S2,(i)+5);                                    \
+    RND(S2,S3,S4,S5,S6,S7,S0,S1,(i)+6);                                    \
+    RND(S1,S2,S3,S4,S5,S6,S7,S0,(i)+7);
+
+#define RND64                                                              \
+    S0 = ctx->h[0]; S1 = ctx->h[1]; S2 = ctx->h[2]; S3 = ctx->h[3];        \
+    S4 = ctx->h[4]; S5 = ctx->h[5]; S6 = ctx->h[6]; S7 = ctx->h[7];        \
+    RND8( 0); RND8( 8); RND8(16); RND8(24);                                \
+    RND8(32); RND8(40); RND8(48); RND8(56);                                \
+    ctx->h[0] += S0; ctx->h[1] += S1; ctx->h[2] += S2; ctx->h[3] += S3;    \
+    ctx->h[4] += S4; ctx->h[5] += S5; ctx->h[6] += S6; ctx->h[7] += S7;
+
+
+/*
+ * Portable compression function. The message schedule only keeps the last
+ * 16 words: W[i] for i >= 16 replaces W[i-16].
+ */
+static void sha256_compress_ref (SHA256_CTX * ctx, const void *buf)
+{
+    uint32_t S0, S1, S2, S3, S4, S5, S6, S7, W[16], t0, t1;
+    const unsigned char *p = buf;
     int i;
 
-    for (i = bytes-1; i >= 0; i--) {
-        b[i] = value & 0xff;
-        value >>= 8;
+    /* SHA256 interprets the block as an array of 16 bigendian 32 bit numbers */
+    for (i = 0; i < 16; i++) {
+        W[i] = load_bigendian(p + 4*i);
     }
+
+#define KW(i) (K[i] + ((i) < 16 ? W[(i) & 15] :                            \
+        (W[(i) & 15] += Gamma1(W[((i) - 2) & 15]) + W[((i) - 7) & 15]      \
+                      + Gamma0(W[((i) - 15) & 15]))))
+    RND64
+#undef KW
 }
-    
-unsigned long long get_bigendian( const void *target, size_t bytes ) {
-    const unsigned char *b = target;
-    unsigned long result = 0;
-    int i;
 
-    for (i=0; i<bytes; i++) {
-        result = 256 * result + (b[i] & 0xff);
-    }
 
-    return result;
+/* Compresses the constant padding block of a 64 byte message */
+static void sha256_compress_pad64_ref (SHA256_CTX * ctx)
+{
+    uint32_t S0, S1, S2, S3, S4, S5, S6, S7, t0, t1;
+
+#define KW(i) KW_PAD64[i]
+    RND64
+#undef KW
 }
 
+#undef RND64
+#undef RND8
+#undef RND
 
 
-static void sha256_compress (SHA256_CTX * ctx, const void *buf)
+
+#if CPU_X86
+#include <immintrin.h>
+
+/*
+ * Four rounds with the SHA extensions. M0 holds the current message words;
+ * the schedule for the next rounds is finished in M1 and started in M3.
+ */
+#define SHANI_QROUND(i, M0, M1, M2, M3)                         \
+    MSG = _mm_add_epi32(M0, _mm_loadu_si128((const __m128i*)(K + 4*(i)))); \
+    STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);        \
+    TMP = _mm_alignr_epi8(M0, M3, 4);                           \
+    M1 = _mm_add_epi32(M1, TMP);                                \
+    M1 = _mm_sha256msg2_epu32(M1, M0);                          \
+    MSG = _mm_shuffle_epi32(MSG, 0x0E);                         \
+    STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);        \
+    M3 = _mm_sha256msg1_epu32(M3, M0);
+
+/* first rounds: load message words, no schedule to finish yet */
+#define SHANI_QROUND_LOAD(i, M)                                 \
+    M = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16*(i))), MASK); \
+    MSG = _mm_add_epi32(M, _mm_loadu_si128((const __m128i*)(K + 4*(i)))); \
+    STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);        \
+    MSG = _mm_shuffle_epi32(MSG, 0x0E);                         \
+    STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+
+CPU_TARGET("sha,sse4.1")
+static void sha256_compress_shani (SHA256_CTX * ctx, const void *buf)
 {
-    unsigned long S0, S1, S2, S3, S4, S5, S6, S7, W[SHA256_K_SIZE], t0, t1, t;
-    int i;
-    const unsigned char *p;
-
-    /* copy state into S */
-    S0 = ctx->h[0];
-    S1 = ctx->h[1];
-    S2 = ctx->h[2];
-    S3 = ctx->h[3];
-    S4 = ctx->h[4];
-    S5 = ctx->h[5];
-    S6 = ctx->h[6];
-    S7 = ctx->h[7];
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    const unsigned char *p = buf;
+    __m128i STATE0, STATE1, MSG, TMP;
+    __m128i MSG0, MSG1, MSG2, MSG3;
+    __m128i ABEF_SAVE, CDGH_SAVE;
+    uint32_t *h = ctx->h;
 
-    /*
-     * We've been asked to perform the hash computation on this 512-bit string.
-     * SHA256 interprets that as an array of 16 bigendian 32 bit numbers; copy
-     * it, and convert it into 16 unsigned long's of the CPU's native format
-     */
-    p = buf;
-    for (i=0; i<16; i++) {
-        W[i] = get_bigendian( p, 4 );
-        p += 4;
-    }
+    /* reorder state into ABEF and CDGH as expected by sha256rnds2 */
+    TMP = _mm_loadu_si128((const __m128i*) &h[0]);
+    STATE1 = _mm_loadu_si128((const __m128i*) &h[4]);
+    TMP = _mm_shuffle_epi32(TMP, 0xB1);          /* CDAB */
+    STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);    /* EFGH */
+    STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);    /* ABEF */
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0); /* CDGH */
+    ABEF_SAVE = STATE0;
+    CDGH_SAVE = STATE1;
+
+    SHANI_QROUND_LOAD(0, MSG0)
+    SHANI_QROUND_LOAD(1, MSG1)
+    MSG0 = _mm_sha256msg1_epu32(MSG0, MSG1);
+    SHANI_QROUND_LOAD(2, MSG2)
+    MSG1 = _mm_sha256msg1_epu32(MSG1, MSG2);
+    MSG3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), MASK);
+    SHANI_QROUND( 3, MSG3, MSG0, MSG1, MSG2)
+    SHANI_QROUND( 4, MSG0, MSG1, MSG2, MSG3)
+    SHANI_QROUND( 5, MSG1, MSG2, MSG3, MSG0)
+    SHANI_QROUND( 6, MSG2, MSG3, MSG0, MSG1)
+    SHANI_QROUND( 7, MSG3, MSG0, MSG1, MSG2)
+    SHANI_QROUND( 8, MSG0, MSG1, MSG2, MSG3)
+    SHANI_QROUND( 9, MSG1, MSG2, MSG3, MSG0)
+    SHANI_QROUND(10, MSG2, MSG3, MSG0, MSG1)
+    SHANI_QROUND(11, MSG3, MSG0, MSG1, MSG2)
+    SHANI_QROUND(12, MSG0, MSG1, MSG2, MSG3)
+    SHANI_QROUND(13, MSG1, MSG2, MSG3, MSG0)   /* last sha256msg1 results are unused */
+    SHANI_QROUND(14, MSG2, MSG3, MSG0, MSG1)
+
+    MSG = _mm_add_epi32(MSG3, _mm_loadu_si128((const __m128i*)(K + 60)));
+    STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+    MSG = _mm_shuffle_epi32(MSG, 0x0E);
+    STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
 
-    /* fill W[16..63] */
-    for (i = 16; i < SHA256_K_SIZE; i++) {
-        W[i] = Gamma1(W[i - 2]) + W[i - 7] + Gamma0(W[i - 15]) + W[i - 16];
-    }        
-
-    /* Compress */
-#define RND(a,b,c,d,e,f,g,h,i)                         \
-     t0 = h + Sigma1(e) + Ch(e, f, g) + K[i] + W[i];   \
-     t1 = Sigma0(a) + Maj(a, b, c);                    \
-     d += t0;                                          \
-     h  = t0 + t1;
-
-     for (i = 0; i < SHA256_K_SIZE; ++i) {
-         RND(S0,S1,S2,S3,S4,S5,S6,S7,i);
-         t = S7; S7 = S6; S6 = S5; S5 = S4; 
-         S4 = S3; S3 = S2; S2 = S1; S1 = S0; S0 = t;
-     }
-#undef RND     
- 
     /* feedback */
-    ctx->h[0] += S0;
-    ctx->h[1] += S1;
-    ctx->h[2] += S2;
-    ctx->h[3] += S3;
-    ctx->h[4] += S4;
-    ctx->h[5] += S5;
-    ctx->h[6] += S6;
-    ctx->h[7] += S7;
+    STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+    STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+
+    TMP = _mm_shuffle_epi32(STATE0, 0x1B);       /* FEBA */
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);    /* DCHG */
+    STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0); /* DCBA */
+    STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);    /* ABEF */
+    _mm_storeu_si128((__m128i*) &h[0], STATE0);
+    _mm_storeu_si128((__m128i*) &h[4], STATE1);
 }
+#undef SHANI_QROUND
+#undef SHANI_QROUND_LOAD
+
+#endif /* CPU_X86 */
+
+
+
+/*
+ * Backend dispatch. The first SHA256_get_compress() resolves the fastest
+ * backend via CPUID. Every context keeps the compression function it was
+ * initialized with.
+ */
+static SHA256_Compress_fn sha256_compress = NULL;
+
+static int sha256_shani_supported(void){
+#if CPU_X86
+    return CPU_has(CPU_SHA) && CPU_has(CPU_SSE41);
+#else
+    return 0;
+#endif
+}
+
+int SHA256_set_backend(SHA256_Backend_t backend)
+{
+    switch (backend) {
+        case SHA256_BACKEND_AUTO:
+            if (sha256_shani_supported()) return SHA256_set_backend(SHA256_BACKEND_SHANI);
+            return SHA256_set_backend(SHA256_BACKEND_REF);
+        case SHA256_BACKEND_REF:
+            sha256_compress = sha256_compress_ref;
+            return 0;
+        case SHA256_BACKEND_SHANI:
+#if CPU_X86
+            if (!sha256_shani_supported()) return -1;
+            sha256_compress = sha256_compress_shani;
+            return 0;
+#endif
+        default:
+            return -1;
+    }
+}
+
+SHA256_Compress_fn SHA256_get_compress(void)
+{
+    if (sha256_compress == NULL) SHA256_set_backend(SHA256_BACKEND_AUTO);
+    return sha256_compress;
+}
+
+SHA256_Backend_t SHA256_get_backend(void)
+{
+#if CPU_X86
+    if (SHA256_get_compress() == sha256_compress_shani) return SHA256_BACKEND_SHANI;
+#endif
+    return SHA256_BACKEND_REF;
+}
+
+/* the portable backend has a precomputed message schedule for the padding block */
+static void sha256_compress_pad64 (SHA256_Compress_fn compress, SHA256_CTX * ctx)
+{
+    if (compress == sha256_compress_ref) sha256_compress_pad64_ref(ctx);
+    else compress(ctx, PAD64);
+}
+
+
 
 void SHA256_Init (SHA256_CTX *ctx)
 {
+    SHA256_Init_compress(ctx, SHA256_get_compress());
+}
+
+void SHA256_Init_compress (SHA256_CTX *ctx, SHA256_Compress_fn compress)
+{
+    ctx->compress = compress;
     ctx->Nl = 0;
     ctx->Nh = 0;
     ctx->num = 0;
@@ -155,28 +351,36 @@ void SHA256_Init (SHA256_CTX *ctx)
 
 void SHA256_Update (SHA256_CTX *ctx, const void *src, unsigned int count)
 {
-    unsigned new_count = (ctx->Nl + (count << 3)) & 0xffffffff;
+    const unsigned char *in = src;
+    uint32_t new_count = ctx->Nl + (count << 3);
     if (new_count < ctx->Nl) {
         ctx->Nh += 1;
     }
+    ctx->Nh += count >> 29;
     ctx->Nl = new_count;
 
-    while (count) {
+    /* fill up a partial block first */
+    if (ctx->num > 0) {
         unsigned int this_step = 64 - ctx->num;
         if (this_step > count) this_step = count;
-        memcpy( ctx->data + ctx->num, src, this_step);
-
-        if (this_step + ctx->num < 64) {
-            ctx->num += this_step;
-            break;
-        }
-
-        src = (const unsigned char *)src + this_step;
+        memcpy( ctx->data + ctx->num, in, this_step);
+        ctx->num += this_step;
+        in += this_step;
         count -= this_step;
+        if (ctx->num < 64) return;
+        ctx->compress( ctx, ctx->data );
         ctx->num = 0;
+    }
 
-        sha256_compress( ctx, ctx->data );
+    /* compress full blocks directly from the input */
+    while (count >= 64) {
+        ctx->compress( ctx, in );
+        in += 64;
+        count -= 64;
     }
+
+    memcpy( ctx->data, in, count);
+    ctx->num = count;
 }
 
 /*
@@ -185,26 +389,77 @@ void SHA256_Update (SHA256_CTX *ctx, const void *src, unsigned int count)
 void SHA256_Final (unsigned char *digest, SHA256_CTX *ctx)
 {
     unsigned int i;
-    unsigned char finalcount[SHA256_FINALCOUNT_SIZE];
-
-    put_bigendian( &finalcount[0], ctx->Nh, 4 );
-    put_bigendian( &finalcount[4], ctx->Nl, 4 );
-
-    SHA256_Update(ctx, "\200", 1);
 
+    ctx->data[ctx->num++] = 0x80;
     if (ctx->num > 56) {
-        SHA256_Update(ctx, "\0\0\0\0\0\0\0\0", 8);
+        memset( ctx->data + ctx->num, 0, 64 - ctx->num );
+        ctx->compress( ctx, ctx->data );
+        ctx->num = 0;
     }
     memset( ctx->data + ctx->num, 0, 56 - ctx->num );
-    ctx->num = 56;
-    SHA256_Update(ctx, finalcount, SHA256_FINALCOUNT_SIZE);  /* Should cause a sha256_compress() */
+    store_bigendian( ctx->data + 56, ctx->Nh );
+    store_bigendian( ctx->data + 60, ctx->Nl );
+    ctx->compress( ctx, ctx->data );
 
     /*
-     * The final state is an array of unsigned long's; place them as a series
+     * The final state is an array of 32 bit words; place them as a series
      * of bigendian 4-byte words onto the output
      */ 
     for (i=0; i<8; i++) {
-        put_bigendian( digest + 4*i, ctx->h[i], 4 );
+        store_bigendian( digest + 4*i, ctx->h[i] );
+    }
+}
+
+
+
+/*
+ * Fixed-length fast paths. Messages that fit into a single block are padded
+ * in place and compressed without the buffering and counting of
+ * SHA256_Update/SHA256_Final. The inline helper is specialized by the
+ * compiler for every constant length below.
+ */
+static inline void sha256_one_block (SHA256_Compress_fn compress, unsigned char *digest,
+                                     const void *prefix, unsigned int prefixlen,
+                                     const void *in, unsigned int inlen)
+{
+    SHA256_CTX ctx;
+    unsigned char block[64];
+    const unsigned int total = prefixlen + inlen;
+    unsigned int i;
+
+    memcpy( block, prefix, prefixlen );
+    memcpy( block + prefixlen, in, inlen );
+    block[total] = 0x80;
+    memset( block + total + 1, 0, 60 - total - 1 );
+    store_bigendian( block + 60, total << 3 );
+
+    SHA256_Init_compress( &ctx, compress );
+    compress( &ctx, block );
+    for (i=0; i<8; i++) {
+        store_bigendian( digest + 4*i, ctx.h[i] );
+    }
+}
+
+void SHA256_Short (SHA256_Compress_fn compress, unsigned char *digest, const void *prefix, unsigned int prefixlen, const void *in, unsigned int inlen)
+{
+    sha256_one_block( compress, digest, prefix, prefixlen, in, inlen );
+}
+
+void SHA256_Key16_32 (SHA256_Compress_fn compress, unsigned char *digest, const void *key, const void *in)
+{
+    sha256_one_block( compress, digest, key, 16, in, 32 );
+}
+
+void SHA256_64 (SHA256_Compress_fn compress, unsigned char *digest, const void *in)
+{
+    SHA256_CTX ctx;
+    unsigned int i;
+
+    SHA256_Init_compress( &ctx, compress );
+    compress( &ctx, in );
+    sha256_compress_pad64( compress, &ctx );
+    for (i=0; i<8; i++) {
+        store_bigendian( digest + 4*i, ctx.h[i] );
     }
 }
 #endif
@@ -12,16 +12,27 @@
 #include <openssl/sha.h>
 #else
 
+#include <stdint.h>
+
+struct SHA256_CTX_s;
+
+/* Compression function of a backend, see SHA256_get_compress() */
+typedef void (*SHA256_Compress_fn)(struct SHA256_CTX_s *, const void *);
+
 /* SHA256 context. */
-typedef struct {
-  unsigned long int h[8];            /* state; this is in the CPU native format */
-  unsigned long Nl, Nh;              /* number of bits processed so far */
+typedef struct SHA256_CTX_s {
+  uint32_t h[8];                     /* state; this is in the CPU native format */
+  uint32_t Nl, Nh;                   /* number of bits processed so far */
   unsigned num;                      /* number of bytes within the below */
                                      /* buffer */
   unsigned char data[64];            /* input buffer.  This is in byte vector format */
+  SHA256_Compress_fn compress;       /* compression function, fixed at init */
 } SHA256_CTX;
 
-void SHA256_Init(SHA256_CTX *);  /* context */
+void SHA256_Init(SHA256_CTX *);  /* context, uses the backend in use */
+
+void SHA256_Init_compress(SHA256_CTX *,        /* context */
+                          SHA256_Compress_fn); /* compression function from SHA256_get_compress() */
 
 void SHA256_Update(SHA256_CTX *, /* context */
                   const void *, /* input block */ 
@@ -29,6 +40,39 @@ void SHA256_Update(SHA256_CTX *, /* context */
 
 void SHA256_Final(unsigned char *,
                  SHA256_CTX *);
+
+
+/* Fixed-length fast paths without buffering, for short inputs */
+#define SHA256_SHORT_MAX 55              /* longest message that fits into one block */
+
+void SHA256_Short(SHA256_Compress_fn,    /* compression function from SHA256_get_compress() */
+                  unsigned char *,       /* digest */
+                  const void *,          /* prefix, e.g. a key */
+                  unsigned int,          /* length of prefix */
+                  const void *,          /* input */
+                  unsigned int);         /* length of input. prefix+input <= SHA256_SHORT_MAX */
+
+void SHA256_Key16_32(SHA256_Compress_fn, /* compression function */
+                     unsigned char *,    /* digest */
+                     const void *,       /* 16 byte key */
+                     const void *);      /* 32 byte input */
+
+void SHA256_64(SHA256_Compress_fn,       /* compression function */
+               unsigned char *,          /* digest */
+               const void *);            /* 64 byte input, e.g. two hashes */
+
+
+/* Implementations of the compression function */
+typedef enum {
+  SHA256_BACKEND_AUTO,               /* fastest supported, chosen via CPUID */
+  SHA256_BACKEND_REF,                /* portable C */
+  SHA256_BACKEND_SHANI,              /* x86 SHA extensions */
+} SHA256_Backend_t;
+
+int SHA256_set_backend(SHA256_Backend_t); /* returns 0 on success, -1 if not supported by the CPU */
+
+SHA256_Backend_t SHA256_get_backend(void); /* backend in use, never AUTO */
+SHA256_Compress_fn SHA256_get_compress(void); /* compression function of the backend in use, not changed by a later SHA256_set_backend() */
 #endif
 
 #endif /* ifdef(SHA256_H_) */
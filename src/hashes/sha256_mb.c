@@ -0,0 +1,267 @@
+/*
+ * Multi-buffer SHA-256
+ *
+ * Hashes up to 16 independent messages of equal length at once by keeping
+ * the same state word of every message in one SIMD register. This only pays
+ * off for many short, independent messages, e.g. the WOTS chain steps.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "sha256.h"
+#include "sha256_mb.h"
+#include "../util/cpu.h"
+
+
+static const uint32_t sha256_mb_IV[8] = {
+    0x6A09E667UL, 0xBB67AE85UL, 0x3C6EF372UL, 0xA54FF53AUL,
+    0x510E527FUL, 0x9B05688CUL, 0x1F83D9ABUL, 0x5BE0CD19UL
+};
+
+static const uint32_t sha256_mb_K[64] = {
+    0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL, 0x3956c25bUL,
+    0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL, 0xd807aa98UL, 0x12835b01UL,
+    0x243185beUL, 0x550c7dc3UL, 0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL,
+    0xc19bf174UL, 0xe49b69c1UL, 0xefbe4786UL, 0x0fc19dc6UL, 0x240ca1ccUL,
+    0x2de92c6fUL, 0x4a7484aaUL, 0x5cb0a9dcUL, 0x76f988daUL, 0x983e5152UL,
+    0xa831c66dUL, 0xb00327c8UL, 0xbf597fc7UL, 0xc6e00bf3UL, 0xd5a79147UL,
+    0x06ca6351UL, 0x14292967UL, 0x27b70a85UL, 0x2e1b2138UL, 0x4d2c6dfcUL,
+    0x53380d13UL, 0x650a7354UL, 0x766a0abbUL, 0x81c2c92eUL, 0x92722c85UL,
+    0xa2bfe8a1UL, 0xa81a664bUL, 0xc24b8b70UL, 0xc76c51a3UL, 0xd192e819UL,
+    0xd6990624UL, 0xf40e3585UL, 0x106aa070UL, 0x19a4c116UL, 0x1e376c08UL,
+    0x2748774cUL, 0x34b0bcb5UL, 0x391c0cb3UL, 0x4ed8aa4aUL, 0x5b9cca4fUL,
+    0x682e6ff3UL, 0x748f82eeUL, 0x78a5636fUL, 0x84c87814UL, 0x8cc70208UL,
+    0x90befffaUL, 0xa4506cebUL, 0xbef9a3f7UL, 0xc67178f2UL
+};
+
+
+static uint32_t mb_load_be32(const unsigned char *p){
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void mb_store_be32(unsigned char *p, uint32_t x){
+    p[0] = (unsigned char)(x >> 24);
+    p[1] = (unsigned char)(x >> 16);
+    p[2] = (unsigned char)(x >>  8);
+    p[3] = (unsigned char)(x);
+}
+
+
+/*
+ * Writes the idx-th 64 byte block of the padded message prefix || in.
+ */
+static void mb_fill_block(unsigned char block[64],
+                          const unsigned char *prefix, size_t prefixlen,
+                          const unsigned char *in, size_t inlen,
+                          size_t idx, size_t nblocks)
+{
+    const size_t total = prefixlen + inlen;
+    const size_t pos = idx * 64;   // offset of the block within the message
+    size_t lo, hi;
+
+    memset(block, 0, 64);
+    if (pos < prefixlen) {
+        hi = (prefixlen - pos < 64) ? prefixlen - pos : 64;
+        memcpy(block, prefix + pos, hi);
+    }
+    lo = (pos > prefixlen) ? pos : prefixlen;
+    hi = (pos + 64 < total) ? pos + 64 : total;
+    if (lo < hi) memcpy(block + (lo - pos), in + (lo - prefixlen), hi - lo);
+
+    if (total >= pos && total < pos + 64) block[total - pos] = 0x80;
+    if (idx == nblocks - 1) {
+        mb_store_be32(block + 56, (uint32_t)((uint64_t)total >> 29));
+        mb_store_be32(block + 60, (uint32_t)(total << 3));
+    }
+}
+
+
+
+#if CPU_X86
+#include <immintrin.h>
+
+/* 4-way SSE2 */
+#define MB_FUNC   sha256_mb_x4
+#define MB_LANES  4
+#define MB_TARGET "sse2"
+#define mbvec     __m128i
+#define MB_ADD(x,y)   _mm_add_epi32(x, y)
+#define MB_XOR(x,y)   _mm_xor_si128(x, y)
+#define MB_AND(x,y)   _mm_and_si128(x, y)
+#define MB_OR(x,y)    _mm_or_si128(x, y)
+#define MB_SHR(x,n)   _mm_srli_epi32(x, n)
+#define MB_ROR(x,n)   _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - (n)))
+#define MB_SET1(x)    _mm_set1_epi32((int)(x))
+#define MB_LOAD(p)    _mm_loadu_si128((const __m128i*)(p))
+#define MB_STORE(p,v) _mm_storeu_si128((__m128i*)(p), v)
+#include "sha256_mb_kernel.h"
+#undef MB_FUNC
+#undef MB_LANES
+#undef MB_TARGET
+#undef mbvec
+#undef MB_ADD
+#undef MB_XOR
+#undef MB_AND
+#undef MB_OR
+#undef MB_SHR
+#undef MB_ROR
+#undef MB_SET1
+#undef MB_LOAD
+#undef MB_STORE
+
+/* 8-way AVX2 */
+#define MB_FUNC   sha256_mb_x8
+#define MB_LANES  8
+#define MB_TARGET "avx2"
+#define mbvec     __m256i
+#define MB_ADD(x,y)   _mm256_add_epi32(x, y)
+#define MB_XOR(x,y)   _mm256_xor_si256(x, y)
+#define MB_AND(x,y)   _mm256_and_si256(x, y)
+#define MB_OR(x,y)    _mm256_or_si256(x, y)
+#define MB_SHR(x,n)   _mm256_srli_epi32(x, n)
+#define MB_ROR(x,n)   _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define MB_SET1(x)    _mm256_set1_epi32((int)(x))
+#define MB_LOAD(p)    _mm256_loadu_si256((const __m256i*)(p))
+#define MB_STORE(p,v) _mm256_storeu_si256((__m256i*)(p), v)
+#include "sha256_mb_kernel.h"
+#undef MB_FUNC
+#undef MB_LANES
+#undef MB_TARGET
+#undef mbvec
+#undef MB_ADD
+#undef MB_XOR
+#undef MB_AND
+#undef MB_OR
+#undef MB_SHR
+#undef MB_ROR
+#undef MB_SET1
+#undef MB_LOAD
+#undef MB_STORE
+
+/* 16-way AVX-512 with native rotates and ternary logic */
+#define MB_FUNC   sha256_mb_x16
+#define MB_LANES  16
+#define MB_TARGET "avx512f"
+#define mbvec     __m512i
+#define MB_ADD(x,y)   _mm512_add_epi32(x, y)
+#define MB_XOR(x,y)   _mm512_xor_si512(x, y)
+#define MB_AND(x,y)   _mm512_and_si512(x, y)
+#define MB_OR(x,y)    _mm512_or_si512(x, y)
+#define MB_SHR(x,n)   _mm512_srli_epi32(x, n)
+#define MB_ROR(x,n)   _mm512_ror_epi32(x, n)
+#define MB_SET1(x)    _mm512_set1_epi32((int)(x))
+#define MB_LOAD(p)    _mm512_loadu_si512((const void*)(p))
+#define MB_STORE(p,v) _mm512_storeu_si512((void*)(p), v)
+#define MB_CH(x,y,z)   _mm512_ternarylogic_epi32(x, y, z, 0xCA)
+#define MB_MAJ(x,y,z)  _mm512_ternarylogic_epi32(x, y, z, 0xE8)
+#define MB_XOR3(x,y,z) _mm512_ternarylogic_epi32(x, y, z, 0x96)
+#include "sha256_mb_kernel.h"
+#undef MB_FUNC
+#undef MB_LANES
+#undef MB_TARGET
+#undef mbvec
+#undef MB_ADD
+#undef MB_XOR
+#undef MB_AND
+#undef MB_OR
+#undef MB_SHR
+#undef MB_ROR
+#undef MB_SET1
+#undef MB_LOAD
+#undef MB_STORE
+
+#endif /* CPU_X86 */
+
+
+
+typedef void (*sha256_mb_kernel_t)(unsigned char *const out[],
+                                   const unsigned char *const prefix[], size_t prefixlen,
+                                   const unsigned char *const in[], size_t inlen);
+
+
+/*
+ * Runs a kernel of the given width on the remaining num < lanes messages by
+ * repeating the last message in the unused lanes.
+ */
+static void sha256_mb_padded(sha256_mb_kernel_t kernel, unsigned int lanes,
+                             unsigned char *const out[],
+                             const unsigned char *const prefix[], size_t prefixlen,
+                             const unsigned char *const in[], size_t inlen,
+                             unsigned int num)
+{
+    unsigned char dummy[SHA256_LEN];
+    unsigned char *lane_out[SHA256_MB_MAX_LANES];
+    const unsigned char *lane_prefix[SHA256_MB_MAX_LANES];
+    const unsigned char *lane_in[SHA256_MB_MAX_LANES];
+    unsigned int i;
+
+    for (i = 0; i < lanes; i++) {
+        unsigned int src = (i < num) ? i : num - 1;
+        lane_out[i] = (i < num) ? out[i] : dummy;
+        lane_prefix[i] = prefix ? prefix[src] : NULL;
+        lane_in[i] = in[src];
+    }
+    kernel(lane_out, prefix ? lane_prefix : NULL, prefixlen, lane_in, inlen);
+}
+
+
+
+static unsigned int G_sha256_mb_limit = SHA256_MB_MAX_LANES;
+
+/* checks if a kernel is supported by the CPU */
+static int sha256_mb_supported(unsigned int lanes){
+#if CPU_X86
+    if (lanes == 16) return CPU_has(CPU_AVX512F);
+    if (lanes == 8)  return CPU_has(CPU_AVX2);
+    if (lanes == 4)  return CPU_has(CPU_SSE2);
+#endif
+    return lanes == 1;
+}
+
+
+/* checks if a kernel is allowed and supported */
+static int sha256_mb_use(unsigned int lanes, unsigned int max_lanes){
+    return lanes <= max_lanes && sha256_mb_supported(lanes);
+}
+
+
+void sha256_mb_limit(unsigned int max_lanes){
+    G_sha256_mb_limit = (max_lanes == 0) ? SHA256_MB_MAX_LANES : max_lanes;
+}
+
+
+unsigned int sha256_mb_lanes(void){
+    if (sha256_mb_use(16, G_sha256_mb_limit)) return 16;
+    if (sha256_mb_use(8, G_sha256_mb_limit)) return 8;
+    if (sha256_mb_use(4, G_sha256_mb_limit)) return 4;
+    return 1;
+}
+
+
+unsigned int sha256_mb(unsigned char *const out[],
+                       const unsigned char *const prefix[], size_t prefixlen,
+                       const unsigned char *const in[], size_t inlen,
+                       unsigned int num, unsigned int max_lanes)
+{
+    unsigned int done = 0;
+
+#define MB_RUN(kernel, lanes)                                                   \
+    for (; num - done >= (lanes); done += (lanes)) {                            \
+        kernel(out + done, prefix ? prefix + done : NULL, prefixlen, in + done, inlen); \
+    }
+
+#if CPU_X86
+    if (sha256_mb_use(16, max_lanes)) MB_RUN(sha256_mb_x16, 16);
+    if (sha256_mb_use(8, max_lanes))  MB_RUN(sha256_mb_x8, 8);
+    if (sha256_mb_use(4, max_lanes)) {
+        MB_RUN(sha256_mb_x4, 4);
+        if (num - done >= 2) {  // a half empty kernel is still faster than two scalar calls
+            sha256_mb_padded(sha256_mb_x4, 4, out + done, prefix ? prefix + done : NULL, prefixlen, in + done, inlen, num - done);
+            done = num;
+        }
+    }
+#endif
+#undef MB_RUN
+    return done;
+}
@@ -0,0 +1,35 @@
+#if !defined(SHA256_MB_H_)
+#define SHA256_MB_H_
+
+/*
+ * Multi-buffer SHA-256. Hashes several independent messages of equal length
+ * in parallel SIMD lanes (4-way SSE2, 8-way AVX2, 16-way AVX-512). The kernel
+ * is selected at runtime. Messages that do not fill a full set of lanes are
+ * left to the caller's scalar implementation.
+ */
+
+#include <stddef.h>
+
+/* Maximum number of lanes of any kernel */
+#define SHA256_MB_MAX_LANES 16
+
+/* Returns the number of messages the widest available kernel hashes at once. 1 if no SIMD is available. */
+unsigned int sha256_mb_lanes(void);
+
+/* Restricts the dispatcher to kernels with at most max_lanes lanes, e.g. to
+ * test or benchmark narrower kernels. 0 removes the restriction.
+ */
+void sha256_mb_limit(unsigned int max_lanes);
+
+/* Computes out[i] = SHA256( prefix[i] || in[i] ) for the first messages with
+ * kernels of at most max_lanes lanes, e.g. from sha256_mb_lanes().
+ * All prefixes have prefixlen bytes and all inputs have inlen bytes.
+ * prefix may be NULL if prefixlen is 0. out[i] may alias in[i].
+ * Returns the number of hashed messages, the caller hashes the rest.
+ */
+unsigned int sha256_mb(unsigned char *const out[],
+                       const unsigned char *const prefix[], size_t prefixlen,
+                       const unsigned char *const in[], size_t inlen,
+                       unsigned int num, unsigned int max_lanes);
+
+#endif /* ifdef(SHA256_MB_H_) */
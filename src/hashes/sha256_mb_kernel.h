@@ -0,0 +1,88 @@
+/*
+ * SHA-256 multi-buffer kernel template. Included by sha256_mb.c once per
+ * vector width. Each vector holds the same state word of MB_LANES messages.
+ *
+ * The includer defines:
+ *   MB_FUNC, MB_LANES, MB_TARGET     name, width and target of the kernel
+ *   mbvec                             vector type with MB_LANES 32-bit words
+ *   MB_ADD, MB_XOR, MB_AND, MB_OR     lane-wise operations
+ *   MB_ROR, MB_SHR                    rotate and shift right by a constant
+ *   MB_SET1, MB_LOAD, MB_STORE        broadcast, unaligned load and store
+ * Optionally MB_CH, MB_MAJ, MB_XOR3 if the ISA has cheaper forms.
+ */
+
+#ifndef MB_CH
+#define MB_CH(x,y,z)   MB_XOR(z, MB_AND(x, MB_XOR(y, z)))
+#endif
+#ifndef MB_MAJ
+#define MB_MAJ(x,y,z)  MB_OR(MB_AND(MB_OR(x, y), z), MB_AND(x, y))
+#endif
+#ifndef MB_XOR3
+#define MB_XOR3(x,y,z) MB_XOR(MB_XOR(x, y), z)
+#endif
+
+#define MB_SIGMA0(x) MB_XOR3(MB_ROR(x,  2), MB_ROR(x, 13), MB_ROR(x, 22))
+#define MB_SIGMA1(x) MB_XOR3(MB_ROR(x,  6), MB_ROR(x, 11), MB_ROR(x, 25))
+#define MB_GAMMA0(x) MB_XOR3(MB_ROR(x,  7), MB_ROR(x, 18), MB_SHR(x,  3))
+#define MB_GAMMA1(x) MB_XOR3(MB_ROR(x, 17), MB_ROR(x, 19), MB_SHR(x, 10))
+
+CPU_TARGET(MB_TARGET)
+static void MB_FUNC(unsigned char *const out[],
+                    const unsigned char *const prefix[], size_t prefixlen,
+                    const unsigned char *const in[], size_t inlen)
+{
+    const size_t nblocks = (prefixlen + inlen + 9 + 63) / 64;
+    uint32_t words[16][MB_LANES];
+    uint32_t digest[8][MB_LANES];
+    unsigned char block[64];
+    mbvec s[8], w[16];
+    mbvec a, b, c, d, e, f, g, h, t0, t1;
+    size_t idx;
+    int i, lane;
+
+    for (i = 0; i < 8; i++) s[i] = MB_SET1(sha256_mb_IV[i]);
+
+    for (idx = 0; idx < nblocks; idx++) {
+        /* gather: transpose the idx-th block of every lane into word vectors */
+        for (lane = 0; lane < MB_LANES; lane++) {
+            mb_fill_block(block, prefix ? prefix[lane] : NULL, prefixlen, in[lane], inlen, idx, nblocks);
+            for (i = 0; i < 16; i++) words[i][lane] = mb_load_be32(block + 4*i);
+        }
+        for (i = 0; i < 16; i++) w[i] = MB_LOAD(words[i]);
+
+        a = s[0]; b = s[1]; c = s[2]; d = s[3];
+        e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+        for (i = 0; i < 64; i++) {
+            if (i >= 16) {  /* rolling 16-word message schedule */
+                w[i & 15] = MB_ADD(MB_ADD(MB_GAMMA1(w[(i - 2) & 15]), w[(i - 7) & 15]),
+                                   MB_ADD(MB_GAMMA0(w[(i - 15) & 15]), w[i & 15]));
+            }
+            t0 = MB_ADD(MB_ADD(h, MB_SIGMA1(e)), MB_ADD(MB_CH(e, f, g), MB_ADD(MB_SET1(sha256_mb_K[i]), w[i & 15])));
+            t1 = MB_ADD(MB_SIGMA0(a), MB_MAJ(a, b, c));
+            h = g; g = f; f = e;
+            e = MB_ADD(d, t0);
+            d = c; c = b; b = a;
+            a = MB_ADD(t0, t1);
+        }
+
+        s[0] = MB_ADD(s[0], a); s[1] = MB_ADD(s[1], b);
+        s[2] = MB_ADD(s[2], c); s[3] = MB_ADD(s[3], d);
+        s[4] = MB_ADD(s[4], e); s[5] = MB_ADD(s[5], f);
+        s[6] = MB_ADD(s[6], g); s[7] = MB_ADD(s[7], h);
+    }
+
+    /* scatter the digests back to the lanes */
+    for (i = 0; i < 8; i++) MB_STORE(digest[i], s[i]);
+    for (lane = 0; lane < MB_LANES; lane++) {
+        for (i = 0; i < 8; i++) mb_store_be32(out[lane] + 4*i, digest[i][lane]);
+    }
+}
+
+#undef MB_SIGMA0
+#undef MB_SIGMA1
+#undef MB_GAMMA0
+#undef MB_GAMMA1
+#undef MB_CH
+#undef MB_MAJ
+#undef MB_XOR3
@@ -45,12 +45,15 @@ int cur_height(const MT_Subtree* tree){
 
 
 // todo: adjust hashkey
-void hash_two(const hash_t* left_in, const hash_t* right_in, hash_t* output, size_t size_hash){
+void hash_two(const HASH_Ctx* hash, const hash_t* left_in, const hash_t* right_in, hash_t* output){
+	const size_t size_hash = hash->config.size;
 	unsigned char input[size_hash*2];
 	memcpy(input, left_in, size_hash);
 	memcpy(input+size_hash, right_in, size_hash);
-	HASH_keyhash(output, input, size_hash*2, 0);
-	LOG_trace("hash_two: h_l=%.8s + h_r=%.8s => %.8s", HASH_hexstr( (hash_t*)input ), HASH_hexstr( (hash_t*)(input+size_hash) ), HASH_hexstr(output) );
+	HASH_Phase_t phase = HASH_set_phase(HASH_PHASE_TREE);
+	HASH_keyhash(hash, output, input, size_hash*2, 0);
+	HASH_set_phase(phase);
+	LOG_trace("hash_two: h_l=%.8s + h_r=%.8s => %.8s", HASH_hexstr( input, 4 ), HASH_hexstr( input+size_hash, 4 ), HASH_hexstr( output, 4 ) );
 }
 
 
@@ -60,10 +63,39 @@ int num_rights(const int height){
 }
 
 
+// root, left nodes and right nodes of a subtree
+static size_t subtree_hashes(uint8_t height){
+	return 1 + height + num_rights(height);
+}
+
+
+static size_t num_left_leafs(uint8_t height){
+	return ((1 << height) + 1) / 2;
+}
+
+
+// a bottom subtree over the whole tree is never replaced, so its desire subtree stays empty
+static uint8_t desire_height(const MT_Config* config, uint8_t height_bottom){
+	return (height_bottom == config->height) ? 0 : height_bottom;
+}
+
+
+// subtree heights of num_layers layers, bottom up. NULL heights split evenly with the remainder on top.
+static bool split_layers(const MT_Config* config, uint8_t num_layers, const uint8_t* heights, uint8_t* split){
+	unsigned sum = 0;
+	for (int i = 0; i < num_layers; i++){
+		split[i] = (heights != NULL) ? heights[i] : config->height / num_layers;
+		if (heights == NULL && i == num_layers-1) split[i] = config->height - sum;
+		sum += split[i];
+	}
+	return sum == config->height;
+}
+
+
 
 MT_Subtree init_subtree(MT_Tree *tree, uint8_t height){
 	uint8_t size_hash = tree->config.cfg_hash.size;
-	unsigned int num_hashes = 1+height+num_rights(height);
+	unsigned int num_hashes = subtree_hashes(height);
 	LOG_debug("num_hashes: %d, height: %d", num_hashes, height);
 	MT_Subtree subtree;
 
@@ -75,6 +107,7 @@ MT_Subtree init_subtree(MT_Tree *tree, uint8_t height){
 	if (subtree.root == NULL) LOG_error("Allocation error!");
 	subtree.left_nodes  = subtree.root + 1*size_hash;   // height left nodes
 	subtree.right_nodes = subtree.left_nodes + height*size_hash;   // 2**(height-1) - 1 right nodes
+	subtree.left_leafs = NULL;
 	LOG_debug("init_subtree: num_hashes=%d, root=%p, left=%p, right=%p, diff=%d", num_hashes, subtree.root, subtree.left_nodes, subtree.right_nodes, subtree.right_nodes - subtree.root);
 	return subtree;	
 }
@@ -89,13 +122,16 @@ void clear_subtree(MT_Subtree* subtree){
 
 
 // add to subtree
-void add_subtree_leaf(MT_Subtree* subtree, const hash_t* leaf){
+void add_subtree_leaf(const HASH_Ctx* hash, MT_Subtree* subtree, const hash_t* leaf){
 	if(subtree->is_full == true) return;
 
 	const uint8_t size_hash = subtree->cfg_hash.size;
 
 	// abuse root hash to store first left hash until tree is full
 	if(subtree->leaf_idx == 0) memcpy(subtree->root, leaf, size_hash);
+	if(subtree->left_leafs != NULL && subtree->leaf_idx % 2 == 0){
+		memcpy(subtree->left_leafs + (subtree->leaf_idx/2)*size_hash, leaf, size_hash);
+	}
 
 	MT_index_t nodeidx = subtree->leaf_idx;
 	MT_index_t curr_height = cur_height(subtree);
@@ -103,7 +139,7 @@ void add_subtree_leaf(MT_Subtree* subtree, const hash_t* leaf){
 	memcpy(node_hash, leaf, size_hash);
 
 	// infos
-	LOG_trace("add_subtree_leaf: Adding %.8s (currh=%d, leaf=%d)", HASH_hexstr(leaf), curr_height, nodeidx);
+	LOG_trace("add_subtree_leaf: Adding %.8s (currh=%d, leaf=%d)", HASH_hexstr( leaf, 4 ), curr_height, nodeidx);
 
 	// traverse subtree to the top, adding nodes
 	for (int h = 0; h < curr_height; h++){
@@ -111,15 +147,15 @@ void add_subtree_leaf(MT_Subtree* subtree, const hash_t* leaf){
 
 		if ((nodeidx & 1) == 0){   // node is left
 			if (h < subtree->height) memcpy(subtree->left_nodes + h*size_hash, node_hash, size_hash); //works, overflow
-			LOG_trace("  - Add Left (h=%d, i=%d) hash: %.8s", h, nodeidx, HASH_hexstr( subtree->left_nodes + h*size_hash ));
+			LOG_trace("  - Add Left (h=%d, i=%d) hash: %.8s", h, nodeidx, HASH_hexstr( subtree->left_nodes + h*size_hash, 4 ));
 			break;
 		} else {
 			unsigned int right_idx = (nodeidx*(1 << h) -1);
-			LOG_trace("  - Add Right %d (h=%d, i=%d) hash: %.8s", right_idx, h, nodeidx, HASH_hexstr(node_hash) );
+			LOG_trace("  - Add Right %d (h=%d, i=%d) hash: %.8s", right_idx, h, nodeidx, HASH_hexstr( node_hash, 4 ) );
 			memcpy( subtree->right_nodes + right_idx*size_hash, node_hash, size_hash);
 			nodeidx /= 2;  // round to lower
 			if (h < subtree->height){  // when not reached the top: compute next parent
-				hash_two(subtree->left_nodes + h*size_hash, node_hash, node_hash, size_hash); 
+				hash_two(hash, subtree->left_nodes + h*size_hash, node_hash, node_hash);
 			}
 		}
 	}
@@ -130,7 +166,7 @@ void add_subtree_leaf(MT_Subtree* subtree, const hash_t* leaf){
 		subtree->is_full = true;
 		if (subtree->height > 0) memcpy(subtree->left_nodes, subtree->root, size_hash); // restore first left 
 		memcpy(subtree->root, node_hash, size_hash);  // assign correct root value
-		LOG_trace("add_subtree_leaf: Full! root=%.8s, lidx=%d", HASH_hexstr(node_hash), subtree->leaf_idx );
+		LOG_trace("add_subtree_leaf: Full! root=%.8s, lidx=%d", HASH_hexstr( node_hash, 4 ), subtree->leaf_idx );
 		subtree->leaf_idx = 0;
 		return;
 	}
@@ -138,14 +174,14 @@ void add_subtree_leaf(MT_Subtree* subtree, const hash_t* leaf){
 	// Else: check if leaf index is a power of 2 => add new left node:
 	if(subtree->leaf_idx == (1 << curr_height)){
 		memcpy(subtree->left_nodes + curr_height*size_hash, node_hash, size_hash);
-		LOG_trace("  - 2^x! Add %d. hash to left_nodes: %.8s", curr_height, HASH_hexstr( node_hash ) );
+		LOG_trace("  - 2^x! Add %d. hash to left_nodes: %.8s", curr_height, HASH_hexstr( node_hash, 4 ) );
 	}	
 }
 
 
 
 // generates the path from a subtree
-void gen_subpath(MT_Subtree* subtree, const hash_t* leaf, hash_t* path){
+void gen_subpath(const HASH_Ctx* hash, MT_Subtree* subtree, const hash_t* leaf, hash_t* path){
 	const size_t size_hash = subtree->cfg_hash.size;    
 	bool first_time_left = true;	
     MT_index_t nodeidx = subtree->leaf_idx;
@@ -158,7 +194,7 @@ void gen_subpath(MT_Subtree* subtree, const hash_t* leaf, hash_t* path){
 				if(h==0){
 					memcpy(subtree->left_nodes, leaf, size_hash);
 				} else {
-					hash_two(path + (h-1)*size_hash, subtree->right_nodes + ((2*nodeidx+1) * (1<<(h-1))-1)*size_hash, subtree->left_nodes + h*size_hash, size_hash);   // Timing-Attack possible here? => No! Only leaks leaf index
+					hash_two(hash, path + (h-1)*size_hash, subtree->right_nodes + ((2*nodeidx+1) * (1<<(h-1))-1)*size_hash, subtree->left_nodes + h*size_hash);   // Timing-Attack possible here? => No! Only leaks leaf index
 				}
 				//LOG_trace("first time left, on h=%d, l=%d", h, subtree->leaf_idx);
 				first_time_left = false;
@@ -171,8 +207,294 @@ void gen_subpath(MT_Subtree* subtree, const hash_t* leaf, hash_t* path){
 }
 
 
+// adds the count-th leaf to a treehash stack. The root of 2^h leaves ends up at stack[h].
+void treehash_add(const HASH_Ctx* hash, hash_t* stack, uint32_t count, const hash_t* leaf){
+	const size_t size_hash = hash->config.size;
+	hash_t node[size_hash];
+	int h = 0;
+	memcpy(node, leaf, size_hash);
+	for (; (count & 1) == 1; count /= 2, h++){
+		hash_two(hash, stack + h*size_hash, node, node);
+	}
+	memcpy(stack + h*size_hash, node, size_hash);
+}
+
+
+// subtrees of a layer: 0 is the bottom, num_mid+1 the top (exist only)
+static MT_Subtree* layer_exist(MT_Tree* tree, unsigned layer){
+	if (layer == 0) return &(tree->exist);
+	if (layer <= tree->num_mid) return &(tree->mid[layer-1].exist);
+	return &(tree->top);
+}
+
+static MT_Subtree* layer_desire(MT_Tree* tree, unsigned layer){
+	return (layer == 0) ? &(tree->desire) : &(tree->mid[layer-1].desire);
+}
+
+
+// adds a node to a layer while the tree is built: the first fills exist, the later ones pass through desire to the layer above
+void build_layer(MT_Tree* tree, unsigned layer, const hash_t* node){
+	MT_Subtree* exist = layer_exist(tree, layer);
+	if (layer == tree->num_mid+1){
+		add_subtree_leaf( &(tree->hash), exist, node);
+		return;
+	}
+	MT_Subtree* target = (exist->is_full) ? layer_desire(tree, layer) : exist;
+	add_subtree_leaf( &(tree->hash), target, node);
+	if (target->is_full){
+		LOG_trace("build_layer: subtree of layer %d is full, h=%d root=%.8s", layer, target->height, HASH_hexstr( target->root, 4 ) );
+		build_layer(tree, layer+1, target->root);
+		if (target != exist) clear_subtree(target);
+	}
+}
+
+
+// ============================================================================
+// BDS traversal
+// ============================================================================
+
+/*
+ * BDS traversal (Buchmann, Dahmen, Schneider 2008) keeps the auth path of the
+ * next leaf. A new left node comes from keep, right nodes below h-k from the
+ * treehash instances and right nodes of the top levels from retain.
+ */
+typedef struct {
+	uint8_t height;       // height of the node to compute
+	bool completed;
+	uint32_t next_idx;    // next leaf
+	uint8_t stack_usage;  // nodes on the shared stack
+	hash_t* node;
+} MT_Treehash;
+
+struct MT_Bds {
+	uint8_t k;
+	hash_t* auth;           // h nodes: auth path of the next leaf
+	hash_t* keep;           // h/2 nodes
+	hash_t* retain;         // 2^k-k-1 right nodes of the levels h-k..h-2, higher levels first
+	hash_t* stack;          // h+1 nodes shared by the treehash instances
+	uint8_t* stack_levels;
+	uint8_t stack_offset;
+	MT_Treehash* treehash;  // h-k instances
+	unsigned updates;       // treehash updates left for the last path: (h-k)/2
+	uint8_t level;          // treehash instance of the last grow request
+};
+
+
+static uint8_t bds_k(const MT_Config* config){
+	uint8_t k = config->bds_k;
+	if (k < 2 || k > config->height || (config->height - k) % 2 != 0){
+		if (k != 0) LOG_warn("BDS: k=%d needs 2 <= k <= h and h-k even. Fallback to default.", k);
+		k = (config->height % 2 == 0) ? 2 : 3;
+	}
+	return k;
+}
+
+
+static size_t bds_num_nodes(uint8_t height, uint8_t k){
+	return height + height/2 + ((1 << k) - k - 1) + (height+1) + (height-k);
+}
+
+
+// first retained node of level h
+static unsigned retain_offset(uint8_t height, unsigned h){
+	return (1 << (height-1-h)) + h - height;
+}
+
+
+static struct MT_Bds* init_bds(const MT_Config* config){
+	const uint8_t height = config->height;
+	const uint8_t k = bds_k(config);
+	const size_t size_hash = config->cfg_hash.size;
+	struct MT_Bds* bds = malloc(sizeof(struct MT_Bds));
+	if (bds == NULL) return NULL;
+	bds->k = k;
+	bds->auth = malloc(bds_num_nodes(height, k) * size_hash);
+	bds->stack_levels = malloc(height+1);
+	bds->treehash = malloc((height-k+1) * sizeof(MT_Treehash));
+	if (bds->auth == NULL || bds->stack_levels == NULL || bds->treehash == NULL){
+		free(bds->auth);
+		free(bds->stack_levels);
+		free(bds->treehash);
+		free(bds);
+		return NULL;
+	}
+	bds->keep = bds->auth + height*size_hash;
+	bds->retain = bds->keep + (height/2)*size_hash;
+	bds->stack = bds->retain + ((1 << k) - k - 1)*size_hash;
+	hash_t* nodes = bds->stack + (height+1)*size_hash;
+	for (int i = 0; i < height-k; i++){
+		bds->treehash[i].height = i;
+		bds->treehash[i].completed = true;
+		bds->treehash[i].next_idx = 0;
+		bds->treehash[i].stack_usage = 0;
+		bds->treehash[i].node = nodes + i*size_hash;
+	}
+	bds->stack_offset = 0;
+	bds->updates = 0;
+	bds->level = 0;
+	return bds;
+}
+
+
+static void free_bds(struct MT_Bds* bds){
+	if (bds == NULL) return;
+	free(bds->auth);
+	free(bds->stack_levels);
+	free(bds->treehash);
+	free(bds);
+}
+
+
+// keeps the nodes of the first auth path while the tree is built
+static void bds_record(MT_Tree* tree, unsigned h, uint32_t node_idx, const hash_t* node){
+	struct MT_Bds* bds = tree->bds;
+	const uint8_t height = tree->config.height;
+	const size_t size_hash = tree->config.cfg_hash.size;
+
+	if (h == height){
+		memcpy(tree->root, node, size_hash);
+	} else if (node_idx == 1){
+		memcpy(bds->auth + h*size_hash, node, size_hash);
+	} else if (node_idx == 3 && h < height - bds->k){
+		memcpy(bds->treehash[h].node, node, size_hash);
+	} else if (h >= height - bds->k && h <= height - 2 && node_idx >= 3 && node_idx % 2 == 1){
+		memcpy(bds->retain + (retain_offset(height, h) + (node_idx-3)/2)*size_hash, node, size_hash);
+	}
+}
+
+
+// adds the next leaf while the tree is built. The shared stack is free until the first path.
+static void bds_add(MT_Tree* tree, const hash_t* leaf){
+	const size_t size_hash = tree->config.cfg_hash.size;
+	const uint32_t leaf_idx = tree->leaf_idx;
+	hash_t* stack = tree->bds->stack;
+	hash_t node[size_hash];
+	int h = 0;
+
+	memcpy(node, leaf, size_hash);
+	bds_record(tree, 0, leaf_idx, node);
+	for (; (leaf_idx >> h) & 1; h++){
+		hash_two( &(tree->hash), stack + h*size_hash, node, node);
+		bds_record(tree, h+1, leaf_idx >> (h+1), node);
+	}
+	memcpy(stack + h*size_hash, node, size_hash);
+}
+
+
+// updates the auth path from leaf_idx to leaf_idx+1 and restarts the treehash instances below tau
+static void bds_round(MT_Tree* tree, uint32_t leaf_idx, const hash_t* leaf){
+	struct MT_Bds* bds = tree->bds;
+	const uint8_t height = tree->config.height;
+	const size_t size_hash = tree->config.cfg_hash.size;
+	hash_t left[size_hash];
+	hash_t right[size_hash];
+	unsigned tau = height;
+
+	// tau: lowest height at which the path of leaf_idx is a left node
+	for (unsigned h = 0; h < height; h++){
+		if (((leaf_idx >> h) & 1) == 0){
+			tau = h;
+			break;
+		}
+	}
+	if (tau > 0){  // read before keep is refreshed
+		memcpy(left, bds->auth + (tau-1)*size_hash, size_hash);
+		memcpy(right, bds->keep + ((tau-1) >> 1)*size_hash, size_hash);
+	}
+	if (((leaf_idx >> (tau+1)) & 1) == 0 && tau < height-1){
+		memcpy(bds->keep + (tau >> 1)*size_hash, bds->auth + tau*size_hash, size_hash);
+	}
+	if (tau == 0){
+		memcpy(bds->auth, leaf, size_hash);
+		return;
+	}
+
+	hash_two( &(tree->hash), left, right, bds->auth + tau*size_hash);
+	for (unsigned h = 0; h < tau; h++){
+		if (h < height - bds->k){
+			memcpy(bds->auth + h*size_hash, bds->treehash[h].node, size_hash);
+		} else {
+			unsigned row_idx = ((leaf_idx >> h) - 1) >> 1;
+			memcpy(bds->auth + h*size_hash, bds->retain + (retain_offset(height, h) + row_idx)*size_hash, size_hash);
+		}
+	}
+	for (unsigned h = 0; h < tau && h < height - bds->k; h++){
+		uint32_t start_idx = leaf_idx + 1 + 3*(1u << h);
+		if (start_idx < (1u << height)){
+			bds->treehash[h].next_idx = start_idx;
+			bds->treehash[h].completed = false;
+			bds->treehash[h].stack_usage = 0;
+		}
+	}
+}
+
+
+// lowest height of an instance: its node height if not started, its lowest node on the stack otherwise
+static unsigned treehash_low(const MT_Tree* tree, const MT_Treehash* treehash){
+	const struct MT_Bds* bds = tree->bds;
+	unsigned low = tree->config.height;
+	if (treehash->completed) return low;
+	if (treehash->stack_usage == 0) return treehash->height;
+	for (unsigned i = 0; i < treehash->stack_usage; i++){
+		if (bds->stack_levels[bds->stack_offset - i - 1] < low) low = bds->stack_levels[bds->stack_offset - i - 1];
+	}
+	return low;
+}
+
+
+// instance to update next: the one with the lowest node. h-k if all are completed.
+static uint8_t bds_select(const MT_Tree* tree){
+	const struct MT_Bds* bds = tree->bds;
+	unsigned level = tree->config.height - bds->k;
+	unsigned low_min = tree->config.height;
+	for (unsigned i = 0; i < tree->config.height - bds->k; i++){
+		unsigned low = treehash_low(tree, &(bds->treehash[i]));
+		if (low < low_min){
+			level = i;
+			low_min = low;
+		}
+	}
+	return level;
+}
+
+
+// adds the next leaf to a treehash instance
+static void bds_treehash_update(MT_Tree* tree, MT_Treehash* treehash, const hash_t* leaf){
+	struct MT_Bds* bds = tree->bds;
+	const size_t size_hash = tree->config.cfg_hash.size;
+	hash_t node[size_hash];
+	unsigned node_height = 0;
+
+	memcpy(node, leaf, size_hash);
+	while (treehash->stack_usage > 0 && bds->stack_levels[bds->stack_offset-1] == node_height){
+		hash_two( &(tree->hash), bds->stack + (bds->stack_offset-1)*size_hash, node, node);
+		node_height++;
+		treehash->stack_usage--;
+		bds->stack_offset--;
+	}
+	if (node_height == treehash->height){
+		memcpy(treehash->node, node, size_hash);
+		treehash->completed = true;
+	} else {
+		memcpy(bds->stack + bds->stack_offset*size_hash, node, size_hash);
+		treehash->stack_usage++;
+		bds->stack_levels[bds->stack_offset] = node_height;
+		bds->stack_offset++;
+		treehash->next_idx++;
+	}
+}
+
+
 
 
+// replaces an exhausted exist subtree by the grown desire subtree
+void swap_subtrees(MT_Subtree* exist, MT_Subtree* desire){
+	clear_subtree(exist);
+	MT_Subtree swap_tree = *exist;
+	*exist = *desire;
+	*desire = swap_tree;
+}
+
 
 
 
@@ -181,9 +503,8 @@ void gen_subpath(MT_Subtree* subtree, const hash_t* leaf, hash_t* path){
 // ============================================================================
 
 
-// todo: add height as argument
 MT_Tree MT_init(const MT_Config* config, const MT_Fractal_t levels){
-	uint8_t height_top = height_top = config->height / 2;
+	uint8_t height_top = config->height / 2;
 	switch (levels){
 		case MT_FRACTAL_ZERO: 
 			height_top = 0;
@@ -194,21 +515,110 @@ MT_Tree MT_init(const MT_Config* config, const MT_Fractal_t levels){
 		case MT_FRACTAL_HALF:
 			height_top = config->height / 2;
 			break;;
-		default: LOG_warn("Fractal level %d not supported. Fallback to 2.");
+		default:
+			if (levels >= MT_FRACTAL_BOTTOM && levels - MT_FRACTAL_BOTTOM <= config->height){
+				height_top = config->height - (levels - MT_FRACTAL_BOTTOM);
+				break;
+			}
+			LOG_warn("MT_init: Fractal level %d not supported. Fallback to MT_FRACTAL_HALF.", levels);
+	}
+	uint8_t heights[2] = { config->height - height_top, height_top };
+	return MT_init_layers(config, 2, heights);
+}
+
+
+// BDS tree: the top subtree of height 0 holds the root
+static MT_Tree init_bds_tree(const MT_Config* config){
+	MT_Tree tree;
+	tree.config = *config;
+	tree.hash = HASH_ctx_init(config->cfg_hash);
+	tree.leaf_idx = 0;
+	tree.is_full = false;
+	tree.grow_pending = false;
+	tree.top = init_subtree(&tree, 0);
+	tree.exist = init_subtree(&tree, 0);
+	tree.desire = init_subtree(&tree, 0);
+	tree.root = tree.top.root;
+	tree.num_mid = 0;
+	tree.mid = NULL;
+	tree.grow_stream = 0;
+	tree.bds = init_bds(config);
+	if (tree.bds == NULL) LOG_error("Allocation error!");
+	return tree;
+}
+
+
+MT_Tree MT_init_layers(const MT_Config* config, uint8_t num_layers, const uint8_t* heights){
+	uint8_t split[MT_MAX_LAYERS];
+
+	if (config->engine == MT_ENGINE_BDS){
+		if (config->height >= 2) return init_bds_tree(config);
+		LOG_warn("MT_init_layers: BDS needs a height of 2 or more. Fallback to fractal subtrees.");
+	}
+	if (num_layers < 2 || num_layers > MT_MAX_LAYERS){
+		LOG_warn("MT_init_layers: %d layers not supported. Fallback to 2.", num_layers);
+		return MT_init(config, MT_FRACTAL_HALF);
 	}
-	uint8_t height_bottom = config->height - height_top;
+	if (!split_layers(config, num_layers, heights, split)){
+		LOG_warn("MT_init_layers: Layer heights do not sum to %d. Fallback to 2 layers.", config->height);
+		return MT_init(config, MT_FRACTAL_HALF);
+	}
+
 	MT_Tree tree;
 	tree.config = *config;
+	tree.hash = HASH_ctx_init(config->cfg_hash);
 	tree.leaf_idx = 0;
 	tree.is_full = false;
-	tree.top = init_subtree(&tree, height_top);
-	tree.exist = init_subtree(&tree, height_bottom);
-	tree.desire = init_subtree(&tree, height_bottom);
+	tree.grow_pending = false;
+	tree.top = init_subtree(&tree, split[num_layers-1]);
+	tree.exist = init_subtree(&tree, split[0]);
+	tree.desire = init_subtree(&tree, desire_height(config, split[0]));
 	tree.root = tree.top.root;
+
+	tree.grow_stream = 0;
+	tree.bds = NULL;
+	tree.num_mid = num_layers - 2;
+	tree.mid = NULL;
+	if (tree.num_mid > 0){
+		tree.mid = malloc(tree.num_mid * sizeof(MT_Layer));
+		if (tree.mid == NULL) LOG_error("Allocation error!");
+	}
+	uint8_t lower_height = split[0];
+	for (int i = 0; i < tree.num_mid; i++){
+		MT_Layer* layer = &(tree.mid[i]);
+		layer->exist = init_subtree(&tree, split[i+1]);
+		layer->desire = init_subtree(&tree, split[i+1]);
+		layer->lower_height = lower_height;
+		layer->lower_leafs = 0;
+		layer->stack = malloc((lower_height+1) * config->cfg_hash.size);
+		if (layer->stack == NULL) LOG_error("Allocation error!");
+		layer->grow_pending = false;
+		lower_height += split[i+1];
+	}
 	return tree;	
 }
 
 
+int MT_init_leaf_cache(MT_Tree* tree){
+	if (tree->bds != NULL){
+		LOG_warn("MT_init_leaf_cache: Not supported by BDS.");
+		return -1;
+	}
+	const size_t size_hash = tree->config.cfg_hash.size;
+	tree->exist.left_leafs = malloc(num_left_leafs(tree->exist.height) * size_hash);
+	tree->desire.left_leafs = malloc(num_left_leafs(tree->desire.height) * size_hash);
+	if (tree->exist.left_leafs == NULL || tree->desire.left_leafs == NULL){
+		LOG_error("MT_init_leaf_cache: Allocation error!");
+		free(tree->exist.left_leafs);
+		free(tree->desire.left_leafs);
+		tree->exist.left_leafs = NULL;
+		tree->desire.left_leafs = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+
 MT_Path MT_init_path(const MT_Config* config){
     MT_Path path;
     path.cfg_hash = config->cfg_hash;
@@ -224,6 +634,18 @@ void MT_free(MT_Tree* tree){
 	free( tree->exist.root );
 	free( tree->desire.root );
 	free( tree->top.root );
+	free( tree->exist.left_leafs );
+	free( tree->desire.left_leafs );
+	for (int i = 0; i < tree->num_mid; i++){
+		free( tree->mid[i].exist.root );
+		free( tree->mid[i].desire.root );
+		free( tree->mid[i].stack );
+	}
+	free( tree->mid );
+	tree->mid = NULL;
+	tree->num_mid = 0;
+	free_bds( tree->bds );
+	tree->bds = NULL;
 }
 
 
@@ -237,34 +659,14 @@ void MT_free_path(MT_Path* path){
 void MT_add(MT_Tree* tree, const hash_t* leaf){
 	if(tree->is_full == true) return;
 
-	const uint8_t subheight = tree->exist.height;
-
-	// build first bottom tree:
-	if(tree->leaf_idx < (1 << subheight)){
-		add_subtree_leaf( &(tree->exist), leaf);
-
-		// if full, add first top
-		if(tree->exist.is_full){
-			LOG_debug("MT_add: Exist tree is full, h=%d root=%.8s", tree->exist.height, HASH_hexstr(tree->exist.root) );
-			add_subtree_leaf( &(tree->top), tree->exist.root);
-		}
-
-	} else {  // build next desire tree
-
-		add_subtree_leaf( &(tree->desire), leaf);
-
-		// if full, add next top leaf
-		if(tree->desire.is_full){
-			LOG_trace("Desire tree is full, h=%d root=%.8s", tree->desire.height, HASH_hexstr(tree->desire.root) );
-			add_subtree_leaf( &(tree->top), tree->desire.root); 
-			clear_subtree( &(tree->desire) );
-		}
-	}
+	// first bottom tree, then the next desire trees whose roots go to the layers above
+	if (tree->bds != NULL) bds_add(tree, leaf);
+	else build_layer(tree, 0, leaf);
 	tree->leaf_idx += 1;
 
 	// check if tree is now full
 	if(tree->leaf_idx == (1 << tree->config.height)){
-		LOG_debug("MT_add: tree is full, h=%d root=%.8s", tree->config.height, HASH_hexstr(tree->root) );
+		LOG_debug("MT_add: tree is full, h=%d root=%.8s", tree->config.height, HASH_hexstr( tree->root, 4 ) );
 		tree->is_full = true;
 		tree->leaf_idx = 0;
 	}
@@ -278,74 +680,213 @@ void MT_generate_path(MT_Tree* tree, const hash_t* leaf, MT_Path* path){
 
 	const size_t size_hash = tree->config.cfg_hash.size; 
 
-	// check if bottom subtree is exhausted
+	// BDS: the path is ready, prepare the next one
+	if (tree->bds != NULL){
+		memcpy(path->hashes, tree->bds->auth, tree->config.height*size_hash);
+		if (tree->leaf_idx + 1 < (1u << tree->config.height)){
+			bds_round(tree, tree->leaf_idx, leaf);
+			tree->bds->updates = (tree->config.height - tree->bds->k) / 2;
+		}
+		tree->leaf_idx += 1;
+		return;
+	}
+
+	// check if bottom subtree is exhausted, then carry the swap up the layers
 	if (tree->exist.leaf_idx == (1 << tree->exist.height)){
 		LOG_trace("MT_grow_dtree: Exist Exhausted");
-		clear_subtree( &(tree->exist) );
-		MT_Subtree swap_tree = tree->exist;
-		tree->exist = tree->desire;  // swap subtrees
-		tree->desire = swap_tree;
-		tree->top.leaf_idx += 1;
+		swap_subtrees( &(tree->exist), &(tree->desire) );
+		unsigned layer = 1;
+		for (; layer <= tree->num_mid; layer++){
+			MT_Subtree* exist = layer_exist(tree, layer);
+			exist->leaf_idx += 1;
+			if (exist->leaf_idx < (1 << exist->height)) break;
+			swap_subtrees(exist, layer_desire(tree, layer));
+		}
+		if (layer > tree->num_mid) tree->top.leaf_idx += 1;
 	}
 
 	// bottom part
-	gen_subpath( &(tree->exist), leaf, path->hashes);
+	gen_subpath( &(tree->hash), &(tree->exist), leaf, path->hashes);
 	tree->exist.leaf_idx += 1;
 
-	// top part
-	gen_subpath( &(tree->top), tree->exist.root, path->hashes + size_hash*tree->exist.height );
+	// middle and top parts
+	const MT_Subtree* lower = &(tree->exist);
+	size_t offset = tree->exist.height;
+	for (unsigned layer = 1; layer <= tree->num_mid+1; layer++){
+		MT_Subtree* exist = layer_exist(tree, layer);
+		gen_subpath( &(tree->hash), exist, lower->root, path->hashes + size_hash*offset );
+		offset += exist->height;
+		lower = exist;
+	}
 
-	// update leaf index
+	// update leaf index, every layer below the top needs a new leaf
 	tree->leaf_idx += 1;
+	tree->grow_pending = true;
+	for (int i = 0; i < tree->num_mid; i++) tree->mid[i].grow_pending = true;
+}
+
+
+
+const hash_t* MT_get_left_leaf(const MT_Tree* tree){
+	if (tree->bds != NULL) return NULL;
+	const MT_Subtree* subtree = &(tree->exist);
+	uint32_t leaf_idx = tree->exist.leaf_idx;
+	if (leaf_idx == (1 << tree->exist.height)){  // exist is exhausted: next leaf is the first of desire
+		subtree = &(tree->desire);
+		leaf_idx = 0;
+	}
+	if (subtree->left_leafs == NULL || leaf_idx % 2 != 0) return NULL;
+	return subtree->left_leafs + (leaf_idx/2)*tree->config.cfg_hash.size;
 }
 
 
 
 // grow the desire tree
 void MT_grow_dtree(MT_Tree* tree, const hash_t* leaf){
-	LOG_debug("Growing tree. leaf=%.8s, idx=%d", HASH_hexstr(leaf), tree->desire.leaf_idx );
-	add_subtree_leaf( &(tree->desire), leaf);
+	if (tree->bds != NULL){  // leaf of the instance returned by MT_get_grow_leaf_idx()
+		if (tree->bds->updates == 0) return;
+		bds_treehash_update(tree, &(tree->bds->treehash[tree->bds->level]), leaf);
+		tree->bds->updates--;
+		return;
+	}
+
+	if (tree->grow_pending || tree->num_mid == 0){
+		LOG_debug("Growing tree. leaf=%.8s, idx=%d", HASH_hexstr( leaf, 4 ), tree->desire.leaf_idx );
+		add_subtree_leaf( &(tree->hash), &(tree->desire), leaf);
+		tree->grow_pending = false;
+		return;
+	}
+
+	// middle layer: the leaf goes to the treehash of the next desire leaf
+	for (int i = 0; i < tree->num_mid; i++){
+		MT_Layer* layer = &(tree->mid[i]);
+		if (!layer->grow_pending) continue;
+		treehash_add( &(tree->hash), layer->stack, layer->lower_leafs, leaf);
+		layer->lower_leafs += 1;
+		if (layer->lower_leafs == (1u << layer->lower_height)){
+			add_subtree_leaf( &(tree->hash), &(layer->desire), layer->stack + layer->lower_height*tree->config.cfg_hash.size);
+			layer->lower_leafs = 0;
+		}
+		layer->grow_pending = false;
+		return;
+	}
 }
 
 
 
 
-void MT_root_from_path(const MT_Path* path, const hash_t* leaf, const MT_index_t leaf_idx, hash_t* root){
+void MT_root_from_path(const HASH_Ctx* hash, const MT_Path* path, const hash_t* leaf, const MT_index_t leaf_idx, hash_t* root){
 	MT_index_t nodeidx = leaf_idx;
 	const size_t size_hash = path->cfg_hash.size; 
 	memcpy(root, leaf, path->cfg_hash.size);
 
 	for (int h = 0; h < path->height; h++){
 		if(nodeidx % 2 == 0){
-			hash_two(root, path->hashes + h*size_hash, root, size_hash);
+			hash_two(hash, root, path->hashes + h*size_hash, root);
 		} else {
-			hash_two(path->hashes + h*size_hash, root, root, size_hash);
+			hash_two(hash, path->hashes + h*size_hash, root, root);
 		}
 		nodeidx /= 2;
 	}
-	LOG_debug("Root from Path. leaf=%.8s, idx=%d, root=%.8s", HASH_hexstr(leaf), leaf_idx, HASH_hexstr(root) );
+	LOG_debug("Root from Path. leaf=%.8s, idx=%d, root=%.8s", HASH_hexstr( leaf, 4 ), leaf_idx, HASH_hexstr( root, 4 ) );
 }
 
 
 
 MT_index_t MT_get_grow_leaf_idx(MT_Tree* tree){
-	if(tree->top.height > 0){
-		return tree->leaf_idx + (1 << tree->exist.height) - 1;
-	} else {
-		if (tree->leaf_idx % 2 == 0){ // leaf is left
-			return tree->leaf_idx + 1;
-		} else {
+	const uint32_t num_leafs = 1u << tree->config.height;
+	if (tree->bds != NULL){  // up to (h-k)/2 leaves for the treehash instances with the lowest nodes
+		struct MT_Bds* bds = tree->bds;
+		if (bds->updates == 0) return 0;
+		bds->level = bds_select(tree);
+		if (bds->level == tree->config.height - bds->k){
+			bds->updates = 0;
 			return 0;
 		}
+		tree->grow_stream = bds->level;
+		return bds->treehash[bds->level].next_idx;
+	}
+	// the subtree of each layer is grown one leaf per path, 2^h leaves ahead of the last path
+	// with h the height of the layer above the tree leaves. Nothing is grown after the last subtree.
+	uint32_t grow_idx = tree->leaf_idx + (1 << tree->exist.height) - 1;
+	if (tree->grow_pending){
+		tree->grow_stream = 0;
+		if (grow_idx < num_leafs) return grow_idx;
+		tree->grow_pending = false;
 	}
+	for (int i = 0; i < tree->num_mid; i++){
+		MT_Layer* layer = &(tree->mid[i]);
+		if (!layer->grow_pending) continue;
+		grow_idx = tree->leaf_idx + (1u << (layer->lower_height + layer->exist.height)) - 1;
+		tree->grow_stream = i + 1;
+		if (grow_idx < num_leafs) return grow_idx;
+		layer->grow_pending = false;
+	}
+	return 0;
 }
 
 
 
 // todo: use tree pointer
 size_t MT_sizeof_tree(const MT_Config config){
+	if (config.engine == MT_ENGINE_BDS && config.height >= 2){
+		return sizeof(config) + 3 + 3*sizeof(void*) + sizeof(struct MT_Bds) + config.cfg_hash.size * (3 + bds_num_nodes(config.height, bds_k(&config)));
+	}
 	uint8_t topheight = config.height/2;
 	uint8_t botheight = config.height - topheight;
 	return sizeof(config) + 3 + 3*sizeof(void*) + config.cfg_hash.size * (3 + topheight + num_rights(topheight) + 2*num_rights(botheight) + 2*botheight);
 }
 
+
+
+size_t MT_sizeof_alloc(const MT_Tree* tree){
+	const MT_Subtree* subtrees[3] = { &(tree->top), &(tree->exist), &(tree->desire) };
+	size_t num_hashes = 0;
+	for (int i = 0; i < 3; i++) num_hashes += subtree_hashes(subtrees[i]->height);
+	for (int i = 0; i < tree->num_mid; i++){
+		num_hashes += 2*subtree_hashes(tree->mid[i].exist.height) + tree->mid[i].lower_height + 1;
+	}
+	if (tree->bds != NULL) num_hashes += bds_num_nodes(tree->config.height, tree->bds->k);
+	if (tree->exist.left_leafs != NULL) num_hashes += num_left_leafs(tree->exist.height) + num_left_leafs(tree->desire.height);
+	return num_hashes * tree->config.cfg_hash.size;
+}
+
+
+
+size_t MT_sizeof_split(const MT_Config* config, uint8_t num_layers, const uint8_t* heights, bool leaf_cache){
+	uint8_t split[MT_MAX_LAYERS];
+	if (config->engine == MT_ENGINE_BDS && config->height >= 2){   // 3 roots of height 0, no leaf cache
+		return (3 + bds_num_nodes(config->height, bds_k(config))) * config->cfg_hash.size;
+	}
+	if (num_layers < 2 || num_layers > MT_MAX_LAYERS || !split_layers(config, num_layers, heights, split)){
+		num_layers = 2;   // MT_FRACTAL_HALF like MT_init_layers()
+		split[0] = config->height - config->height/2;
+		split[1] = config->height/2;
+	}
+	const uint8_t height_desire = desire_height(config, split[0]);
+	size_t num_hashes = subtree_hashes(split[num_layers-1]) + subtree_hashes(split[0]) + subtree_hashes(height_desire);
+	uint8_t lower_height = split[0];
+	for (int i = 1; i < num_layers-1; i++){
+		num_hashes += 2*subtree_hashes(split[i]) + lower_height + 1;
+		lower_height += split[i];
+	}
+	if (leaf_cache) num_hashes += num_left_leafs(split[0]) + num_left_leafs(height_desire);
+	return num_hashes * config->cfg_hash.size;
+}
+
+
+
+unsigned MT_get_grow_stream(const MT_Tree* tree){
+	return tree->grow_stream;
+}
+
+
+uint8_t MT_bds_k(const MT_Config* config){
+	return bds_k(config);
+}
+
+
+unsigned MT_num_grow_streams(const MT_Tree* tree){
+	if (tree->bds != NULL) return tree->config.height - tree->bds->k;
+	return tree->num_mid + 1;
+}
@@ -36,21 +36,35 @@
 // ============================================================================
 
 typedef void** MT_leafs_t;
-typedef uint16_t MT_index_t;
+typedef uint32_t MT_index_t;
+
+#define MT_MAX_LAYERS 8   // layers of MT_init_layers()
 
 
 typedef enum {
     MT_FRACTAL_ZERO,  // store all right nodes
     MT_FRACTAL_ONE,   // 
     MT_FRACTAL_HALF,
+    MT_FRACTAL_BOTTOM = 0x40,  // plus the height of the bottom subtree, see MT_FRACTAL_BOTTOM_HEIGHT()
 } MT_Fractal_t;
 
+// fractal level with a bottom subtree of height h, 0 <= h <= tree height
+#define MT_FRACTAL_BOTTOM_HEIGHT(h) ((MT_Fractal_t)(MT_FRACTAL_BOTTOM + (h)))
+
+
+
+typedef enum {
+    MT_ENGINE_FRACTAL,  // fractal subtrees, see MT_init() and MT_init_layers()
+    MT_ENGINE_BDS,      // BDS traversal: treehash instances and retained top nodes
+} MT_Engine_t;
 
 
 // this can be compressed to 2 byte
 typedef struct {
     HASH_Config cfg_hash;
     uint8_t height;
+    MT_Engine_t engine;  // signer only, MT_ENGINE_FRACTAL by default
+    uint8_t bds_k;       // MT_ENGINE_BDS: retained top levels with h-k even, 0 picks 2 or 3
 } MT_Config;
 
 
@@ -70,17 +84,35 @@ typedef struct {
     hash_t* root;  // pointer to all hashes
     hash_t* right_nodes;
     hash_t* left_nodes;
+    hash_t* left_leafs;  // optional: hashes of the left leaves, NULL if not cached
 } MT_Subtree;
 
 
+// middle layer of a fractal tree. Its leaves are the roots of the subtrees of the layer below.
+typedef struct {
+    MT_Subtree exist;
+    MT_Subtree desire;
+    uint8_t lower_height;  // height of a desire leaf above the tree leaves
+    uint32_t lower_leafs;  // tree leaves added to the stack for the next desire leaf
+    hash_t* stack;         // treehash stack of the next desire leaf: lower_height+1 nodes
+    bool grow_pending;
+} MT_Layer;
+
+
 typedef struct {
     MT_Config config;
+    HASH_Ctx hash;     // hash backend for config.cfg_hash
     uint32_t leaf_idx;
     bool is_full;
     hash_t* root;
     MT_Subtree top;    // right-nodes top tree
     MT_Subtree exist;  // bottom existing tree
     MT_Subtree desire; // bottom desired tree
+    bool grow_pending; // desire needs a leaf for the last path
+    uint8_t num_mid;   // middle layers between bottom and top, see MT_init_layers()
+    MT_Layer* mid;     // bottom up
+    uint8_t grow_stream;  // of the last MT_get_grow_leaf_idx()
+    struct MT_Bds* bds;   // MT_ENGINE_BDS state, NULL for fractal trees. Top holds the root, exist and desire are unused.
     //hash_t* leafs;     // additional leafs
 } MT_Tree;
 
@@ -96,13 +128,38 @@ typedef struct {
 /**
  * Allocates and initializes a byte array suitable to store all hash values. 
  * \param[in] config struct that specifies height and hash algorithm
- * \param[in] levels specify the number of levels of the bottom subtree.
- *            Determines space requirements of the tree.
+ * \param[in] levels specify the number of levels of the bottom subtree: MT_FRACTAL_HALF or
+ *            MT_FRACTAL_BOTTOM_HEIGHT() for any other split. Determines space requirements of the
+ *            tree (about 2^h_top + 2 * 2^h_bottom nodes) and the leaves to grow. Ignored by MT_ENGINE_BDS.
  * \return pointer to the MT_Tree struct
  */
 MT_Tree MT_init(const MT_Config* config, const MT_Fractal_t levels);
 
 
+/**
+ * Allocates a fractal tree of num_layers layers: the bottom and top subtrees
+ * of MT_init() plus num_layers-2 middle layers. Every layer but the top keeps
+ * an existing and a desired subtree, so memory is about 2 * sum(2^h_i) nodes,
+ * and every path needs one new leaf per layer below the top (see MT_get_grow_leaf_idx()).
+ * \param[in] config struct that specifies height and hash algorithm
+ * \param[in] num_layers number of layers, 2 to MT_MAX_LAYERS
+ * \param[in] heights subtree height of each layer, bottom up, summing to config->height.
+ *            NULL splits the height evenly and gives the remainder to the top.
+ * \return the MT_Tree struct. Falls back to MT_FRACTAL_HALF for invalid layers.
+ */
+MT_Tree MT_init_layers(const MT_Config* config, uint8_t num_layers, const uint8_t* heights);
+
+
+/**
+ * Enables the left leaf cache: the bottom subtrees keep the hashes of their
+ * left leaves, so MT_get_left_leaf() can return them for signing.
+ * Costs 2^(h_bottom-1) * n bytes per bottom subtree. Call before the first MT_add().
+ * \param[in,out] tree pointer to the merkle tree.
+ * \return 0 on success, -1 if the cache could not be allocated
+ */
+int MT_init_leaf_cache(MT_Tree* tree);
+
+
 /**
  * Allocates and initializes a MT_Path struct. 
  * \param[in] config struct that specifies height and hash algorithm
@@ -143,13 +200,44 @@ void MT_generate_path(MT_Tree* tree, const hash_t* leaf, MT_Path* path);
 
 
 /**
- * Returns the leaf index that is needed to grow the tree.
+ * Returns the leaf index that is needed to grow the tree. After each path, call
+ * MT_grow_dtree() with the requested leaf until this returns 0: once for each layer below the top.
  * \param[in,out] tree pointer to the merkle tree.
  * \return index of the leaf. 0 if growing is not necessary.
  */
 MT_index_t MT_get_grow_leaf_idx(MT_Tree* tree);
 
 
+/**
+ * Returns the cached hash of the leaf that is signed next, if it is a left leaf.
+ * \param[in] tree pointer to the merkle tree.
+ * \return pointer to the leaf hash. NULL if the leaf is right or the cache is disabled.
+ */
+const hash_t* MT_get_left_leaf(const MT_Tree* tree);
+
+
+/**
+ * Returns the stream of the leaf of the last MT_get_grow_leaf_idx(). The leaves
+ * of a stream have increasing indices: one stream per fractal layer below the top,
+ * one per BDS treehash instance.
+ * \return stream index < MT_num_grow_streams()
+ */
+unsigned MT_get_grow_stream(const MT_Tree* tree);
+
+
+/**
+ * Returns the number of grow streams of a tree: one per fractal layer below the top,
+ * h-k for BDS.
+ */
+unsigned MT_num_grow_streams(const MT_Tree* tree);
+
+
+/**
+ * Returns the k of MT_ENGINE_BDS for config: bds_k if it is valid, 2 or 3 otherwise.
+ */
+uint8_t MT_bds_k(const MT_Config* config);
+
+
 /**
  * Grows the internal tree structure. This needs to be called in order to generate the next paths.
  * The passed leaf needs to be at the index given by MT_get_grow_leaf_idx()
@@ -162,12 +250,13 @@ void MT_grow_dtree(MT_Tree* tree, const hash_t* leaf);
 
 /**
  * Generates the root hash from an authentication path.
+ * \param[in] hash hash context matching the config of the path.
  * \param[in] path pointer to the authentication path.
  * \param[in] leaf pointer to the hash of the leaf hash.
  * \param[in] leaf_idx index of the leaf.
  * \param[out] root root hash of the Merkle tree.
  */
-void MT_root_from_path(const MT_Path* path, const hash_t* leaf, const MT_index_t leaf_idx, hash_t* root);
+void MT_root_from_path(const HASH_Ctx* hash, const MT_Path* path, const hash_t* leaf, const MT_index_t leaf_idx, hash_t* root);
 
 
 /**
@@ -176,4 +265,21 @@ void MT_root_from_path(const MT_Path* path, const hash_t* leaf, const MT_index_t
  */
 size_t MT_sizeof_tree(const MT_Config config);
 
+
+/**
+ * Determines the hashes allocated by an initialized tree, unlike MT_sizeof_tree() for any
+ * layers, BDS and the leaf cache.
+ * return size of all subtrees, treehash stacks and caches in bytes.
+ */
+size_t MT_sizeof_alloc(const MT_Tree* tree);
+
+
+/**
+ * Determines the hashes that MT_init_layers() would allocate, like MT_sizeof_alloc()
+ * without allocating the tree.
+ * \param[in] leaf_cache include the cache of MT_init_leaf_cache()
+ * return size of all subtrees, treehash stacks and caches in bytes.
+ */
+size_t MT_sizeof_split(const MT_Config* config, uint8_t num_layers, const uint8_t* heights, bool leaf_cache);
+
 #endif
@@ -23,7 +23,7 @@ void hex_bytes(const unsigned char* buf, int len){
     fflush(stdout);
 }
 
-size_t sizeof_wots_sig(const WOTS_Wots* wots){ return wots->num_chains * wots->config.cfg_hash.size; }
+size_t sizeof_wots_sig(const WOTS_Wots* wots){ return WOTS_sig_size( &(wots->config) ); }
 size_t sizeof_tree_aux(const MT_Tree* tree){ return (cli_num_rights(tree->config.height) + tree->config.height) * tree->config.cfg_hash.size; }
 size_t sizeof_tree_auth(const MT_Tree* tree){ return tree->config.height * tree->config.cfg_hash.size; }
 
@@ -45,13 +45,17 @@ void CLI_print_hashname(const HASH_Config config){
 	if (config.algo == HASH_SHA2 ) printf("SHA2_%d", num_bits );
 	if (config.algo == HASH_SHA3 ) printf("SHA3_%d", num_bits );
 	if (config.algo == HASH_BLAKE2B ) printf("BLAKE2B_%d", num_bits );
+	if (config.algo == HASH_BLAKE2B_TW ) printf("BLAKE2B_TW_%d", num_bits );
 	if (config.algo == HASH_SHAKE128 ) printf("SHAKE128_%d", num_bits );
+	if (config.algo == HASH_SHAKE256 ) printf("SHAKE256_%d", num_bits );
 }
 
 void CLI_print_wots_config(const WOTS_Config config){
 	printf("WOTS_");
 	CLI_print_hashname(config.cfg_hash);
 	printf("_W%d", config.code_base);
+	if (config.seed_mode == WOTS_SEED_INDEXED) printf("_INDEXED");
+	if (config.encoding == WOTS_ENC_TARGET_SUM) printf((config.zero_digits || config.target_sum) ? "_WOTSC" : "_TARGET");
 }
 
 
@@ -61,9 +65,9 @@ void CLI_print_merkle(const MT_Tree* tree){
 	const size_t size_hash = tree->config.cfg_hash.size; 
 	int n_rights = cli_num_rights(tree->top.height) + 2*cli_num_rights(tree->exist.height);
 	int n_lefts = tree->top.height + 2*tree->exist.height;
-	size_t total_size = MT_sizeof_tree(tree->config);
+	size_t total_size = MT_sizeof_alloc(tree);
 	printf("\nMerkleTree"); 
-	printf("\n  - height: %d", (tree->top.height + tree->exist.height));
+	printf("\n  - height: %d, layers: %d", tree->config.height, tree->num_mid + 2);
 	printf("\n  - size: %ld byte,  (%d lefts + %d rights + 3 roots) hashes + 3 int", total_size, n_lefts, n_rights);
 	printf("\n  - Root hash: %s ", CLI_hexstr( tree->root ));	
 
@@ -107,7 +111,7 @@ void CLI_print_wots_sig(const WOTS_Wots* wots, const WOTS_chains_t* sig){
 	key_s hashkey = wots->hashkey;
 	hashkey.bytes[0] = 0xFF;
 	CLI_print_wots(wots);
-    for (int i = 0; i < (wots->code_digits+wots->csum_digits); i++) {
+    for (int i = 0; i < wots->num_chains; i++) {
 		hashkey.bytes[0] = i;
         printf("  -chain %2d: Hash: %s\n", i, CLI_hexstr(sig + i*wots->config.cfg_hash.size) );
     	printf("             Hkey: %s\n", CLI_hexstr( (hash_t*)&(hashkey) ) );
@@ -118,8 +122,10 @@ void CLI_print_wots_sig(const WOTS_Wots* wots, const WOTS_chains_t* sig){
 void CLI_print_amss(const AMSA_Amss* amss){
 	int size_pubkey = amss->tree.config.cfg_hash.size + 2 + CFG_HASH_KEY_SIZE;  // root + config + hashkey (16)
 	int size_seckey = sizeof(amss->secret_key) + CFG_HASH_KEY_SIZE;
+	if (amss->key_mode == AMSA_KEYS_GGM) size_seckey = (amss->tree.config.height+1) * CFG_WOTS_SEED_SIZE + CFG_HASH_KEY_SIZE;  // punctured tree
     int size_auth = sizeof_tree_auth( &(amss->tree) );
-	int size_aux = ( MT_sizeof_tree(amss->tree.config) + sizeof_wots_sig( &(amss->wots) ) );
+	int size_aux = ( MT_sizeof_alloc( &(amss->tree) ) + sizeof_wots_sig( &(amss->wots) ) );
+	if (amss->cp_interval > 0) size_aux += (1 << amss->tree.exist.height) * WOTS_checkpoints_size( &(amss->wots), amss->cp_interval );
     int size_wots_sig = sizeof_wots_sig( &(amss->wots) );
     printf("AMSA: sizes: pk=%d B, sk=%d B, sig=(%d+%d)= %d B, aux=%d B\n", size_pubkey, size_seckey, size_wots_sig, size_auth, size_auth+size_wots_sig, size_aux);
 	printf(" +TREE=(n=%dB, h=%d)\n", amss->tree.config.cfg_hash.size, amss->tree.config.height);
@@ -131,7 +137,7 @@ void CLI_print_pubkey(const AMSA_Pubkey* pubkey){
     printf("=== AMSA Public Key ===\n");
     printf("Hash bytes: %d \n", pubkey->config.cfg_wots.cfg_hash.size );
     printf("Tree Height: %d \n", pubkey->config.cfg_tree.height );
-    printf("Public key (hex): %s \n", HASH_hexstr( pubkey->root ) );
+    printf("Public key (hex): %s \n", HASH_hexstr( pubkey->root, pubkey->config.cfg_wots.cfg_hash.size ) );
     printf("=== END Public Key ===\n");
 }
 
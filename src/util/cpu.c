@@ -0,0 +1,18 @@
+#include "cpu.h"
+
+
+bool CPU_has(const CPU_Feature_t feature){
+#if CPU_X86
+    __builtin_cpu_init();  // idempotent, required if called before constructors
+    switch (feature) {
+        case CPU_SSE2:    return __builtin_cpu_supports("sse2");
+        case CPU_SSSE3:   return __builtin_cpu_supports("ssse3");
+        case CPU_SSE41:   return __builtin_cpu_supports("sse4.1");
+        case CPU_AVX2:    return __builtin_cpu_supports("avx2");
+        case CPU_AVX512F: return __builtin_cpu_supports("avx512f");
+        case CPU_SHA:     return __builtin_cpu_supports("sha");
+    }
+#endif
+    (void)feature;
+    return false;
+}
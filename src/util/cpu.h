@@ -0,0 +1,48 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * 
+ * Institution: Technical University of Munich, Germany
+ * Department:  Electrical and Computer Engineering 
+ * Group:       Embedded Systems and Internet of Things
+ * 
+ * Project:     Hash-based Signature
+ * Authors:     Emanuel Regnath (emanuel.regnath@tum.de)
+ *
+ * Description: Runtime detection of CPU features for SIMD backends.
+ *              On non-x86 targets all features are reported as missing,
+ *              so the portable C implementations will be used.
+ * 
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef _CPU_H_
+#define _CPU_H_
+
+#include <stdbool.h>
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_X86 1
+#define CPU_TARGET(x) __attribute__((target(x)))   // compile a single function for an extension
+#else
+#define CPU_X86 0
+#define CPU_TARGET(x)
+#endif
+
+
+typedef enum {
+    CPU_SSE2,
+    CPU_SSSE3,
+    CPU_SSE41,
+    CPU_AVX2,
+    CPU_AVX512F,
+    CPU_SHA,
+} CPU_Feature_t;
+
+
+/**
+ * Checks if the CPU and the OS support an instruction set extension.
+ * \param[in] feature extension to check
+ * \return true if the extension can be used
+ */
+bool CPU_has(const CPU_Feature_t feature);
+
+
+#endif // _CPU_H_
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+
+/*
+ * A job lives on the stack of the thread that called POOL_run(). It stays in
+ * the queue until all of its tasks are handed out.
+ */
+typedef struct POOL_Job {
+    POOL_task_fn task;
+    void* arg;
+    unsigned int num_tasks;
+    unsigned int next_task;   // next idx to hand out
+    unsigned int done_tasks;  // finished tasks
+    pthread_cond_t finished;
+    struct POOL_Job* next;
+} POOL_Job;
+
+
+struct POOL_Pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;      // signals new jobs and shutdown
+    POOL_Job* head;           // jobs with tasks left to hand out
+    POOL_Job* tail;
+    bool stop;
+    unsigned int workers;
+    pthread_t threads[];
+};
+
+
+/*
+ * Takes the next task of the first job. Must hold the lock.
+ * \return job of the task or NULL if the queue is empty
+ */
+static POOL_Job* take_task(POOL_Pool* pool, unsigned int* idx){
+    POOL_Job* job = pool->head;
+    if (job == NULL) return NULL;
+    *idx = job->next_task++;
+    if (job->next_task == job->num_tasks){  // all handed out
+        pool->head = job->next;
+        if (pool->head == NULL) pool->tail = NULL;
+    }
+    return job;
+}
+
+
+static void finish_task(POOL_Job* job){
+    if (++(job->done_tasks) == job->num_tasks) pthread_cond_signal(&(job->finished));
+}
+
+
+static void* worker(void* arg){
+    POOL_Pool* pool = arg;
+    unsigned int idx;
+
+    pthread_mutex_lock(&(pool->lock));
+    while (!pool->stop){
+        POOL_Job* job = take_task(pool, &idx);
+        if (job == NULL){
+            pthread_cond_wait(&(pool->work), &(pool->lock));
+            continue;
+        }
+        pthread_mutex_unlock(&(pool->lock));
+        job->task(job->arg, idx);
+        pthread_mutex_lock(&(pool->lock));
+        finish_task(job);
+    }
+    pthread_mutex_unlock(&(pool->lock));
+    return NULL;
+}
+
+
+POOL_Pool* POOL_create(unsigned int workers){
+    POOL_Pool* pool = malloc(sizeof(POOL_Pool) + workers*sizeof(pthread_t));
+    if (pool == NULL) return NULL;
+    pthread_mutex_init(&(pool->lock), NULL);
+    pthread_cond_init(&(pool->work), NULL);
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->stop = false;
+    pool->workers = 0;
+
+    for (unsigned int i = 0; i < workers; i++){
+        if (pthread_create(&(pool->threads[i]), NULL, worker, pool) != 0){
+            POOL_destroy(pool);
+            return NULL;
+        }
+        pool->workers++;
+    }
+    return pool;
+}
+
+
+unsigned int POOL_workers(const POOL_Pool* pool){
+    return pool->workers;
+}
+
+
+void POOL_run(POOL_Pool* pool, POOL_task_fn task, void* arg, unsigned int num_tasks){
+    POOL_Job job = {task, arg, num_tasks, 0, 0, PTHREAD_COND_INITIALIZER, NULL};
+    unsigned int idx;
+    if (num_tasks == 0) return;
+
+    pthread_mutex_lock(&(pool->lock));
+    if (pool->tail != NULL) pool->tail->next = &job;
+    else pool->head = &job;
+    pool->tail = &job;
+    pthread_cond_broadcast(&(pool->work));
+
+    // help with the own job until all tasks are handed out, then wait for the workers
+    while (job.next_task < job.num_tasks){
+        POOL_Job* taken = take_task(pool, &idx);   // the own job is still queued, so never NULL
+        pthread_mutex_unlock(&(pool->lock));
+        taken->task(taken->arg, idx);
+        pthread_mutex_lock(&(pool->lock));
+        finish_task(taken);
+    }
+    while (job.done_tasks < job.num_tasks) pthread_cond_wait(&(job.finished), &(pool->lock));
+    pthread_mutex_unlock(&(pool->lock));
+    pthread_cond_destroy(&(job.finished));
+}
+
+
+void POOL_destroy(POOL_Pool* pool){
+    pthread_mutex_lock(&(pool->lock));
+    pool->stop = true;
+    pthread_cond_broadcast(&(pool->work));
+    pthread_mutex_unlock(&(pool->lock));
+    for (unsigned int i = 0; i < pool->workers; i++) pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&(pool->lock));
+    pthread_cond_destroy(&(pool->work));
+    free(pool);
+}
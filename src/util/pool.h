@@ -0,0 +1,50 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Institution: Technical University of Munich, Germany
+ * Department:  Electrical and Computer Engineering
+ * Group:       Embedded Systems and Internet of Things
+ *
+ * Project:     Hash-based Signature
+ * Authors:     Emanuel Regnath (emanuel.regnath@tum.de)
+ *
+ * Description: Small pool of worker threads for fork-join parallelism.
+ *              A job is split into tasks that the workers and the calling
+ *              thread process together. Several threads may run jobs on
+ *              the same pool at once.
+ *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+
+typedef struct POOL_Pool POOL_Pool;
+
+/* task function: called once for each idx < num_tasks of a job */
+typedef void (*POOL_task_fn)(void* arg, unsigned int idx);
+
+
+/**
+ * Starts a pool of worker threads.
+ * \param[in] workers number of threads besides the calling ones
+ * \return pool or NULL if threads could not be created
+ */
+POOL_Pool* POOL_create(unsigned int workers);
+
+/**
+ * Returns the number of worker threads of a pool.
+ */
+unsigned int POOL_workers(const POOL_Pool* pool);
+
+/**
+ * Runs task(arg, idx) for all idx < num_tasks and returns when all are done.
+ * The calling thread processes tasks as well.
+ */
+void POOL_run(POOL_Pool* pool, POOL_task_fn task, void* arg, unsigned int num_tasks);
+
+/**
+ * Stops the workers and frees the pool. No job may be running.
+ */
+void POOL_destroy(POOL_Pool* pool);
+
+
+#endif // _POOL_H_
@@ -1,13 +1,16 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "wots.h"
 #include "hash.h"
 #include "util/logger.h"
+#include "util/pool.h"
 
 
 
 #define IDX_HASHKEY_BYTE_CHAIN_IDX 0  // first byte set to chain idx
 #define IDX_HASHKEY_BYTE_HASH_IDX 1   // second byte set to hash idx within chain
+#define IDX_HASHKEY_ENCODE 254        // second byte of the message key, whose first byte is 255 like the seed key
 
 
 // ============================================================================
@@ -16,6 +19,9 @@
 
 const WOTS_Config WOTS_SHA2_256_W4      = {{HASH_SHA2, 32},   4};
 const WOTS_Config WOTS_SHA2_256_W16     = {{HASH_SHA2, 32},  16};
+const WOTS_Config WOTS_SHA2_256_W32     = {{HASH_SHA2, 32},  32};
+const WOTS_Config WOTS_SHA2_256_W64     = {{HASH_SHA2, 32},  64};
+const WOTS_Config WOTS_SHA2_256_W128    = {{HASH_SHA2, 32}, 128};
 const WOTS_Config WOTS_SHA2_256_W256    = {{HASH_SHA2, 32}, 256};
 
 const WOTS_Config WOTS_BLAKE2B_128_W4   = {{HASH_BLAKE2B, 16},   4};
@@ -26,6 +32,8 @@ const WOTS_Config WOTS_BLAKE2B_160_W4   = {{HASH_BLAKE2B, 20},   4};
 const WOTS_Config WOTS_BLAKE2B_160_W16  = {{HASH_BLAKE2B, 20},  16};
 const WOTS_Config WOTS_BLAKE2B_160_W32  = {{HASH_BLAKE2B, 20},  32};
 const WOTS_Config WOTS_BLAKE2B_160_W256 = {{HASH_BLAKE2B, 20}, 256};
+const WOTS_Config WOTS_BLAKE2B_160_W64  = {{HASH_BLAKE2B, 20},  64};
+const WOTS_Config WOTS_BLAKE2B_160_W128 = {{HASH_BLAKE2B, 20}, 128};
 
 // const WOTS_Config WOTS_BLAKE2B_192_W4   = {{HASH_BLAKE2B, 24},   4};
 // const WOTS_Config WOTS_BLAKE2B_192_W16  = {{HASH_BLAKE2B, 24},  16};
@@ -35,21 +43,53 @@ const WOTS_Config WOTS_BLAKE2B_256_W4   = {{HASH_BLAKE2B, 32}, 4};
 const WOTS_Config WOTS_BLAKE2B_256_W16  = {{HASH_BLAKE2B, 32}, 16};
 const WOTS_Config WOTS_BLAKE2B_256_W256 = {{HASH_BLAKE2B, 32}, 256};
 
+const WOTS_Config WOTS_BLAKE2B_TW_160_W16 = {{HASH_BLAKE2B_TW, 20}, 16};
+const WOTS_Config WOTS_BLAKE2B_TW_256_W16 = {{HASH_BLAKE2B_TW, 32}, 16};
 
+const WOTS_Config WOTS_SHA2_256_W16_INDEXED       = {{HASH_SHA2, 32},       16, WOTS_SEED_INDEXED};
+const WOTS_Config WOTS_BLAKE2B_TW_160_W16_INDEXED = {{HASH_BLAKE2B_TW, 20}, 16, WOTS_SEED_INDEXED};
 
-// LUT for equation $ sqrt( ( 8n ) / ( log_2(w) ) * (w-1) ) $
-const unsigned csum_base(unsigned int n, unsigned int w){
-    if (n == 16 && w ==   4){ return 14; }
-    if (n == 16 && w ==  16){ return 22; }
-    if (n == 16 && w == 256){ return 64; }
-    if (n == 20 && w ==   4){ return 16; }
-    if (n == 20 && w ==  16){ return 25; }
-    if (n == 20 && w ==  32){ return 32; }
-    if (n == 20 && w == 256){ return 72; }
-    if (n == 32 && w ==   4){ return 20; }
-    if (n == 32 && w ==  16){ return 31; }
-    if (n == 32 && w == 256){ return 91; }
-    return -1;
+const WOTS_Config WOTS_SHA2_256_W16_TARGET    = {{HASH_SHA2, 32},    16, WOTS_SEED_CHAINED, WOTS_ENC_TARGET_SUM};
+const WOTS_Config WOTS_BLAKE2B_160_W16_TARGET = {{HASH_BLAKE2B, 20}, 16, WOTS_SEED_CHAINED, WOTS_ENC_TARGET_SUM};
+
+// one zero digit, target one standard deviation above the mean: about 2800 and 1300 digests per signature
+const WOTS_Config WOTS_SHA2_256_W16_WOTSC    = {{HASH_SHA2, 32},    16, WOTS_SEED_CHAINED, WOTS_ENC_TARGET_SUM, 1, 510};  // verify 435 instead of 480 steps
+const WOTS_Config WOTS_BLAKE2B_160_W16_WOTSC = {{HASH_BLAKE2B, 20}, 16, WOTS_SEED_CHAINED, WOTS_ENC_TARGET_SUM, 1, 320};  // verify 265 instead of 300 steps
+
+
+
+#define WOTS_STREAM_LANE_CHAINS 2  // chains per hash lane that are computed before they are absorbed into the public key
+
+
+int log2pow2(int x){
+    int ret = 0;
+    while(x > 1){
+        x = x >> 1;
+        ret++;
+    }
+    return ret;
+}
+
+
+/**
+ * Number of message digits: ceil(8n / log2(w)). The last digit is padded with
+ * zero bits if log2(w) does not divide 8n.
+ */
+static unsigned code_digits(unsigned int n, unsigned int w){
+    const unsigned log_w = log2pow2(w);
+    return (8*n + log_w - 1) / log_w;
+}
+
+
+/**
+ * Base of the two MinWOTS checksum digits: the smallest b with b^2 > l1*(w-1),
+ * i.e. ceil( sqrt( l1*(w-1) + 1 ) ), so two digits encode every checksum.
+ */
+static unsigned csum_base(unsigned int n, unsigned int w){
+    const unsigned max_csum = code_digits(n, w) * (w - 1);
+    unsigned base = 1;
+    while (base*base <= max_csum) base++;
+    return base;
 }
 
 
@@ -68,26 +108,84 @@ void update_hashkey(key_s* hashkey, uint8_t idx_chain){
 }
 
 
+#define SEED_INDEXED_INPUT (CFG_WOTS_SEED_SIZE + 2)  // seed || 16 bit chain index
+
+static void seed_indexed_input(const WOTS_Wots* wots, unsigned idx, byte_t input[SEED_INDEXED_INPUT]){
+    memcpy(input, wots->seed, CFG_WOTS_SEED_SIZE);
+    input[CFG_WOTS_SEED_SIZE] = (byte_t)(idx >> 8);
+    input[CFG_WOTS_SEED_SIZE + 1] = (byte_t)idx;
+}
+
+
 /**
- * Helper method for pseudorandom key generation.
- * Expands the n-byte wots-seed into a len*n byte chain seeds.
+ * WOTS_SEED_INDEXED: chain seed i = H_k(seed || i) with the seed key k.
+ * All seeds are independent and hashed in one batch.
  */
-static void expand_seed(const WOTS_Wots* wots, hash_t* chains)
+static void expand_seed_indexed(const WOTS_Wots* wots, hash_t* chains, const key_s* seedkey, int first_chain, int end_chain)
 {
-    update_hashkey( (key_s*) &(wots->hashkey), 255); // reset hashkey
-    int num_chains = wots->code_digits+wots->csum_digits;
-    HASH_keyhash(chains, wots->seed, CFG_WOTS_SEED_SIZE, &(wots->hashkey) );  // first seed
-    hash_t preimage[CFG_WOTS_SEED_SIZE];
+    const int num = end_chain - first_chain;
+    byte_t inputs[num][SEED_INDEXED_INPUT];
+    const byte_t* inptrs[num];
+    hash_t* outptrs[num];
+    const key_s* keyptrs[num];
+
+    for (int i = 0; i < num; i++) {
+        seed_indexed_input(wots, first_chain + i, inputs[i]);
+        inptrs[i] = inputs[i];
+        outptrs[i] = chains + i*wots->config.cfg_hash.size;
+        keyptrs[i] = seedkey;
+    }
+    HASH_keyhash_xN( &(wots->hash), outptrs, inptrs, SEED_INDEXED_INPUT, keyptrs, num);
+}
+
 
+void WOTS_chain_seed(const WOTS_Wots* wots, unsigned idx, hash_t* out){
+    key_s seedkey = wots->hashkey;
+    byte_t input[SEED_INDEXED_INPUT];
 
-    for (int i = 1; i < num_chains; i++) {
+    if (wots->config.seed_mode != WOTS_SEED_INDEXED) LOG_error("WOTS_chain_seed: only available in WOTS_SEED_INDEXED mode.");
+    update_hashkey( &seedkey, 255);
+    seed_indexed_input(wots, idx, input);
+    HASH_Phase_t phase = HASH_set_phase(HASH_PHASE_SEED);
+    HASH_keyhash( &(wots->hash), out, input, SEED_INDEXED_INPUT, &seedkey);
+    HASH_set_phase(phase);
+}
+
+
+/**
+ * Helper method for pseudorandom key generation.
+ * Expands the n-byte wots-seed into the n-byte seeds of the chains
+ * first_chain <= i < end_chain. chains points to the seed of first_chain.
+ * WOTS_SEED_CHAINED continues from prev_seed, the seed of first_chain-1 (NULL for chain 0).
+ */
+static void expand_seed(const WOTS_Wots* wots, hash_t* chains, const hash_t* prev_seed, int first_chain, int end_chain)
+{
+    const size_t size_hash = wots->config.cfg_hash.size;
+    key_s seedkey = wots->hashkey;
+    update_hashkey( &seedkey, 255);
+    HASH_Phase_t phase = HASH_set_phase(HASH_PHASE_SEED);
+    if (wots->config.seed_mode == WOTS_SEED_INDEXED) {
+        expand_seed_indexed(wots, chains, &seedkey, first_chain, end_chain);
+        HASH_set_phase(phase);
+        return;
+    }
+    hash_t preimage[size_hash];
+
+    for (int i = first_chain; i < end_chain; i++) {
+        hash_t* chain_seed = chains + (i-first_chain)*size_hash;
+        if (i == 0) {
+            HASH_keyhash(&(wots->hash), chain_seed, wots->seed, CFG_WOTS_SEED_SIZE, &seedkey );  // first seed
+            continue;
+        }
         // 1. XOR previous seed with initial wots-seed
-        for (int j = 0; j < wots->config.cfg_hash.size; j++){
-            preimage[j] = chains[(i-1)*wots->config.cfg_hash.size + j] ^ wots->seed[j];
+        const hash_t* prev = (i == first_chain) ? prev_seed : chain_seed - size_hash;
+        for (int j = 0; j < size_hash; j++){
+            preimage[j] = prev[j] ^ ((j < CFG_WOTS_SEED_SIZE) ? wots->seed[j] : 0);   // n may exceed the seed, e.g. SHAKE-256
         }
         // 2. rehash
-        HASH_keyhash(chains+(i*wots->config.cfg_hash.size), (const hash_t*)&preimage, wots->config.cfg_hash.size, &(wots->hashkey));
+        HASH_keyhash(&(wots->hash), chain_seed, (const hash_t*)&preimage, size_hash, &seedkey);
     }
+    HASH_set_phase(phase);
 }
 
 /**
@@ -97,7 +195,7 @@ static void expand_seed(const WOTS_Wots* wots, hash_t* chains)
  * Interprets in as start-th value of the chain.
  * addr has to contain the address of the chain.
  */
-static void gen_chain(hash_t* out, const hash_t* in, const key_s* hashkey, const size_t hash_bytes,
+static void gen_chain(const HASH_Ctx* hash, hash_t* out, const hash_t* in, const key_s* hashkey, const size_t hash_bytes,
                       unsigned int start, unsigned int steps)
 {
     /* Initialize out with the value at position 'start'. */
@@ -109,63 +207,285 @@ static void gen_chain(hash_t* out, const hash_t* in, const key_s* hashkey, const
     for (int i = start; i < (start+steps); i++) {
         copykey.bytes[IDX_HASHKEY_BYTE_HASH_IDX] = i;
         //hashkey->bytes[IDX_HASHKEY_BYTE_HASH_IDX] = i;
-        HASH_keyhash(out, out, hash_bytes, &copykey);
+        HASH_keyhash(hash, out, out, hash_bytes, &copykey);
+    }
+}
+
+
+/**
+ * Runs the chains like gen_chains(), but advances independent chains in parallel
+ * lanes of HASH_keyhash_xN(). The chains are queued longest first and a lane
+ * takes the next chain from the queue as soon as its chain is finished, so the
+ * uneven lengths of sign and verify keep the lanes busy until the queue is empty.
+ */
+static void gen_chains_xN(hash_t* chains_out, const WOTS_Wots* wots, const int* starts, const int* stops, int first_chain, int end_chain){
+    const size_t size_hash = wots->config.cfg_hash.size;
+    const unsigned lanes = HASH_lanes( &(wots->hash) );
+    int queue[wots->num_chains];
+    int first[wots->num_chains];
+    int steps[wots->num_chains];
+    unsigned num_queued = 0;
+
+    // steps per chain, queue sorted by descending length (insertion sort, few chains)
+    for (int i = first_chain; i < end_chain; i++) {
+        int val_base = (i < wots->code_digits) ? wots->config.code_base : wots->csum_base;
+        first[i] = (starts == NULL) ? 0 : starts[i];
+        steps[i] = (stops != NULL) ? stops[i] - first[i] : val_base - 1 - first[i];
+        if (steps[i] <= 0) continue;
+        int pos = num_queued++;
+        while (pos > 0 && steps[queue[pos-1]] < steps[i]) { queue[pos] = queue[pos-1]; pos--; }
+        queue[pos] = i;
+    }
+
+    // lanes: chain pointer, key with chain and step index, remaining steps
+    hash_t* lane_chain[lanes];
+    key_s lane_key[lanes];
+    const key_s* lane_keyptr[lanes];
+    int lane_left[lanes];
+    unsigned active = 0;
+    unsigned next = 0;
+
+    for (unsigned l = 0; l < lanes; l++) lane_keyptr[l] = &lane_key[l];
+    while (active < lanes && next < num_queued) {
+        int i = queue[next++];
+        lane_chain[active] = chains_out + (i-first_chain)*size_hash;
+        lane_key[active] = wots->hashkey;
+        update_hashkey( &lane_key[active], i);
+        lane_key[active].bytes[IDX_HASHKEY_BYTE_HASH_IDX] = first[i];
+        lane_left[active] = steps[i];
+        active++;
+    }
+
+    while (active > 0) {
+        HASH_keyhash_xN( &(wots->hash), lane_chain, (const byte_t* const*)lane_chain, size_hash, lane_keyptr, active);
+        for (unsigned l = 0; l < active; l++) {
+            lane_key[l].bytes[IDX_HASHKEY_BYTE_HASH_IDX]++;
+            lane_left[l]--;
+        }
+
+        // refill finished lanes, or close the gap with the last lane once the queue is empty
+        for (unsigned l = 0; l < active; ) {
+            if (lane_left[l] > 0) { l++; continue; }
+            if (next < num_queued) {
+                int i = queue[next++];
+                lane_chain[l] = chains_out + (i-first_chain)*size_hash;
+                lane_key[l] = wots->hashkey;
+                update_hashkey( &lane_key[l], i);
+                lane_key[l].bytes[IDX_HASHKEY_BYTE_HASH_IDX] = first[i];
+                lane_left[l] = steps[i];
+                l++;
+            } else {
+                active--;
+                lane_chain[l] = lane_chain[active];
+                lane_key[l] = lane_key[active];
+                lane_left[l] = lane_left[active];
+            }
+        }
     }
 }
 
 
-static void gen_chains(hash_t* chains_out, const WOTS_Wots* wots, int* starts, int* stops){
+/**
+ * Runs the chains first_chain <= i < end_chain from 0 to end (starts and stops NULL),
+ * from 0 to stops[i], from starts[i] to end or from starts[i] to stops[i].
+ * chains_out points to chain first_chain.
+ */
+static void gen_chains_range(hash_t* chains_out, const WOTS_Wots* wots, const int* starts, const int* stops, int first_chain, int end_chain){
     int val_base = wots->config.code_base;
-    for (int i = 0; i < wots->num_chains; i++) {
-        update_hashkey( (key_s*) &(wots->hashkey), i);
+    key_s chainkey = wots->hashkey;
+    HASH_Phase_t phase = HASH_set_phase(HASH_PHASE_CHAIN);
+    if (HASH_lanes( &(wots->hash) ) > 1) {
+        gen_chains_xN(chains_out, wots, starts, stops, first_chain, end_chain);
+        HASH_set_phase(phase);
+        return;
+    }
+    for (int i = first_chain; i < end_chain; i++) {
+        hash_t* chain = chains_out + (i-first_chain)*wots->config.cfg_hash.size;
+        update_hashkey( &chainkey, i);
         if(i >= wots->code_digits) val_base = wots->csum_base;
         if (starts == NULL){
             if (stops == NULL){  // run from 0 to end
-                gen_chain( chains_out+i*wots->config.cfg_hash.size, chains_out+i*wots->config.cfg_hash.size, &(wots->hashkey), wots->config.cfg_hash.size, 0, val_base-1);
+                gen_chain( &(wots->hash), chain, chain, &chainkey, wots->config.cfg_hash.size, 0, val_base-1);
             } else {  // run from 0 to stops
-                gen_chain( chains_out+i*wots->config.cfg_hash.size, chains_out+i*wots->config.cfg_hash.size, &(wots->hashkey), wots->config.cfg_hash.size, 0, stops[i]);
+                gen_chain( &(wots->hash), chain, chain, &chainkey, wots->config.cfg_hash.size, 0, stops[i]);
             }
-        } else {  // run from start to end
-            gen_chain( chains_out+i*wots->config.cfg_hash.size, chains_out+i*wots->config.cfg_hash.size, &(wots->hashkey), wots->config.cfg_hash.size, starts[i], val_base - 1 - starts[i]);
+        } else if (stops == NULL) {  // run from start to end
+            gen_chain( &(wots->hash), chain, chain, &chainkey, wots->config.cfg_hash.size, starts[i], val_base - 1 - starts[i]);
+        } else {  // run from start to stop
+            gen_chain( &(wots->hash), chain, chain, &chainkey, wots->config.cfg_hash.size, starts[i], stops[i] - starts[i]);
         }
     }    
+    HASH_set_phase(phase);
 }
 
 
+static void gen_chains(hash_t* chains_out, const WOTS_Wots* wots, const int* starts, const int* stops){
+    gen_chains_range(chains_out, wots, starts, stops, 0, wots->num_chains);
+}
 
-int log2pow2(int x){
-    int ret = 0;
-    while(x > 1){
-        x = x >> 1;
-        ret++;
+
+// ============================================================================
+// Chain checkpoints
+// ============================================================================
+
+/* Checkpoints of chain i: the values at 0, interval, 2*interval, ... <= w-2 (a start below the end) */
+static unsigned chain_checkpoints(const WOTS_Wots* wots, int i, unsigned interval){
+    const unsigned val_base = (i < wots->code_digits) ? wots->config.code_base : wots->csum_base;
+    return (val_base - 2) / interval + 1;
+}
+
+
+/* Index of the first checkpoint of chain i. The checkpoints are stored chain by chain. */
+static size_t checkpoint_offset(const WOTS_Wots* wots, int i, unsigned interval){
+    if (i <= wots->code_digits) return i*chain_checkpoints(wots, 0, interval);
+    return wots->code_digits*chain_checkpoints(wots, 0, interval) + (i - wots->code_digits)*chain_checkpoints(wots, wots->code_digits, interval);
+}
+
+
+/**
+ * Runs the chains first_chain <= i < end_chain from their seeds to the end in
+ * segments of interval steps and stores the value at the start of every
+ * segment in checkpoints.
+ */
+static void gen_chains_checkpoints(hash_t* chains, const WOTS_Wots* wots, int first_chain, int end_chain, unsigned interval, hash_t* checkpoints){
+    const size_t size_hash = wots->config.cfg_hash.size;
+    int starts[wots->num_chains];
+    int stops[wots->num_chains];
+
+    for (unsigned pos = 0; ; pos += interval) {
+        bool more = false;
+        for (int i = first_chain; i < end_chain; i++) {
+            const int end = ((i < wots->code_digits) ? wots->config.code_base : wots->csum_base) - 1;
+            if (pos < end) memcpy(checkpoints + (checkpoint_offset(wots, i, interval) + pos/interval)*size_hash, chains + (i-first_chain)*size_hash, size_hash);
+            starts[i] = (pos < end) ? pos : end;
+            stops[i] = (pos + interval < end) ? pos + interval : end;
+            more |= (starts[i] < stops[i]);
+        }
+        if (!more) break;
+        gen_chains_range(chains, wots, starts, stops, first_chain, end_chain);
     }
-    return ret;
 }
 
 
+
 /**
- * base_w algorithm as described in draft.
- * Interprets an array of bytes as integers in base w.
- * This only works when log_w is a divisor of 8.
+ * Computes the public key block by block: a block of WOTS_STREAM_LANE_CHAINS
+ * chains per hash lane is run to the end and absorbed into the keyed public key
+ * hash right away, so only one block is buffered instead of all chains.
+ * Key generation (sig NULL) starts the chains at their seeds and fills the
+ * checkpoints if given, verification starts at the signature values with starts.
+ */
+static void stream_pubkey(const WOTS_Wots* wots, const WOTS_chains_t* sig, const int* starts, hash_t* root_out,
+                          unsigned interval, hash_t* checkpoints){
+    const size_t size_hash = wots->config.cfg_hash.size;
+    const int block_chains = HASH_lanes( &(wots->hash) ) * WOTS_STREAM_LANE_CHAINS;
+    hash_t block[block_chains*size_hash];
+    hash_t prev_seed[size_hash];   // chained seeds continue from the last seed of the previous block
+    HASH_Stream pk;
+    HASH_Phase_t phase;
+
+    HASH_keyhash_init( &(wots->hash), &pk, &(wots->hashkey) );
+    for (int first = 0; first < wots->num_chains; first += block_chains) {
+        const int end = (first + block_chains < wots->num_chains) ? first + block_chains : wots->num_chains;
+        if (sig == NULL) {
+            expand_seed(wots, block, prev_seed, first, end);
+            memcpy(prev_seed, block + (end-1-first)*size_hash, size_hash);
+        } else {
+            memcpy(block, sig + first*size_hash, (end-first)*size_hash);
+        }
+        if (checkpoints != NULL) gen_chains_checkpoints(block, wots, first, end, interval, checkpoints);
+        else gen_chains_range(block, wots, starts, NULL, first, end);
+        phase = HASH_set_phase(HASH_PHASE_WOTS_PK);
+        HASH_keyhash_update( &pk, block, (end-first)*size_hash);
+        HASH_set_phase(phase);
+    }
+    phase = HASH_set_phase(HASH_PHASE_WOTS_PK);
+    HASH_keyhash_final( &pk, root_out);   // same as hashing all chains together
+    HASH_set_phase(phase);
+}
+
+
+
+// ============================================================================
+// Parallel verification
+// ============================================================================
+
+typedef struct {
+    hash_t* chains;
+    const WOTS_Wots* wots;
+    const int* starts;
+    const int* bounds;  // task t runs the chains bounds[t] <= i < bounds[t+1]
+} Verify_Task_s;
+
+
+static void verify_task(void* arg, unsigned int idx){
+    const Verify_Task_s* task = arg;
+    gen_chains_range(task->chains + task->bounds[idx]*task->wots->config.cfg_hash.size, task->wots, task->starts, NULL, task->bounds[idx], task->bounds[idx+1]);
+}
+
+
+/**
+ * Runs the chains from starts to end like gen_chains(), split into contiguous
+ * ranges of about equal steps for the verify pool and the calling thread.
+ * The bounds are rounded to multiples of the lanes of the hash, so every range
+ * but the last fills whole batches and keeps at least one batch of chains.
+ */
+static void gen_chains_parallel(hash_t* chains_out, const WOTS_Wots* wots, const int* starts, unsigned total_steps){
+    const int lanes = HASH_lanes( &(wots->hash) );
+    unsigned num_tasks = POOL_workers(wots->verify_pool) + 1;
+    const unsigned max_tasks = wots->num_chains / lanes;
+    if (num_tasks > max_tasks) num_tasks = max_tasks;
+    if (num_tasks <= 1) {
+        gen_chains(chains_out, wots, starts, NULL);
+        return;
+    }
+    int bounds[num_tasks + 1];
+    unsigned steps = 0;
+    unsigned t = 1;
+
+    bounds[0] = 0;
+    for (int i = 0; i < wots->num_chains && t < num_tasks; i++) {
+        int val_base = (i < wots->code_digits) ? wots->config.code_base : wots->csum_base;
+        steps += val_base - 1 - starts[i];
+        while (t < num_tasks && steps * num_tasks >= t * total_steps) {
+            const int min_bound = bounds[t-1] + lanes;                            // one batch for this range
+            const int max_bound = (max_tasks - (num_tasks - t)) * lanes;         // one batch for each later range
+            int bound = (i + 1 + lanes/2) / lanes * lanes;
+            if (bound < min_bound) bound = min_bound;
+            if (bound > max_bound) bound = max_bound;
+            bounds[t++] = bound;
+        }
+    }
+    bounds[num_tasks] = wots->num_chains;
+
+    Verify_Task_s task = {chains_out, wots, starts, bounds};
+    POOL_run(wots->verify_pool, verify_task, &task, num_tasks);
+}
+
+
+
+
+/**
+ * Interprets an array of n bytes as a bit stream (MSB first) of code_digits
+ * digits with log2(w) bits each. Works for every power of two w <= 256; if
+ * log2(w) does not divide 8n, the last digit is padded with zero bits.
  */
 static void base_w(const WOTS_Wots* wots, const unsigned char *input, int *output)
 {
-    int in = 0;
-    int out = 0;
-    unsigned char total;
+    const int code_bits = log2pow2(wots->config.code_base);
+    const int size_hash = wots->config.cfg_hash.size;
+    uint32_t buffer = 0;
     int bits = 0;
-    int code_bits = log2pow2(wots->config.code_base);
-    int consumed;
+    int in = 0;
 
-   for (consumed = 0; consumed < wots->code_digits; consumed++) {
-        if (bits == 0) {
-            total = input[in];
+    for (int out = 0; out < wots->code_digits; out++) {
+        while (bits < code_bits) {
+            buffer = (buffer << 8) | ((in < size_hash) ? input[in] : 0);
             in++;
             bits += 8;
         }
         bits -= code_bits;
-        output[out] = (total >> bits) & (wots->config.code_base - 1);
-        out++;
+        output[out] = (buffer >> bits) & (wots->config.code_base - 1);
     }
 }
 
@@ -218,20 +538,178 @@ static void chain_lengths(const WOTS_Wots* wots, int *lengths, const hash_t* msg
 }
 
 
+#define ENCODE_INPUT(n) ((n) + WOTS_COUNTER_SIZE)  // msg || 32 bit counter
 
+/**
+ * WOTS_ENC_TARGET_SUM: computes the digests H_k(msg || counter+i), i < num, with
+ * the message key k in one batch.
+ */
+static void encode_digests(const WOTS_Wots* wots, const hash_t* msg, uint32_t counter, unsigned num, hash_t* digests)
+{
+    const size_t size_hash = wots->config.cfg_hash.size;
+    byte_t inputs[num][ENCODE_INPUT(size_hash)];
+    const byte_t* inptrs[num];
+    hash_t* outptrs[num];
+    const key_s* keyptrs[num];
+    key_s msgkey = wots->hashkey;
+
+    update_hashkey( &msgkey, 255);
+    msgkey.bytes[IDX_HASHKEY_BYTE_HASH_IDX] = IDX_HASHKEY_ENCODE;
+    for (unsigned i = 0; i < num; i++) {
+        const uint32_t ctr = counter + i;
+        memcpy(inputs[i], msg, size_hash);
+        inputs[i][size_hash]     = (byte_t)(ctr >> 24);
+        inputs[i][size_hash + 1] = (byte_t)(ctr >> 16);
+        inputs[i][size_hash + 2] = (byte_t)(ctr >> 8);
+        inputs[i][size_hash + 3] = (byte_t)ctr;
+        inptrs[i] = inputs[i];
+        outptrs[i] = digests + i*size_hash;
+        keyptrs[i] = &msgkey;
+    }
+    HASH_Phase_t phase = HASH_set_phase(HASH_PHASE_ENCODE);
+    HASH_keyhash_xN( &(wots->hash), outptrs, inptrs, ENCODE_INPUT(size_hash), keyptrs, num);
+    HASH_set_phase(phase);
+}
 
 
+/**
+ * WOTS_ENC_TARGET_SUM: the digits of the chains sum up to target_sum and the
+ * remaining zero_digits digits (without chains) are zero.
+ */
+static bool meets_target(const WOTS_Wots* wots, const int* digits){
+    int sum = 0;
+    for (int i = 0; i < wots->num_chains; i++) sum += digits[i];
+    for (int i = wots->num_chains; i < wots->code_digits; i++) {
+        if (digits[i] != 0) return false;
+    }
+    return sum == wots->target_sum;
+}
 
 
-WOTS_Wots WOTS_init(const WOTS_Config* config){
+/**
+ * WOTS_ENC_TARGET_SUM: searches the smallest counter whose digest digits meet
+ * the target. Tries one counter per hash lane at once, so the counter does
+ * not depend on the backend. Stops after counter UINT32_MAX.
+ * \return 0 and the counter in counter_out, lengths (code_digits entries) holds
+ *         the digits of its digest; -1 if no counter meets the target
+ */
+static int target_sum_lengths(const WOTS_Wots* wots, int* lengths, const hash_t* msg, uint32_t* counter_out)
+{
+    const unsigned lanes = HASH_lanes( &(wots->hash) );
+    hash_t digests[lanes*wots->config.cfg_hash.size];
+
+    for (uint64_t counter = 0; counter <= UINT32_MAX; counter += lanes) {
+        const unsigned num = (UINT32_MAX - counter + 1 < lanes) ? (unsigned)(UINT32_MAX - counter + 1) : lanes;
+        encode_digests(wots, msg, (uint32_t)counter, num, digests);
+        for (unsigned l = 0; l < num; l++) {
+            base_w(wots, digests + l*wots->config.cfg_hash.size, lengths);
+            if (meets_target(wots, lengths)) {
+                *counter_out = (uint32_t)counter + l;
+                LOG_trace("target sum %d: counter=%u", wots->target_sum, *counter_out);
+                return 0;
+            }
+        }
+    }
+    LOG_error("WOTS_sign: no counter meets the target sum %d.", wots->target_sum);
+    return -1;
+}
+
+
+
+
+
+
+
+/**
+ * WOTS_ENC_TARGET_SUM: probability that the digits of a random digest meet the
+ * target, so 1/p counters are tried per signature on average. Sums the digit
+ * distributions up to target_sum; a padded last digit takes fewer values.
+ * \return probability, 0 if no digest meets the target or on allocation error
+ */
+static double target_sum_probability(const WOTS_Wots* wots){
+    const unsigned log_w = log2pow2(wots->config.code_base);
+    const unsigned bits = 8*wots->config.cfg_hash.size;
+    const unsigned target = wots->target_sum;
+    double* prob = (double*) calloc(target + 1, sizeof(double));   // prob[s]: the digits so far sum up to s
+    double* next = (double*) malloc((target + 1) * sizeof(double));
+    double p_zero = 1.0;
+    if (prob == NULL || next == NULL) {
+        LOG_error("WOTS_init: Allocation error!");
+        free(prob);
+        free(next);
+        return 0.0;
+    }
+
+    prob[0] = 1.0;
+    for (unsigned i = 0; i < wots->code_digits; i++) {
+        const unsigned digit_bits = (bits - i*log_w < log_w) ? bits - i*log_w : log_w;
+        const unsigned values = 1u << digit_bits;             // digit = r << (log_w - digit_bits), r < values
+        const unsigned spacing = 1u << (log_w - digit_bits);
+        if (i >= wots->num_chains) {   // zero digit
+            p_zero /= values;
+            continue;
+        }
+        double window = 0.0;   // sliding sum of prob[s - v] for v < values
+        for (unsigned s = 0; s <= target; s++) {
+            if (spacing == 1) {
+                window += prob[s];
+                if (s >= values) window -= prob[s - values];
+                next[s] = window / values;
+            } else {
+                next[s] = 0.0;
+                for (unsigned v = 0; v < values && v*spacing <= s; v++) next[s] += prob[s - v*spacing];
+                next[s] /= values;
+            }
+        }
+        double* tmp = prob; prob = next; next = tmp;
+    }
+    const double p = prob[target] * p_zero;
+    free(prob);
+    free(next);
+    return p;
+}
+
+
+int WOTS_init_ctx(WOTS_Wots* wots_out, const WOTS_Config* config, const HASH_Ctx* hash){
     WOTS_Wots wots;
+    memset(&wots, 0, sizeof(wots));
     wots.config = *config;
+    wots.hash = *hash;
+    wots.root = NULL;
+    if (config->code_base < 4 || config->code_base > 256 || (config->code_base & (config->code_base - 1)) != 0) {
+        LOG_error("WOTS_init: w=%d is not a power of two from 4 to 256.", config->code_base);
+        *wots_out = wots;
+        return -1;
+    }
+    int ret = 0;
     wots.csum_base = csum_base(config->cfg_hash.size, config->code_base);
-    wots.code_digits = (8*config->cfg_hash.size) / log2pow2(config->code_base);
-    wots.csum_digits = 2;
-    wots.has_seckey = 0;
-    wots.has_pubkey = 0;
-    wots.num_chains = wots.code_digits+wots.csum_digits;
+    wots.code_digits = code_digits(config->cfg_hash.size, config->code_base);
+    wots.csum_digits = (config->encoding == WOTS_ENC_TARGET_SUM) ? 0 : 2;
+    wots.num_chains = WOTS_num_chains(config);
+    wots.target_sum = config->target_sum;
+    if (config->encoding == WOTS_ENC_TARGET_SUM) {
+        if (config->zero_digits >= wots.code_digits) { LOG_error("WOTS_init: %d zero digits leave no chain.", config->zero_digits); ret = -1; }
+        if (config->target_sum == 0) wots.target_sum = (wots.num_chains*(config->code_base - 1) + 1) / 2;   // most likely sum, fewest counters to try
+        if (wots.target_sum > wots.num_chains*(config->code_base - 1)) { LOG_error("WOTS_init: target sum %d is out of reach.", wots.target_sum); ret = -1; }
+    }
+    if (wots.num_chains > WOTS_MAX_CHAINS) { LOG_error("WOTS_init: %d chains, at most %d are supported.", wots.num_chains, WOTS_MAX_CHAINS); ret = -1; }
+    if (ret == 0 && config->encoding == WOTS_ENC_TARGET_SUM) {
+        const double p = target_sum_probability(&wots);
+        if (p * WOTS_MAX_TARGET_TRIES < 1.0) {
+            LOG_error("WOTS_init: target sum %d with %d zero digits takes %.3g tries per signature, at most %u are allowed.",
+                wots.target_sum, config->zero_digits, 1.0 / p, WOTS_MAX_TARGET_TRIES);
+            ret = -1;
+        }
+    }
+    *wots_out = wots;
+    return ret;
+}
+
+
+WOTS_Wots WOTS_init(const WOTS_Config* config){
+    WOTS_Wots wots;
+    const HASH_Ctx hash = HASH_ctx_init(config->cfg_hash);
+    if (WOTS_init_ctx(&wots, config, &hash) != 0) return wots;   // rejected: root stays NULL
     wots.root = malloc(config->cfg_hash.size);
     return wots;
 }
@@ -244,8 +722,20 @@ void WOTS_free(WOTS_Wots* wots){
 
 
 
+void WOTS_set_verify_pool(WOTS_Wots* wots, POOL_Pool* pool, unsigned min_steps){
+    wots->verify_pool = pool;
+    wots->verify_min_steps = min_steps;
+}
+
+
 unsigned WOTS_num_chains(const WOTS_Config* config){
-    return (8*config->cfg_hash.size) / log2pow2(config->code_base) + 2;
+    const unsigned digits = code_digits(config->cfg_hash.size, config->code_base);
+    return (config->encoding == WOTS_ENC_TARGET_SUM) ? digits - config->zero_digits : digits + 2;
+}
+
+
+size_t WOTS_sig_size(const WOTS_Config* config){
+    return WOTS_num_chains(config)*config->cfg_hash.size + ((config->encoding == WOTS_ENC_TARGET_SUM) ? WOTS_COUNTER_SIZE : 0);
 }
 
 
@@ -261,6 +751,12 @@ void WOTS_import_seckey(WOTS_Wots* wots, const hash_t* seckey, const key_s hashk
 }
 
 
+void WOTS_wipe_seckey(WOTS_Wots* wots){
+    memset(wots->seed, 0, CFG_WOTS_SEED_SIZE);
+    wots->has_seckey = 0;
+}
+
+
 void WOTS_import_pubkey(WOTS_Wots* wots, const hash_t* pubkey, const key_s hashkey){
     memcpy(wots->root, pubkey, wots->config.cfg_hash.size);
     wots->hashkey = hashkey; 
@@ -272,41 +768,86 @@ void WOTS_import_pubkey(WOTS_Wots* wots, const hash_t* pubkey, const key_s hashk
 
 
 void WOTS_generate_pubkey(WOTS_Wots* wots){
-    const size_t size_hash = wots->config.cfg_hash.size;
-    hash_t chains[wots->num_chains*size_hash];
-
     /* check init */
     if (wots->has_seckey == 0) LOG_error("WOTS_gen: no seckey. Import seckey first.");
 
     /* The WOTS private key is derived from the seed. */
-    HASH_config(wots->config.cfg_hash);
-    expand_seed(wots, chains);
-    gen_chains(chains, wots, NULL, NULL);
-    HASH_keyhash(wots->root, (unsigned char*)chains, wots->num_chains*size_hash, &(wots->hashkey));   // hash all chains together
-    LOG_debug("Generating WOTS: %3d chains, seed=%.8s, root=%.8s, hkey=%.8s", wots->num_chains, HASH_hexstr( wots->seed ), HASH_hexstr( wots->root ), HASH_hexstr( (const hash_t*)&(wots->hashkey) ) );
+    stream_pubkey(wots, NULL, NULL, wots->root, 0, NULL);
+    LOG_debug("Generating WOTS: %3d chains, seed=%.8s, root=%.8s, hkey=%.8s", wots->num_chains, HASH_hexstr( wots->seed, 4 ), HASH_hexstr( wots->root, 4 ), HASH_hexstr( &(wots->hashkey), 4 ) );
     wots->has_pubkey = 1;
 }
 
 
 
+/**
+ * Derives the chain lengths of a signature and, with WOTS_ENC_TARGET_SUM,
+ * appends the counter to sig_out.
+ * \return 0 on success, -1 if no counter meets the target sum
+ */
+static int sign_lengths(const WOTS_Wots* wots, const hash_t* msg, int* lengths, WOTS_chains_t* sig_out){
+    if (wots->config.encoding == WOTS_ENC_TARGET_SUM) {
+        uint32_t counter;
+        if (target_sum_lengths(wots, lengths, msg, &counter) != 0) return -1;
+        WOTS_chains_t* ctr_out = sig_out + wots->num_chains*wots->config.cfg_hash.size;
+        ctr_out[0] = (WOTS_chains_t)(counter >> 24);
+        ctr_out[1] = (WOTS_chains_t)(counter >> 16);
+        ctr_out[2] = (WOTS_chains_t)(counter >> 8);
+        ctr_out[3] = (WOTS_chains_t)counter;
+    } else {
+        chain_lengths(wots, lengths, msg);
+    }
+    return 0;
+}
+
+
 /**
  * Takes a n-byte message and the 32-byte seed for the private key to compute a
  * signature that is placed at 'sig'.
  */
-void WOTS_sign(const WOTS_Wots* wots, const hash_t* msg, WOTS_chains_t* sig_out){
+int WOTS_sign(const WOTS_Wots* wots, const hash_t* msg, WOTS_chains_t* sig_out){
 
     if (wots->has_seckey == 0) LOG_error("WOTS_sign: no seckey. Import seckey first.");  
-    int lengths[wots->num_chains];
+    int lengths[wots->code_digits + wots->csum_digits];   // target sum: also the zero digits without chain
 
-    chain_lengths(wots, lengths, msg);
+    if (sign_lengths(wots, msg, lengths, sig_out) != 0) return -1;
 
     /* The WOTS+ private key is derived from the seed. */
-    HASH_config(wots->config.cfg_hash);
-    expand_seed(wots, sig_out);
+    expand_seed(wots, sig_out, NULL, 0, wots->num_chains);
 
     gen_chains(sig_out, wots, NULL, lengths);
-    LOG_trace("Signed: seed=%.8s, root=%.8s, sig=%.8s", HASH_hexstr( wots->seed ), HASH_hexstr( wots->root ), HASH_hexstr( sig_out ) );
+    LOG_trace("Signed: seed=%.8s, root=%.8s, sig=%.8s", HASH_hexstr( wots->seed, 4 ), HASH_hexstr( wots->root, 4 ), HASH_hexstr( sig_out, 4 ) );
+    return 0;
+}
 
+
+size_t WOTS_checkpoints_size(const WOTS_Wots* wots, unsigned interval){
+    return checkpoint_offset(wots, wots->num_chains, interval) * wots->config.cfg_hash.size;
+}
+
+
+void WOTS_generate_pubkey_checkpoints(WOTS_Wots* wots, unsigned interval, hash_t* checkpoints){
+    if (wots->has_seckey == 0) LOG_error("WOTS_gen: no seckey. Import seckey first.");
+    stream_pubkey(wots, NULL, NULL, wots->root, interval, checkpoints);
+    wots->has_pubkey = 1;
+}
+
+
+int WOTS_sign_checkpoints(const WOTS_Wots* wots, const hash_t* msg, unsigned interval, const hash_t* checkpoints, WOTS_chains_t* sig_out){
+    const size_t size_hash = wots->config.cfg_hash.size;
+    int lengths[wots->code_digits + wots->csum_digits];
+    int starts[wots->num_chains];
+
+    if (sign_lengths(wots, msg, lengths, sig_out) != 0) return -1;
+
+    // start every chain at the closest checkpoint below its length
+    for (int i = 0; i < wots->num_chains; i++) {
+        unsigned k = lengths[i] / interval;
+        if (k >= chain_checkpoints(wots, i, interval)) k = chain_checkpoints(wots, i, interval) - 1;
+        starts[i] = k*interval;
+        memcpy(sig_out + i*size_hash, checkpoints + (checkpoint_offset(wots, i, interval) + k)*size_hash, size_hash);
+    }
+    gen_chains(sig_out, wots, starts, lengths);
+    return 0;
 }
 
 
@@ -318,7 +859,7 @@ bool WOTS_verify(const WOTS_Wots* wots, const hash_t* msg, const WOTS_chains_t*
 
     bool isvalid = (bool)(memcmp(&msg_root, wots->root, wots->config.cfg_hash.size) == 0);  // 0 means equal
     if (!isvalid){
-        LOG_warn("Verify failed: sig=%.8s, msg_root=%.8s, wots_root=%.8s", HASH_hexstr( sig ), HASH_hexstr(msg_root), HASH_hexstr(wots->root) );
+        LOG_warn("Verify failed: sig=%.8s, msg_root=%.8s, wots_root=%.8s", HASH_hexstr( sig, 4 ), HASH_hexstr( msg_root, 4 ), HASH_hexstr( wots->root, 4 ) );
     } 
     return isvalid;
 }
@@ -330,15 +871,39 @@ bool WOTS_verify(const WOTS_Wots* wots, const hash_t* msg, const WOTS_chains_t*
  */
 void WOTS_root_from_sig(const WOTS_Wots* wots, const hash_t* msg, const WOTS_chains_t* sig, hash_t* root_out)
 {
-    int lengths[wots->num_chains];
-    WOTS_chains_t chains[wots->num_chains*wots->config.cfg_hash.size];
+    int lengths[wots->code_digits + wots->csum_digits];   // target sum: also the zero digits without chain
+
+    if (wots->config.encoding == WOTS_ENC_TARGET_SUM) {
+        const WOTS_chains_t* ctr = sig + wots->num_chains*wots->config.cfg_hash.size;
+        uint32_t counter = ((uint32_t)ctr[0] << 24) | ((uint32_t)ctr[1] << 16) | ((uint32_t)ctr[2] << 8) | ctr[3];
+        hash_t digest[wots->config.cfg_hash.size];
+        encode_digests(wots, msg, counter, 1, digest);
+        base_w(wots, digest, lengths);
+        if (!meets_target(wots, lengths)) {   // lengths would not be bound to the digest
+            LOG_warn("WOTS_root_from_sig: counter %u misses the target sum %d.", counter, wots->target_sum);
+            memset(root_out, 0, wots->config.cfg_hash.size);
+            return;
+        }
+    } else {
+        chain_lengths(wots, lengths, msg);
+    }
 
-    HASH_config(wots->config.cfg_hash);
-    chain_lengths(wots, lengths, msg);
-    memcpy(chains, sig, wots->num_chains*wots->config.cfg_hash.size);
+    unsigned total_steps = 0;
+    for (int i = 0; i < wots->num_chains; i++) {
+        total_steps += ((i < wots->code_digits) ? wots->config.code_base : wots->csum_base) - 1 - lengths[i];
+    }
+    if (wots->verify_pool == NULL || total_steps < wots->verify_min_steps) {
+        stream_pubkey(wots, sig, lengths, root_out, 0, NULL);
+        return;
+    }
 
-    gen_chains(chains, wots, lengths, NULL);
-    HASH_keyhash(root_out, (unsigned char*)chains, wots->num_chains*wots->config.cfg_hash.size, &(wots->hashkey) );   // hash all chains together
+    // the workers need all chains at once
+    WOTS_chains_t chains[wots->num_chains*wots->config.cfg_hash.size];
+    memcpy(chains, sig, wots->num_chains*wots->config.cfg_hash.size);
+    gen_chains_parallel(chains, wots, lengths, total_steps);
+    HASH_Phase_t phase = HASH_set_phase(HASH_PHASE_WOTS_PK);
+    HASH_keyhash(&(wots->hash), root_out, (unsigned char*)chains, wots->num_chains*wots->config.cfg_hash.size, &(wots->hashkey) );   // hash all chains together
+    HASH_set_phase(phase);
 }
 
 
@@ -18,6 +18,7 @@
 
 // own includes
 #include "hash.h"
+#include "util/pool.h"
 
 
 // ============================================================================
@@ -28,27 +29,57 @@
 #define CFG_WOTS_SEED_SIZE 32
 #endif
 
+#define WOTS_COUNTER_SIZE 4  // counter appended to the chains of a WOTS_ENC_TARGET_SUM signature
+#define WOTS_MAX_CHAINS 255  // chain indices are one key byte, 255 marks the seed key
+#define WOTS_MAX_TARGET_TRIES (1u << 20)  // WOTS_ENC_TARGET_SUM: most counters a signature may take on average
+
 
 // ============================================================================
 // public types
 // ============================================================================
 
+/*
+ * Derivation of the chain seeds (private key) from the WOTS seed.
+ */
+typedef enum {
+    WOTS_SEED_CHAINED = 0,  // seed i = H(seed i-1 XOR seed), serial
+    WOTS_SEED_INDEXED = 1,  // seed i = H(seed || i), independent, computed in parallel lanes
+} WOTS_Seed_Mode_t;
+
+
+/*
+ * Encoding of the message digest into chain lengths.
+ */
+typedef enum {
+    WOTS_ENC_CHECKSUM = 0,    // base-w digits of the digest and two MinWOTS checksum chains
+    WOTS_ENC_TARGET_SUM = 1,  // base-w digits of H(digest || counter) with a fixed digit sum, no checksum chains
+} WOTS_Encoding_t;
+
+
 typedef struct {
     HASH_Config cfg_hash;
     uint16_t code_base;
+    uint8_t seed_mode;    // WOTS_Seed_Mode_t, 0 if omitted in an initializer
+    uint8_t encoding;     // WOTS_Encoding_t, 0 if omitted in an initializer
+    uint8_t zero_digits;  // WOTS_ENC_TARGET_SUM: last digits that must be zero, their chains are dropped
+    uint16_t target_sum;  // WOTS_ENC_TARGET_SUM: digit sum of the other digits, 0 for the most likely sum
 } WOTS_Config;
 
 
 typedef struct {
     uint8_t seed[CFG_WOTS_SEED_SIZE];   // private key => make it a pointer?
     WOTS_Config config;
-    uint8_t num_chains;
+    uint16_t num_chains;
     uint8_t csum_base;
     uint8_t has_seckey;
     uint8_t has_pubkey;
-    uint8_t code_digits;  // deprecated?
-    uint8_t csum_digits;  // deprecated
+    uint16_t code_digits;  // message digits of log2(w) bits
+    uint8_t csum_digits;   // checksum digits of base csum_base
+    uint16_t target_sum;   // digit sum of WOTS_ENC_TARGET_SUM, the sign steps of every signature
     key_s hashkey;   // security key
+    HASH_Ctx hash;   // hash backend for config.cfg_hash
+    POOL_Pool* verify_pool;      // workers of WOTS_root_from_sig(), NULL verifies single-threaded
+    unsigned verify_min_steps;   // fewer remaining chain steps are verified single-threaded
     hash_t* root;   // public key
     //hash_t* chains;   // chains expanded
 } WOTS_Wots;
@@ -60,6 +91,9 @@ typedef unsigned char WOTS_chains_t;
 // configs
 extern const WOTS_Config WOTS_SHA2_256_W4      ;
 extern const WOTS_Config WOTS_SHA2_256_W16     ;
+extern const WOTS_Config WOTS_SHA2_256_W32     ;
+extern const WOTS_Config WOTS_SHA2_256_W64     ;
+extern const WOTS_Config WOTS_SHA2_256_W128    ;
 extern const WOTS_Config WOTS_SHA2_256_W256    ;
 
 extern const WOTS_Config WOTS_BLAKE2B_128_W4   ;
@@ -69,11 +103,27 @@ extern const WOTS_Config WOTS_BLAKE2B_128_W256 ;
 extern const WOTS_Config WOTS_BLAKE2B_160_W4   ;
 extern const WOTS_Config WOTS_BLAKE2B_160_W16  ;
 extern const WOTS_Config WOTS_BLAKE2B_160_W32  ;
+extern const WOTS_Config WOTS_BLAKE2B_160_W64  ;
+extern const WOTS_Config WOTS_BLAKE2B_160_W128 ;
 extern const WOTS_Config WOTS_BLAKE2B_160_W256 ;
 
 extern const WOTS_Config WOTS_BLAKE2B_256_W4   ;
 extern const WOTS_Config WOTS_BLAKE2B_256_W16  ;
 
+extern const WOTS_Config WOTS_BLAKE2B_TW_160_W16;
+extern const WOTS_Config WOTS_BLAKE2B_TW_256_W16;
+
+extern const WOTS_Config WOTS_SHA2_256_W16_INDEXED;
+extern const WOTS_Config WOTS_BLAKE2B_TW_160_W16_INDEXED;
+
+extern const WOTS_Config WOTS_SHA2_256_W16_TARGET;
+extern const WOTS_Config WOTS_BLAKE2B_160_W16_TARGET;
+
+// WOTS+C: target sum above the most likely sum and one zero digit. The signer tries
+// more counters, the verifier walks fewer steps and one chain less.
+extern const WOTS_Config WOTS_SHA2_256_W16_WOTSC;
+extern const WOTS_Config WOTS_BLAKE2B_160_W16_WOTSC;
+
 
 // ============================================================================
 // public functions
@@ -83,13 +133,49 @@ extern const WOTS_Config WOTS_BLAKE2B_256_W16  ;
 // returns the number of hash chains
 unsigned WOTS_num_chains(const WOTS_Config* config);
 
+// returns the size of a signature in bytes: the chains and, with WOTS_ENC_TARGET_SUM, the counter
+size_t WOTS_sig_size(const WOTS_Config* config);
+
+
+/**
+ * Splits the chains of WOTS_root_from_sig() (and thereby WOTS_verify()) of this
+ * wots across the workers of pool and the verifying thread. The caller owns the
+ * pool and destroys it after the last verification that uses it. Several threads
+ * may verify at once and share the pool. Each thread gets at least one batch of
+ * HASH_lanes() chains.
+ * \param[in] pool worker threads from POOL_create(), NULL verifies single-threaded
+ * \param[in] min_steps signatures with fewer remaining chain steps are verified single-threaded.
+ *            The break-even depends on the machine, measure it there.
+ */
+void WOTS_set_verify_pool(WOTS_Wots* wots, POOL_Pool* pool, unsigned min_steps);
+
 
 /**
  * Allocates and initializes the WOTS data structure.
+ * Rejects a config that WOTS_init_ctx() rejects: the returned root is NULL.
  */
 WOTS_Wots WOTS_init(const WOTS_Config* config);
 
 
+/**
+ * Initializes the WOTS data structure with a resolved hash context, without
+ * allocating: no root, so it needs no WOTS_free(). Enough for WOTS_root_from_sig().
+ * With WOTS_ENC_TARGET_SUM, a target that a random digest meets less often than
+ * once in WOTS_MAX_TARGET_TRIES counters is rejected: the signer gives up after
+ * 2^32 counters, which this makes a chance below e^-4096.
+ * \return 0 on success, -1 if the config is invalid
+ */
+int WOTS_init_ctx(WOTS_Wots* wots, const WOTS_Config* config, const HASH_Ctx* hash);
+
+
+/**
+ * Computes the chain seed (start of chain idx) in WOTS_SEED_INDEXED mode
+ * without deriving the other chain seeds.
+ * \param[out] out n-byte chain seed
+ */
+void WOTS_chain_seed(const WOTS_Wots* wots, unsigned idx, hash_t* out);
+
+
 /**
  * Frees allocated memory of the WOTS data structure.
  */
@@ -121,12 +207,43 @@ void WOTS_import_seckey(WOTS_Wots* wots, const hash_t* seckey, const key_s hashk
 void WOTS_import_pubkey(WOTS_Wots* wots, const hash_t* pubkey, const key_s hashkey);
 
 
+/**
+ * Wipes the imported private key, e.g. after its one signature.
+ */
+void WOTS_wipe_seckey(WOTS_Wots* wots);
+
+
 /**
  * Takes a n-byte message digest and the wots to compute a
- * signature that is writen to sig_out.
+ * signature that is writen to sig_out (WOTS_sig_size() bytes).
+ * With WOTS_ENC_TARGET_SUM, it searches the smallest counter for which the
+ * digits of H(msg || counter) meet the target sum and zero digits and appends the counter.
+ * \return 0 on success, -1 if no 32-bit counter meets the target
+ */
+int WOTS_sign(const WOTS_Wots* wots, const hash_t* msg, WOTS_chains_t* sig_out);
+
+
+
+/**
+ * Returns the size in bytes of the chain checkpoints of one key: the chain
+ * values at 0, interval, 2*interval, ... below the end of each chain.
+ */
+size_t WOTS_checkpoints_size(const WOTS_Wots* wots, unsigned interval);
+
+
+/**
+ * Like WOTS_generate_pubkey(), but also stores the chain checkpoints
+ * (WOTS_checkpoints_size() bytes) for WOTS_sign_checkpoints(). They are secret key material.
  */
-void WOTS_sign(const WOTS_Wots* wots, const hash_t* msg, WOTS_chains_t* sig_out);
+void WOTS_generate_pubkey_checkpoints(WOTS_Wots* wots, unsigned interval, hash_t* checkpoints);
+
 
+/**
+ * Like WOTS_sign(), but starts each chain at the closest checkpoint below its
+ * length instead of the seed: at most interval-1 steps per chain.
+ * \return 0 on success, -1 if no 32-bit counter meets the target
+ */
+int WOTS_sign_checkpoints(const WOTS_Wots* wots, const hash_t* msg, unsigned interval, const hash_t* checkpoints, WOTS_chains_t* sig_out);
 
 
 /**
@@ -139,6 +256,7 @@ bool WOTS_verify(const WOTS_Wots* wots, const hash_t* msg, const WOTS_chains_t*
 
 /**
  * Takes a WOTS signature and an n-byte message, computes a WOTS root hash (public key).
+ * A WOTS_ENC_TARGET_SUM signature whose counter misses the target sum or zero digits yields a zero root.
  */
 void WOTS_root_from_sig(const WOTS_Wots* wots, const hash_t* msg, const WOTS_chains_t* sig, hash_t* root_out);
 